@@ -0,0 +1,255 @@
+/*
+** Size-class allocator for small blocks
+** See Copyright Notice in lua.h
+*/
+
+#define lallocator_c
+#define LUA_CORE
+
+#include <lprefix.hpp>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <lallocator.hpp>
+#include <llimits.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define ARENA_MMAP      1
+#else
+#define ARENA_MMAP      0
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+#endif
+
+/*
+** Every page starts with this header; its blocks follow it. Pages are
+** aligned to their size, so the page of a block is found by masking
+** its address.
+*/
+struct LuaArena::Page
+{
+  Page* next;  /* in 'avail' list of its class */
+  Page* prev;
+  Page* allnext;  /* in 'all' list */
+  Page* allprev;
+  void* free;  /* list of free blocks */
+  char* unused;  /* blocks never allocated start here */
+  unsigned used;  /* blocks in use */
+  int sizeclass;
+  bool inavail;  /* is it in an 'avail' list? */
+};
+
+#define PAGEHEADER      ((sizeof(LuaArena::Page) + 63) & ~size_t(63))
+
+#define sizeclass(s)    cast_int(((s) - 1) >> 4)
+#define classsize(c)    (cast(size_t, (c) + 1) << 4)
+
+#define pageof(b)  \
+  reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(b) & ~uintptr_t(PAGESIZE - 1))
+
+#define pageend(p)      (reinterpret_cast<char*>(p) + PAGESIZE)
+
+#if ARENA_MMAP
+
+/*
+** map twice the page size and unmap the ends, to get an aligned page
+*/
+static void* mappage(size_t size) {
+  void* m = mmap(nullptr, 2 * size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED)
+    return nullptr;
+  char* start = static_cast<char*>(m);
+  char* page = reinterpret_cast<char*>(
+    (reinterpret_cast<uintptr_t>(start) + size - 1) & ~uintptr_t(size - 1));
+  if (page > start)
+    munmap(start, page - start);
+  if (page + size < start + 2 * size)
+    munmap(page + size, (start + 2 * size) - (page + size));
+  return page;
+}
+
+static void unmappage(void* page, size_t size) {
+  munmap(page, size);
+}
+
+#elif defined(_WIN32)
+
+/* the C runtime of Windows has no 'aligned_alloc' */
+static void* mappage(size_t size) {
+  return _aligned_malloc(size, size);
+}
+
+static void unmappage(void* page, size_t size) {
+  (void)size;
+  _aligned_free(page);
+}
+
+#else
+
+static void* mappage(size_t size) {
+  return std::aligned_alloc(size, size);
+}
+
+static void unmappage(void* page, size_t size) {
+  (void)size;
+  std::free(page);
+}
+
+#endif
+
+void LuaArena::linkpage(Page** list, Page* p)
+{
+  p->prev = nullptr;
+  p->next = *list;
+  if (*list != nullptr)
+    (*list)->prev = p;
+  *list = p;
+  p->inavail = true;
+}
+
+void LuaArena::unlinkpage(Page** list, Page* p)
+{
+  if (p->prev != nullptr)
+    p->prev->next = p->next;
+  else
+    *list = p->next;
+  if (p->next != nullptr)
+    p->next->prev = p->prev;
+  p->inavail = false;
+}
+
+LuaArena::~LuaArena()
+{
+  while (this->all != nullptr)
+  {
+    Page* p = this->all;
+    lua_assert(this->dropping || p->used == 0);
+    this->all = p->allnext;
+    unmappage(p, PAGESIZE);
+  }
+}
+
+LuaArena::Page* LuaArena::newpage(int sc)
+{
+  Page* p = this->cache;
+  if (p != nullptr)
+  {
+    this->cache = p->next;
+    this->ncached--;
+  }
+  else
+  {
+    p = static_cast<Page*>(mappage(PAGESIZE));
+    if (p == nullptr)
+      return nullptr;
+    p->allprev = nullptr;
+    p->allnext = this->all;
+    if (this->all != nullptr)
+      this->all->allprev = p;
+    this->all = p;
+    this->npages++;
+  }
+  p->free = nullptr;
+  p->unused = reinterpret_cast<char*>(p) + PAGEHEADER;
+  p->used = 0;
+  p->sizeclass = sc;
+  linkpage(&this->avail[sc], p);
+  return p;
+}
+
+void LuaArena::releasepage(Page* p)
+{
+  if (this->ncached < MAXCACHED)
+  {
+    p->next = this->cache;
+    this->cache = p;
+    this->ncached++;
+  }
+  else
+  {
+    if (p->allprev != nullptr)
+      p->allprev->allnext = p->allnext;
+    else
+      this->all = p->allnext;
+    if (p->allnext != nullptr)
+      p->allnext->allprev = p->allprev;
+    unmappage(p, PAGESIZE);
+    this->npages--;
+  }
+}
+
+void* LuaArena::allocblock(int sc)
+{
+  size_t size = classsize(sc);
+  Page* p = this->avail[sc];
+  void* b;
+  if (p == nullptr && (p = newpage(sc)) == nullptr)
+    return nullptr;
+  b = p->free;
+  if (b != nullptr)
+    p->free = *static_cast<void**>(b);
+  else
+  {
+    b = p->unused;
+    p->unused += size;
+  }
+  p->used++;
+  if (p->free == nullptr && p->unused + size > pageend(p))
+    unlinkpage(&this->avail[sc], p);  /* page is full */
+  return b;
+}
+
+/*
+** a page that becomes empty is released, unless it is the only one of
+** its class with free blocks (to avoid remapping a page for a class
+** that keeps allocating and freeing a few blocks)
+*/
+void LuaArena::freeblock(void* b, int sc)
+{
+  Page* p = pageof(b);
+  lua_assert(p->sizeclass == sc && p->used > 0);
+  *static_cast<void**>(b) = p->free;
+  p->free = b;
+  if (!p->inavail)
+    linkpage(&this->avail[sc], p);
+  if (--p->used == 0 && (p->next != nullptr || p->prev != nullptr))
+  {
+    unlinkpage(&this->avail[sc], p);
+    releasepage(p);
+  }
+}
+
+void* LuaArena::realloc(void* block, size_t osize, size_t nsize)
+{
+  void* newblock;
+  if (nsize == 0 && this->dropping && serves(osize))
+    return nullptr;  /* its page goes away with the arena */
+  if (block != nullptr && serves(osize) && serves(nsize) &&
+      sizeclass(osize) == sizeclass(nsize))
+    return block;  /* same class: nothing to do */
+  if (nsize == 0)
+    newblock = nullptr;
+  else if (serves(nsize))
+    newblock = allocblock(sizeclass(nsize));
+  else if (block != nullptr && !serves(osize))
+    return LuaAllocator<void>::alloc(block, osize, nsize);  /* not ours */
+  else
+    newblock = LuaAllocator<void>::alloc(nullptr, 0, nsize);
+  if (newblock == nullptr && nsize != 0)
+    return nullptr;  /* keep the old block */
+  if (block != nullptr)
+  {
+    if (newblock != nullptr)
+      std::memcpy(newblock, block, (osize < nsize) ? osize : nsize);
+    if (serves(osize))
+      freeblock(block, sizeclass(osize));
+    else
+      LuaAllocator<void>::free(block);
+  }
+  return newblock;
+}
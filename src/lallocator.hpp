@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdlib>
+
 template<class T>
 class LuaAllocator
 {
@@ -21,3 +24,80 @@ public:
     ::free(ptr);
   }
 };
+
+/* give new states a 'LuaArena' (see 'LuaHeap') */
+#if !defined(LUA_USE_ARENA)
+#define LUA_USE_ARENA           1
+#endif
+
+/*
+** Where a state takes its memory from: 'System' is 'LuaAllocator'
+** for everything; 'Arena' serves small blocks from a 'LuaArena' of its
+** own and only the larger ones from 'LuaAllocator'.
+*/
+enum class LuaHeap
+{
+  System,
+  Arena,
+};
+
+#define LUAI_DEFAULTHEAP        (LUA_USE_ARENA ? LuaHeap::Arena : LuaHeap::System)
+
+/* largest block served by a 'LuaArena' */
+#define LUAI_ARENAMAX           512
+
+/*
+** Small-object allocator of a state. Blocks of each size class (a
+** multiple of 16 bytes) are carved from 64 KB pages mapped for that
+** class; each page keeps a list of its free blocks. Pages with free
+** blocks are linked per class, and a page that becomes empty goes back
+** to a small cache or to the system. A 'LuaArena' belongs to a single
+** state, so it needs no locks. Block sizes must be exact: a block is
+** freed into the class of the size it is freed with. Pages keep no mark
+** bitmaps (mark bits stay in the objects and the collector sweeps its
+** lists), so pages are released wholesale only when the state is closed
+** (see 'dropall').
+*/
+class LuaArena
+{
+public:
+  LuaArena() = default;
+  ~LuaArena();
+  LuaArena(const LuaArena&) = delete;
+  LuaArena& operator=(const LuaArena&) = delete;
+
+  /* same contract as a 'lua_Alloc'; 'osize' is 0 for new blocks */
+  void* realloc(void* block, size_t osize, size_t nsize);
+
+  /*
+  ** stop freeing blocks one by one: all pages are unmapped at once
+  ** when the arena is destroyed (used when closing a state)
+  */
+  void dropall() { this->dropping = true; }
+
+  /* bytes of the pages in use or cached */
+  size_t mappedbytes() const { return this->npages * PAGESIZE; }
+
+  static bool serves(size_t size) { return size != 0 && size <= LUAI_ARENAMAX; }
+
+private:
+  struct Page;
+
+  static constexpr size_t PAGESIZE = 64 * 1024;
+  static constexpr int NCLASSES = LUAI_ARENAMAX / 16;
+  static constexpr int MAXCACHED = 8;  /* empty pages kept for reuse */
+
+  static void linkpage(Page** list, Page* p);
+  static void unlinkpage(Page** list, Page* p);
+  void* allocblock(int sc);
+  void freeblock(void* block, int sc);
+  Page* newpage(int sc);
+  void releasepage(Page* page);
+
+  Page* avail[NCLASSES] = {};  /* pages with free blocks, per class */
+  Page* cache = nullptr;  /* empty pages */
+  Page* all = nullptr;  /* all mapped pages */
+  int ncached = 0;
+  size_t npages = 0;
+  bool dropping = false;
+};
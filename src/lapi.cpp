@@ -285,6 +285,7 @@ LUA_API int lua_isnumber(lua_State *L, int idx)
 {
   lua_Number n;
   const TValue *o = index2addr(L, idx);
+  luaS_flatvalue(L, o);
   return tonumber(o, &n);
 }
 
@@ -304,6 +305,8 @@ LUA_API int lua_rawequal(lua_State *L, int index1, int index2)
 {
   StkId o1 = index2addr(L, index1);
   StkId o2 = index2addr(L, index2);
+  luaS_unrope(L, o1);
+  luaS_unrope(L, o2);
   return (isvalid(o1) && isvalid(o2)) ? luaV_rawequalobj(o1, o2) : 0;
 }
 
@@ -345,7 +348,7 @@ LUA_API int lua_compare(lua_State *L, int index1, int index2, int op)
 
 LUA_API size_t lua_stringtonumber(lua_State *L, const char *s)
 {
-  size_t sz = luaO_str2num(s, L->top);
+  size_t sz = luaO_str2num(L, s, L->top);
   if (sz != 0)
     api_incr_top(L);
   return sz;
@@ -355,6 +358,7 @@ LUA_API lua_Number lua_tonumberx(lua_State *L, int idx, int *pisnum)
 {
   lua_Number n;
   const TValue *o = index2addr(L, idx);
+  luaS_flatvalue(L, o);
   int isnum = tonumber(o, &n);
   if (!isnum)
     n = 0; /* call to 'tonumber' may change 'n' even if it fails */
@@ -367,6 +371,7 @@ LUA_API lua_Integer lua_tointegerx(lua_State *L, int idx, int *pisnum)
 {
   lua_Integer res;
   const TValue *o = index2addr(L, idx);
+  luaS_flatvalue(L, o);
   int isnum = tointeger(o, &res);
   if (!isnum)
     res = 0; /* call to 'tointeger' may change 'n' even if it fails */
@@ -398,6 +403,8 @@ LUA_API const char *lua_tolstring(lua_State *L, int idx, size_t *len)
     o = index2addr(L, idx);  /* previous call may reallocate the stack */
     lua_unlock(L);
   }
+  luaS_flatvalue(L, o);
+  luaS_expose(o);
   if (len != nullptr)
     *len = vslen(o);
   return svalue(o);
@@ -484,8 +491,10 @@ LUA_API void lua_pushnumber(lua_State *L, lua_Number n)
 LUA_API void lua_pushinteger(lua_State *L, lua_Integer n)
 {
   lua_lock(L);
-  setivalue(L->top, n);
+  setivalue(L, L->top, n);
   api_incr_top(L);
+  if (iscollectable(L->top - 1))  /* boxed (see LUA_NANBOXING)? */
+    luaC_checkGC(L);
   lua_unlock(L);
 }
 
@@ -498,7 +507,7 @@ LUA_API const char *lua_pushlstring(lua_State *L, const char *s, size_t len)
 {
   TString *ts;
   lua_lock(L);
-  ts = (len == 0) ? luaS_new(L, "") : luaS_newlstr(L, s, len);
+  ts = (len == 0) ? luaS_new(L, "") : luaS_newtransient(L, s, len);
   setsvalue2s(L, L->top, ts);
   api_incr_top(L);
   luaC_checkGC(L);
@@ -506,6 +515,28 @@ LUA_API const char *lua_pushlstring(lua_State *L, const char *s, size_t len)
   return getstr(ts);
 }
 
+/*
+** Pushes on the stack the substring of 'len' bytes that starts 'i'
+** bytes into the string at index 'idx'. A long substring may share the
+** bytes of that string (see 'luaS_newslice'), so no pointer to them is
+** returned: they may not be followed by a '\0'.
+*/
+LUA_API void lua_pushsubstring(lua_State *L, int idx, size_t i, size_t len)
+{
+  StkId o;
+  TString *ts;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  api_check(L, i <= vslen(o) && len <= vslen(o) - i, "invalid substring");
+  luaS_unrope(L, o);
+  ts = (len == 0) ? luaS_new(L, "") : luaS_newslice(L, tsvalue(o), i, len);
+  setsvalue2s(L, L->top, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
 LUA_API const char *lua_pushstring(lua_State *L, const char *s)
 {
   lua_lock(L);
@@ -658,7 +689,7 @@ LUA_API LuaType lua_geti(lua_State *L, int idx, lua_Integer n)
   }
   else
   {
-    setivalue(L->top, n);
+    setivalue(L, L->top, n);
     api_incr_top(L);
     luaV_finishget(L, t, L->top - 1, L->top - 1, slot);
   }
@@ -672,6 +703,7 @@ LUA_API LuaType lua_rawget(lua_State *L, int idx)
   lua_lock(L);
   t = index2addr(L, idx);
   api_check(L, ttistable(t), "table expected");
+  luaS_unrope(L, L->top - 1);
   setobj2s(L, L->top - 1, luaH_get(hvalue(t), L->top - 1));
   lua_unlock(L);
   return ttnov(L->top - 1);
@@ -816,7 +848,7 @@ LUA_API void lua_seti(lua_State *L, int idx, lua_Integer n)
     L->top--; /* pop value */
   else
   {
-    setivalue(L->top, n);
+    setivalue(L, L->top, n);
     api_incr_top(L);
     luaV_finishset(L, t, L->top - 1, L->top - 2, slot);
     L->top -= 2;  /* pop value and key */
@@ -834,6 +866,7 @@ LUA_API void lua_rawset(lua_State *L, int idx)
   api_check(L, ttistable(o), "table expected");
   slot = luaH_set(L, hvalue(o), L->top - 2);
   setobj2t(L, slot, L->top - 1);
+  luaH_commit(L, hvalue(o), slot);
   invalidateTMcache(hvalue(o));
   luaC_barrierback(L, hvalue(o), L->top-1);
   L->top -= 2;
@@ -869,6 +902,90 @@ LUA_API void lua_rawsetp(lua_State *L, int idx, const void *p)
   lua_unlock(L);
 }
 
+/*
+** Bulk versions of 'lua_rawseti'/'lua_rawset': they store all the
+** values with one barrier and (for 'lua_rawsetn') at most one resize.
+*/
+
+/* the backward barrier for storing the 'n' values above 'first' */
+static void bulkbarrier(lua_State *L, Table *t, StkId first, int n) {
+  for (StkId o = first; o < first + n; o++)
+    if (iscollectable(o))
+    {
+      luaC_barrierback(L, t, o);
+      if (!isblack(t))
+        return;  /* table is gray; no more barriers needed */
+    }
+}
+
+/* t[i], ..., t[i + n - 1] = the 'n' values on the top (popped) */
+LUA_API void lua_rawsetn(lua_State *L, int idx, lua_Integer i, int n)
+{
+  StkId o;
+  Table *t;
+  StkId first;
+  lua_lock(L);
+  api_checknelems(L, n);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  t = hvalue(o);
+  first = L->top - n;
+  /* preallocate the array part when the span starts inside it or
+     right after it (as a table constructor does) */
+  if (0 < i && i <= cast(lua_Integer, t->sizearray) + 1)
+  {
+    lua_Integer last = i - 1 + n;
+    if (last > cast(lua_Integer, t->sizearray) && last <= MAX_INT)
+      luaH_resizearray(L, t, cast(uint32_t, last));
+  }
+  for (int j = 0; j < n; j++)
+    luaH_setint(L, t, i + j, first + j);
+  bulkbarrier(L, t, first, n);
+  L->top = first;
+  lua_unlock(L);
+}
+
+/* t[k1] = v1, ..., t[kn] = vn, for the 'n' pairs on the top (popped) */
+LUA_API void lua_rawsetpairs(lua_State *L, int idx, int n)
+{
+  StkId o;
+  Table *t;
+  StkId first;
+  lua_lock(L);
+  api_checknelems(L, 2 * n);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  t = hvalue(o);
+  first = L->top - 2 * n;
+  for (StkId p = first; p < L->top; p += 2)
+  {
+    TValue *slot = luaH_set(L, t, p);
+    setobj2t(L, slot, p + 1);
+    luaH_commit(L, t, slot);
+  }
+  invalidateTMcache(t);
+  bulkbarrier(L, t, first, 2 * n);
+  L->top = first;
+  lua_unlock(L);
+}
+
+/*
+** Makes room in a table for 'narr' elements in its array part and
+** 'nrec' entries in its other part, so that filling it up to those
+** sizes needs no more rehashes. (It never shrinks the table.)
+*/
+LUA_API void lua_reservetable(lua_State *L, int idx, int narr, int nrec)
+{
+  StkId o;
+  lua_lock(L);
+  o = index2addr(L, idx);
+  api_check(L, ttistable(o), "table expected");
+  api_check(L, narr >= 0 && nrec >= 0, "invalid table size");
+  luaH_reserve(L, hvalue(o), cast(uint32_t, narr), cast(uint32_t, nrec));
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
 LUA_API int lua_setmetatable(lua_State *L, int objindex)
 {
   Table* mt;
@@ -1115,7 +1232,8 @@ LUA_API int lua_gc(lua_State *L, int what, int data)
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause) /* end of cycle? */
+      /* end of cycle? (each step in generational mode is a whole one) */
+      if (debt > 0 && (g->gcstate == GCSpause || isdecGCmodegen(g)))
         res = 1; /* signal it */
       break;
     }
@@ -1135,12 +1253,54 @@ LUA_API int lua_gc(lua_State *L, int what, int data)
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      res = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      luaC_changemode(L, (what == LUA_GCGEN) ? KGC_GEN : KGC_INC);
+      break;
+    }
+    case LUA_GCSETMINORMUL: {
+      res = g->genminormul;
+      if (data < 1)
+        data = 1; /* avoid a collection at each allocation */
+      g->genminormul = data;
+      break;
+    }
+    case LUA_GCSETMAJORMUL: {
+      res = g->genmajormul;
+      if (data < 1)
+        data = 1; /* avoid a major collection at each step */
+      g->genmajormul = data;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
   return res;
 }
 
+LUA_API int lua_gcstats(lua_State *L, lua_GCStats *s)
+{
+  int res;
+  lua_lock(L);
+  res = luaC_getstats(L, s);
+  lua_unlock(L);
+  return res;
+}
+
+LUA_API int lua_memusage(lua_State *L, size_t *bytes)
+{
+  int res;
+  lua_lock(L);
+  res = luaC_memusage(L, bytes);
+  lua_unlock(L);
+  return res;
+}
+
+LUA_API int lua_memsites(lua_State *L, lua_MemSiteFn f, void *ud)
+{
+  return luaC_memsites(L, f, ud);  /* 'f' may use the API */
+}
+
 /*
 ** miscellaneous functions
 */
@@ -1153,7 +1313,10 @@ LUA_API void lua_error(lua_State *L)
   const char* what = nullptr;
   const TValue* o = index2addr(L, -1);
   if (ttisstring(o))
+  {
+    luaS_flatvalue(L, o);
     what = svalue(o);
+  }
   luaG_errormsg(L, what);
   /* code unreachable; will unlock when control actually leaves the kernel */
 }
@@ -1176,6 +1339,23 @@ LUA_API int lua_next(lua_State *L, int idx)
   return more;
 }
 
+/*
+** Sorts t[1..n] in place, with no metamethods, when they are numbers
+** that the table keeps unboxed. Returns 0 (doing nothing) otherwise.
+*/
+LUA_API int lua_sortnumbers(lua_State *L, int idx, lua_Integer n)
+{
+  StkId t;
+  int done;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  done = (0 <= n && n <= MAX_INT &&
+          luaH_sortnumbers(hvalue(t), cast(uint32_t, n)));
+  lua_unlock(L);
+  return done;
+}
+
 LUA_API void lua_concat(lua_State *L, int n)
 {
   lua_lock(L);
@@ -1326,5 +1506,7 @@ LUA_API void lua_upvaluejoin(lua_State *L, int fidx1, int n1,
   (*up1)->refcount++;
   if (upisopen(*up1))
     (*up1)->u.open.touched = 1;
+  if (isold(f1))
+    (*up1)->old = 1;  /* see 'luaC_upvalbarrier_' */
   luaC_upvalbarrier(L, *up1);
 }
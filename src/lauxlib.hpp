@@ -19,6 +19,9 @@
 /* key, in the registry, for table of preloaded loaders */
 #define LUA_PRELOAD_TABLE       "_PRELOAD"
 
+/* key, in the registry, for table of compiled patterns */
+#define LUA_PATTERNS_TABLE      "_PATTERNS"
+
 typedef struct luaL_Reg
 {
   const char *name;
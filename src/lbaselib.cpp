@@ -175,14 +175,149 @@ static int luaB_rawset(lua_State *L) {
   return 1;
 }
 
+/*
+** set the collector mode, with its optional parameters (0 keeps the
+** current value), and return the previous mode
+*/
+static int setgcmode(lua_State *L, int mode) {
+  int p1 = (int)luaL_optinteger(L, 2, 0);
+  int p2 = (int)luaL_optinteger(L, 3, 0);
+  if (p1 != 0)
+    lua_gc(L, (mode == LUA_GCGEN) ? LUA_GCSETMINORMUL : LUA_GCSETPAUSE, p1);
+  if (p2 != 0)
+    lua_gc(L, (mode == LUA_GCGEN) ? LUA_GCSETMAJORMUL : LUA_GCSETSTEPMUL, p2);
+  mode = lua_gc(L, mode, 0);
+  lua_pushstring(L, (mode == LUA_GCGEN) ? "generational" : "incremental");
+  return 1;
+}
+
+static void setstat(lua_State *L, const char *k, uint64_t v) {
+  lua_pushinteger(L, (lua_Integer)v);
+  lua_setfield(L, -2, k);
+}
+
+/*
+** push a table with the statistics of the collector (see 'lua_GCStats'),
+** or nil if they are not kept
+*/
+static int pushgcstats(lua_State *L) {
+  static const char *const states[] = {"propagate", "atomic", "swpallgc",
+                                       "swpfinobj", "swptobefnz", "swpend",
+                                       "callfin", "pause"};
+  static const char *const types[] = {nullptr, nullptr, nullptr, "number",
+                                      "string", "table", "function",
+                                      "userdata", "thread", "proto"};
+  lua_GCStats s;
+  if (!lua_gcstats(L, &s))
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, 19);
+  setstat(L, "totalbytes", s.totalbytes);
+  lua_pushinteger(L, (lua_Integer)s.debt);
+  lua_setfield(L, -2, "debt");
+  setstat(L, "estimate", s.estimate);
+  setstat(L, "memtrav", s.memtrav);
+  setstat(L, "cycles", s.cycles);
+  setstat(L, "minors", s.minors);
+  setstat(L, "lastcycletime", s.lastcycletime);
+  setstat(L, "maxcycletime", s.maxcycletime);
+  setstat(L, "totaltime", s.totaltime);
+  setstat(L, "pauses", s.pauses);
+  setstat(L, "maxpause", s.maxpause);
+  setstat(L, "swept", s.swept);
+  setstat(L, "finalizers", s.finalizers);
+  setstat(L, "barriers", s.barriers);
+  setstat(L, "backbarriers", s.backbarriers);
+  lua_createtable(L, 0, LUA_GCSTATSTATES);
+  for (int i = 0; i < LUA_GCSTATSTATES; i++)
+  {
+    lua_createtable(L, 0, 2);
+    setstat(L, "steps", s.statesteps[i]);
+    setstat(L, "time", s.statetime[i]);
+    lua_setfield(L, -2, states[i]);
+  }
+  lua_setfield(L, -2, "states");
+  lua_createtable(L, LUA_GCSTATBUCKETS, 0);
+  for (int i = 0; i < LUA_GCSTATBUCKETS; i++)
+  {
+    lua_pushinteger(L, (lua_Integer)s.pausehist[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "pausehist");
+  lua_createtable(L, 0, 6);
+  for (int i = 0; i < LUA_GCSTATTYPES; i++)
+  {
+    if (types[i] == nullptr)
+      continue;
+    lua_createtable(L, 0, 4);
+    setstat(L, "new", s.newobjs[i]);
+    setstat(L, "newbytes", s.newbytes[i]);
+    setstat(L, "freed", s.freedobjs[i]);
+    setstat(L, "freedbytes", s.freedbytes[i]);
+    lua_setfield(L, -2, types[i]);
+  }
+  lua_setfield(L, -2, "types");
+  return 1;
+}
+
+static void pushmemsite(void *ud, const lua_MemSite *site) {
+  lua_State *L = static_cast<lua_State *>(ud);
+  lua_createtable(L, 0, 4);
+  lua_pushstring(L, site->source);
+  lua_setfield(L, -2, "source");
+  lua_pushinteger(L, site->line);
+  lua_setfield(L, -2, "line");
+  setstat(L, "count", site->count);
+  setstat(L, "bytes", site->bytes);
+  lua_rawseti(L, -2, (lua_Integer)lua_rawlen(L, -2) + 1);
+}
+
+/*
+** push a table with the bytes in use per kind of object and, in field
+** 'sites', the sampled allocation sites (see 'lua_memsites'), or nil
+** if memory is not accounted
+*/
+static int pushmemusage(lua_State *L) {
+  static const char *const categories[] = {"table", "array", "node",
+                                           "string", "closure", "proto",
+                                           "userdata", "stack", "other"};
+  size_t bytes[LUA_MEMCATEGORIES];
+  if (!lua_memusage(L, bytes))
+  {
+    lua_pushnil(L);
+    return 1;
+  }
+  lua_createtable(L, 0, LUA_MEMCATEGORIES + 1);
+  for (int i = 0; i < LUA_MEMCATEGORIES; i++)
+    setstat(L, categories[i], bytes[i]);
+  lua_newtable(L);
+  lua_memsites(L, pushmemsite, L);
+  lua_setfield(L, -2, "sites");
+  return 1;
+}
+
+/* options of 'collectgarbage' not handled by 'lua_gc' */
+#define GCOPTSTATS      (-1)
+#define GCOPTMEMORY     (-2)
+
 static int luaB_collectgarbage(lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
                                      "count", "step", "setpause", "setstepmul",
-                                     "isrunning", nullptr};
+                                     "isrunning", "generational", "incremental",
+                                     "stats", "memory", nullptr};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
                                 LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-                                LUA_GCISRUNNING};
+                                LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, GCOPTSTATS,
+                                GCOPTMEMORY};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
+  if (o == GCOPTSTATS)
+    return pushgcstats(L);
+  if (o == GCOPTMEMORY)
+    return pushmemusage(L);
+  if (o == LUA_GCGEN || o == LUA_GCINC)
+    return setgcmode(L, o);
   int ex = (int)luaL_optinteger(L, 2, 0);
   int res = lua_gc(L, o, ex);
   switch (o)
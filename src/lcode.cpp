@@ -35,14 +35,14 @@ static bool hasjumps(const ExpressionDescription* e) { return e->patch1 != e->pa
 ** If expression is a numeric constant, fills 'v' with its value
 ** and returns 1. Otherwise, returns 0.
 */
-static int tonumeral(const ExpressionDescription *e, TValue *v) {
+static int tonumeral(lua_State *L, const ExpressionDescription *e, TValue *v) {
   if (hasjumps(e))
     return 0; /* not a numeral */
   switch (e->k)
   {
     case VKINT:
       if (v)
-        setivalue(v, e->u.ival);
+        setivalue(L, v, e->u.ival);
       return 1;
     case VKFLT:
       if (v)
@@ -429,7 +429,8 @@ static int addk(FuncState *fs, TValue *key, TValue *v) {
   k = fs->nk;
   /* numerical value does not need GC barrier;
      table has no metatable, so it does not need to invalidate cache */
-  setivalue(idx, k);
+  setivalue(L, idx, k);
+  luaH_commit(L, fs->ls->h, idx);
   LMem<TValue>::luaM_growvector(L, f->k, k, f->sizek, MAXARG_Ax, "constants");
   while (oldsize < f->sizek)
     setnilvalue(&f->k[oldsize++]);
@@ -456,8 +457,13 @@ int luaK_stringK(FuncState *fs, TString *s) {
 */
 int luaK_intK(FuncState *fs, lua_Integer n) {
   TValue k, o;
+#if LUA_NANBOXING
+  /* a light userdata keeps 48 bits; 'addk' tells apart the collisions */
+  setpvalue(&k, cast(void*, cast(size_t, l_castS2U(n) & NB_PAYLOAD)));
+#else
   setpvalue(&k, cast(void*, cast(size_t, n)));
-  setivalue(&o, n);
+#endif
+  setivalue(fs->ls->L, &o, n);
   return addk(fs, &k, &o);
 }
 
@@ -961,9 +967,11 @@ static int validop(int op, TValue *v1, TValue *v2) {
 static int constfolding(FuncState *fs, int op, ExpressionDescription *e1,
                         const ExpressionDescription *e2) {
   TValue v1, v2, res;
-  if (!tonumeral(e1, &v1) || !tonumeral(e2, &v2) || !validop(op, &v1, &v2))
+  lua_State *L = fs->ls->L;
+  if (!tonumeral(L, e1, &v1) || !tonumeral(L, e2, &v2) ||
+      !validop(op, &v1, &v2))
     return 0; /* non-numeric operands or not safe to fold */
-  luaO_arith(fs->ls->L, op, &v1, &v2, &res);  /* does operation */
+  luaO_arith(L, op, &v1, &v2, &res);  /* does operation */
   if (ttisinteger(&res))
   {
     e1->k = VKINT;
@@ -1085,7 +1093,7 @@ void luaK_infix(FuncState *fs, BinOpr op, ExpressionDescription *v) {
     case OPR_MOD: case OPR_POW:
     case OPR_BAND: case OPR_BOR: case OPR_BXOR:
     case OPR_SHL: case OPR_SHR: {
-      if (!tonumeral(v, nullptr))
+      if (!tonumeral(fs->ls->L, v, nullptr))
         luaK_exp2RK(fs, v);
       /* else keep numeral, which may be folded with 2nd operand */
       break;
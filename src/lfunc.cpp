@@ -43,6 +43,7 @@ void luaF_initupvals(lua_State *L, LClosure *cl) {
   {
     UpVal* uv = LMem<UpVal>::luaM_new(L);
     uv->refcount = 1;
+    uv->old = 0;
     uv->v = &uv->u.value;  /* make it closed */
     setnilvalue(uv->v);
     cl->upvals[i] = uv;
@@ -64,6 +65,7 @@ UpVal *luaF_findupval(lua_State *L, StkId level) {
   /* not found: create a new upvalue */
   uv = LMem<UpVal>::luaM_new(L);
   uv->refcount = 0;
+  uv->old = 0;
   uv->u.open.next = *pp;  /* link it to list of open upvalues */
   uv->u.open.touched = 1;
   *pp = uv;
@@ -101,6 +103,7 @@ Proto *luaF_newproto(lua_State *L) {
   f->sizep = 0;
   f->code = nullptr;
   f->cache = nullptr;
+  f->fieldcache = nullptr;
   f->sizecode = 0;
   f->lineinfo = nullptr;
   f->sizelineinfo = 0;
@@ -117,6 +120,19 @@ Proto *luaF_newproto(lua_State *L) {
   return f;
 }
 
+/*
+** Create the (empty) inline caches of a prototype whose code is final.
+*/
+void luaF_newfieldcache(lua_State *L, Proto *f) {
+  lua_assert(f->fieldcache == NULL);
+  f->fieldcache = LMem<FieldCache>::luaM_newvector(L, f->sizecode);
+  for (int i = 0; i < f->sizecode; i++)
+  {
+    f->fieldcache[i].layout = nullptr;
+    f->fieldcache[i].index = 0;
+  }
+}
+
 /*
 ** Look for n-th local variable at line 'line' in function 'func'.
 ** Returns NULL if not found.
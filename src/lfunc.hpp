@@ -23,6 +23,7 @@ struct UpVal
 {
   TValue *v;  /* points to stack or to its own value */
   lu_mem refcount;  /* reference counter */
+  int old;  /* an old closure may point to it (generational mode) */
   union
   {
     struct    /* (when open) */
@@ -36,6 +37,7 @@ struct UpVal
 #define upisopen(up)    ((up)->v != & (up)->u.value)
 
 LUAI_FUNC Proto *luaF_newproto(lua_State *L);
+LUAI_FUNC void luaF_newfieldcache(lua_State *L, Proto *f);
 LUAI_FUNC CClosure *luaF_newCclosure(lua_State *L, int nelems);
 LUAI_FUNC LClosure *luaF_newLclosure(lua_State *L, int nelems);
 LUAI_FUNC void luaF_initupvals(lua_State *L, LClosure *cl);
@@ -24,6 +24,35 @@
 #include <lutils.hpp>
 #include <lauxlib.hpp>
 
+#if LUA_USE_PARALLELMARK || LUA_USE_BGSWEEP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+#if LUA_USE_PARALLELMARK && defined(_MSC_VER) && !defined(__GNUC__)
+#include <intrin.h>
+#endif
+
+#if LUA_USE_GCSTATS
+#include <algorithm>
+#include <chrono>
+#endif
+
+#if LUA_USE_MEMACCOUNT
+#include <algorithm>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#endif
+
 thread_local lua_State* LGCFactory::active_state = nullptr;
 
 /*
@@ -64,6 +93,9 @@ thread_local lua_State* LGCFactory::active_state = nullptr;
 #define makewhite(g, x)  \
   (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
+/* mask erasing all color bits and the age */
+#define maskgcbits      (maskcolors & ~AGEBITS)
+
 #define white2gray(x)   resetbits(x->marked, WHITEBITS)
 #define black2gray(x)   resetbit(x->marked, BLACKBIT)
 
@@ -87,6 +119,145 @@ thread_local lua_State* LGCFactory::active_state = nullptr;
 
 static void reallymarkobject(global_State *g, GCObject *o);
 
+/*
+** {======================================================
+** Statistics (see 'lua_gcstats')
+** =======================================================
+*/
+
+#if LUA_USE_GCSTATS
+
+#define gcstats(g)      ((g)->gcstats->s)
+
+#define statcount(g, f)  cast_void(gcstats(g).f++)
+
+static uint64_t gcclock() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* size of the block of an object (with the arrays of a table) */
+static size_t objsize(GCObject *o) {
+  switch (o->type.asVariantStrict())
+  {
+    case LuaType::Variant::FunctionPrototype: return sizeof(Proto);
+    case LuaType::Variant::LuaFunctionClosure:
+      return sizeLClosure(gco2lcl(o)->nupvalues);
+    case LuaType::Variant::CFunctionClosure:
+      return sizeCClosure(gco2ccl(o)->nupvalues);
+    case LuaType::Variant::Table: return sizetable(gco2t(o));
+    case LuaType::Variant::Thread: return sizeof(lua_State);
+    case LuaType::Variant::UserData: return sizeudata(gco2u(o));
+    case LuaType::Variant::ShortString: return sizelstring(gco2ts(o)->shrlen);
+    case LuaType::Variant::LongString: return sizelngstr(gco2ts(o));
+#if LUA_NANBOXING
+    case LuaType::Variant::IntNumber: return sizeof(BoxedInt);
+#endif
+    default: lua_assert(false); return 0;
+  }
+}
+
+static void statfree(global_State *g, GCObject *o) {
+  int t = int(novariant(o->type));
+  gcstats(g).freedobjs[t]++;
+  gcstats(g).freedbytes[t] += objsize(o);
+}
+
+/* a cycle ended; its time is closed by the pause that ended it */
+#define statcycle(g)    statcount(g, cycles)
+
+/* charges the time of a 'singlestep' to the state it started from */
+class GCStepTimer
+{
+public:
+  explicit GCStepTimer(global_State *g)
+    : g(g), state(g->gcstate), start(gcclock())
+  {
+  }
+  ~GCStepTimer()
+  {
+    gcstats(this->g).statesteps[this->state]++;
+    gcstats(this->g).statetime[this->state] += gcclock() - this->start;
+  }
+private:
+  global_State *g;
+  int state;
+  uint64_t start;
+};
+
+/*
+** measures a pause of the program (a GC step or a full collection);
+** nested pauses are part of the outer one
+*/
+class GCPauseTimer
+{
+public:
+  explicit GCPauseTimer(global_State *g)
+    : g(g), cycles(gcstats(g).cycles), start(gcclock())
+  {
+    g->gcstats->depth++;
+  }
+  ~GCPauseTimer()
+  {
+    GCStats *st = this->g->gcstats;
+    uint64_t t = gcclock() - this->start;
+    uint64_t us = t / 1000;
+    int b = 0;
+    if (--st->depth > 0)
+      return;
+    while (us != 0 && b < LUA_GCSTATBUCKETS - 1)
+    {
+      us >>= 1;
+      b++;
+    }
+    st->s.pausehist[b]++;
+    st->s.pauses++;
+    st->s.maxpause = std::max(st->s.maxpause, t);
+    st->s.totaltime += t;
+    st->cycletime += t;
+    if (st->s.cycles != this->cycles)  /* ended a cycle? */
+    {
+      st->s.lastcycletime = st->cycletime;
+      st->s.maxcycletime = std::max(st->s.maxcycletime, st->cycletime);
+      st->cycletime = 0;
+    }
+  }
+private:
+  global_State *g;
+  uint64_t cycles;
+  uint64_t start;
+};
+
+#define timestep(g)     GCStepTimer steptimer_(g)
+#define timepause(g)    GCPauseTimer pausetimer_(g)
+
+#else
+
+#define statcount(g, f)  cast_void(0)
+#define statfree(g, o)  cast_void(0)
+#define statcycle(g)    cast_void(0)
+#define timestep(g)     cast_void(0)
+#define timepause(g)    cast_void(0)
+
+#endif
+
+int luaC_getstats(lua_State *L, lua_GCStats *s) {
+#if LUA_USE_GCSTATS
+  global_State *g = L->globalState;
+  *s = gcstats(g);
+  s->totalbytes = g->getTotalBytes();
+  s->debt = g->GCdebt;
+  s->estimate = g->GCestimate;
+  s->memtrav = g->GCmemtrav;
+  return 1;
+#else
+  (void)L; (void)s;
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
 /*
 ** {======================================================
 ** Generic functions
@@ -103,6 +274,21 @@ static void reallymarkobject(global_State *g, GCObject *o);
 */
 #define linkgclist(o, p) ((o)->gclist = (p), (p) = obj2gco(o))
 
+/*
+** address of the 'gclist' field of an object that can be in a gray list
+*/
+static GCObject **getgclist(GCObject *o) {
+  switch (o->type.asVariantStrict())
+  {
+    case LuaType::Variant::Table: return &gco2t(o)->gclist;
+    case LuaType::Variant::LuaFunctionClosure: return &gco2lcl(o)->gclist;
+    case LuaType::Variant::CFunctionClosure: return &gco2ccl(o)->gclist;
+    case LuaType::Variant::Thread: return &gco2th(o)->gclist;
+    case LuaType::Variant::FunctionPrototype: return &gco2p(o)->gclist;
+    default: lua_assert(0); return nullptr;
+  }
+}
+
 /*
 ** If key is not marked, mark its entry as dead. This allows key to be
 ** collected, but keeps its entry in the table.  A dead node is needed
@@ -122,16 +308,17 @@ static void removeentry(Node *n)
 /*
 ** tells whether a key or value can be cleared from a weak
 ** table. Non-collectable objects are never removed from weak
-** tables. Strings behave as 'values', so are never removed too. for
-** other objects: if really collected, cannot keep them; for objects
-** being finalized, keep them in keys, but not in values
+** tables. Strings (and boxed integers) behave as 'values', so are
+** never removed too. for other objects: if really collected, cannot
+** keep them; for objects being finalized, keep them in keys, but not
+** in values
 */
 static int iscleared(global_State *g, const TValue *o) {
   if (!iscollectable(o))
     return 0;
-  else if (ttisstring(o))
+  else if (ttisstring(o) || ttisinteger(o))
   {
-    markobject(g, tsvalue(o));  /* strings are 'values', so are never weak */
+    markobject(g, gcvalue(o));  /* they are 'values', so are never weak */
     return 0;
   }
   else
@@ -147,44 +334,87 @@ static int iscleared(global_State *g, const TValue *o) {
 void luaC_barrier_(lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = L->globalState;
   lua_assert(isblack(o) && iswhite(v) && !isdead(g, v) && !isdead(g, o));
+  statcount(g, barriers);
   if (keepinvariant(g)) /* must keep invariant? */
+  {
     reallymarkobject(g, v); /* restore invariant */
+    if (isold(o))
+    {
+      lua_assert(!isold(v));  /* white object could not be old */
+      setage(v, G_OLD0);  /* restore generational invariant */
+    }
+  }
   else    /* sweep phase */
   {
     lua_assert(issweepphase(g));
-    makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
+    if (g->gckind == KGC_INC)  /* incremental mode? */
+      makewhite(g, o);  /* mark main obj. as white to avoid other barriers */
   }
 }
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. In generational mode, the
+** table becomes 'touched'; a table touched in the previous cycle is
+** still in 'grayagain', so it only has to turn gray.
 */
 void luaC_barrierback_(lua_State *L, Table *t) {
   global_State *g = L->globalState;
   lua_assert(isblack(t) && !isdead(g, t));
+  lua_assert(g->gckind != KGC_GEN || isold(t));
+  statcount(g, backbarriers);
   black2gray(t);  /* make table gray (again) */
-  linkgclist(t, g->grayagain);
+  if (getage(t) != G_TOUCHED2)  /* not already in gray list? */
+    linkgclist(t, g->grayagain);
+  if (g->gckind == KGC_GEN)
+    setage(t, G_TOUCHED1);  /* touched in current cycle */
+}
+
+/*
+** barrier for the closure cache of an old prototype (generational
+** mode). As a touched table, the prototype is visited in the next two
+** cycles, so that 'traverseproto' can drop the cache if the closure
+** dies young.
+*/
+void luaC_protobarrier_(lua_State *L, Proto *p) {
+  global_State *g = L->globalState;
+  lua_assert(g->gckind == KGC_GEN && isblack(p) && isold(p));
+  statcount(g, backbarriers);
+  black2gray(p);
+  if (getage(p) != G_TOUCHED2)  /* not already in gray list? */
+    linkgclist(p, g->grayagain);
+  setage(p, G_TOUCHED1);
 }
 
 /*
 ** barrier for assignments to closed upvalues. Because upvalues are
 ** shared among closures, it is impossible to know the color of all
 ** closures pointing to it. So, we assume that the object being assigned
-** must be marked.
+** must be marked. In generational mode, only the values of upvalues
+** that an old closure may reach need that, and they must become old.
 */
 void luaC_upvalbarrier_(lua_State *L, UpVal *uv) {
   global_State *g = L->globalState;
   GCObject *o = gcvalue(uv->v);
   lua_assert(!upisopen(uv));  /* ensured by macro luaC_upvalbarrier */
-  if (keepinvariant(g))
+  if (!keepinvariant(g))
+    return;
+  if (g->gckind == KGC_INC)
+  {
     markobject(g, o);
+  }
+  else if (uv->old && !isold(o))
+  {
+    markobject(g, o);
+    setage(o, G_OLD0);
+  }
 }
 
 void luaC_fix(lua_State *L, GCObject *o) {
   global_State *g = L->globalState;
   lua_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   white2gray(o);  /* they will be gray forever */
+  setage(o, G_OLD);  /* and old forever */
   g->allgc = o->next;  /* remove object from 'allgc' list */
   o->next = g->fixedgc;  /* link it to 'fixedgc' list */
   g->fixedgc = o;
@@ -217,10 +447,37 @@ reentry:
       g->GCmemtrav += sizelstring(gco2ts(o)->shrlen);
       break;
     }
+#if LUA_NANBOXING
+    case LuaType::Variant::IntNumber:
+    {
+      gray2black(o);
+      g->GCmemtrav += sizeof(BoxedInt);
+      break;
+    }
+#endif
     case LuaType::Variant::LongString:
     {
+      TString *ts = gco2ts(o);
       gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      g->GCmemtrav += sizelngstr(ts);
+      if (isrope(ts))
+      {  /* mark its pieces (at most MAXROPEDEPTH levels) */
+        markobject(g, ropeleft(ts));
+        markobjectN(g, roperight(ts));
+      }
+      else if (isslice(ts))
+      {
+#if LUA_USE_SLICES
+        TString *parent = sliceparent(ts);
+        if (iswhite(parent) && compactable(ts, parent))
+        {  /* let 'compactslices' decide */
+          slicegclist(ts) = g->slices;
+          g->slices = ts;
+          break;
+        }
+#endif
+        markobject(g, sliceparent(ts));
+      }
       break;
     }
     case LuaType::Variant::UserData:
@@ -291,6 +548,52 @@ static void markbeingfnz(global_State *g) {
 ** thread.) Remove from the list threads that no longer have upvalues and
 ** not-marked threads.
 */
+#if LUA_USE_SLICES
+
+static void flattenslice(lua_State *L, void *ud) {
+  TString *ts = static_cast<TString *>(ud);
+  TString *flat = luaS_flatten(L, ts);
+  markobject(L->globalState, flat);
+  if (isold(ts))  /* an old slice now points to its copy */
+    setage(flat, G_OLD0);
+}
+
+/*
+** Slices in 'g->slices' keep alive parents much longer than themselves;
+** when nothing else marked such a parent, give the slice a copy of its
+** bytes so that the parent can be collected. In an emergency, if the
+** slice was exposed after it was marked, or if that copy fails, just
+** mark the parent.
+*/
+static void compactslices(lua_State *L, global_State *g) {
+  while (g->slices != nullptr)
+  {
+    TString *ts = g->slices;
+    g->slices = slicegclist(ts);
+    if (iswhite(sliceparent(ts)))
+    {
+      int status = LUA_ERRMEM;
+      black2gray(ts);  /* no barrier: 'flattenslice' marks the copy */
+      if (!g->gcemergency && !(ts->extra & LNG_EXPOSED))
+        status = luaD_rawrunprotected(L, flattenslice, ts);
+      gray2black(ts);
+      if (status != LUA_OK)
+        markobject(g, sliceparent(ts));
+    }
+  }
+}
+
+#else
+
+#define compactslices(L, g)     cast_void(0)
+
+#endif
+
+/*
+** In generational mode, the open upvalues of a dead thread that an old
+** closure may reach are also remarked, and their values become old, as
+** closing them when the thread is freed cannot run the barrier.
+*/
 static void remarkupvals(global_State *g) {
   lua_State *thread;
   lua_State **p = &g->twups;
@@ -305,11 +608,16 @@ static void remarkupvals(global_State *g) {
       *p = thread->twups;  /* remove thread from the list */
       thread->twups = thread;  /* mark that it is out of list */
       for (uv = thread->openupval; uv != nullptr; uv = uv->u.open.next)
-        if (uv->u.open.touched)
+      {
+        int old = uv->old && g->gckind == KGC_GEN;
+        if (uv->u.open.touched || old)
         {
           markvalue(g, uv->v);  /* remark upvalue's value */
+          if (old && iscollectable(uv->v) && !isold(gcvalue(uv->v)))
+            setage(gcvalue(uv->v), G_OLD0);
           uv->u.open.touched = 0;
         }
+      }
     }
   }
 }
@@ -320,6 +628,7 @@ static void remarkupvals(global_State *g) {
 static void restartcollection(global_State *g) {
   g->gray = g->grayagain = nullptr;
   g->weak = g->allweak = g->ephemeron = nullptr;
+  g->slices = nullptr;
   markobject(g, g->mainthread);
   markvalue(g, &g->l_registry);
   markmt(g);
@@ -334,17 +643,38 @@ static void restartcollection(global_State *g) {
 ** =======================================================
 */
 
+/*
+** In generational mode, a table (or prototype) touched in this cycle
+** must be visited again in the next one (its new entries may still be
+** young), so it goes back to 'grayagain'; an object touched in the
+** previous cycle is old again.
+*/
+static void genlink(global_State *g, GCObject *o) {
+  if (getage(o) == G_TOUCHED1)
+  {
+    black2gray(o);
+    *getgclist(o) = g->grayagain;
+    g->grayagain = o;
+  }
+  else if (getage(o) == G_TOUCHED2)
+    changeage(o, G_TOUCHED2, G_OLD);
+}
+
 /*
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
 ** atomic phase. In the atomic phase, if table has any white value,
-** put it in 'weak' list, to be cleared.
+** put it in 'weak' list, to be cleared; otherwise keep it in
+** 'grayagain' too (for the generational mode).
 */
 static void traverseweakvalue(global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
-  int hasclears = (h->sizearray > 0);
+  int hasclears = (boxedsize(h) > 0);
+  if (isshaped(h))
+    for (uint32_t i = 0; !hasclears && i < h->shape->nkeys; i++)
+      hasclears = iscleared(g, &h->slots[i]);
   for (n = gnode(h, 0); n < limit; n++)    /* traverse hash part */
   {
     checkdeadkey(n);
@@ -358,10 +688,10 @@ static void traverseweakvalue(global_State *g, Table *h) {
         hasclears = 1; /* table will have to be cleared */
     }
   }
-  if (g->gcstate == GCSpropagate)
-    linkgclist(h, g->grayagain); /* must retraverse it in atomic phase */
-  else if (hasclears)
+  if (g->gcstate == GCSinsideatomic && hasclears)
     linkgclist(h, g->weak); /* has to be cleared later */
+  else
+    linkgclist(h, g->grayagain); /* must retraverse it in atomic phase */
 }
 
 /*
@@ -381,12 +711,19 @@ static int traverseephemeron(global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   uint32_t i;
   /* traverse array part */
-  for (i = 0; i < h->sizearray; i++)
+  for (i = 0; i < boxedsize(h); i++)
     if (valiswhite(&h->array[i]))
     {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
+  /* traverse slots (their string keys are never weak) */
+  for (i = 0; isshaped(h) && i < h->shape->nkeys; i++)
+    if (valiswhite(&h->slots[i]))
+    {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->slots[i]));
+    }
   /* traverse hash part */
   for (n = gnode(h, 0); n < limit; n++)
   {
@@ -412,14 +749,21 @@ static int traverseephemeron(global_State *g, Table *h) {
     linkgclist(h, g->ephemeron); /* have to propagate again */
   else if (hasclears) /* table has white keys? */
     linkgclist(h, g->allweak); /* may have to clean white keys */
+  else
+  {
+    gray2black(h);  /* not in any list: must be black for barriers */
+    genlink(g, obj2gco(h));
+  }
   return marked;
 }
 
 static void traversestrongtable(global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   uint32_t i;
-  for (i = 0; i < h->sizearray; i++) /* traverse array part */
+  for (i = 0; i < boxedsize(h); i++) /* traverse array part */
     markvalue(g, &h->array[i]);
+  for (i = 0; isshaped(h) && i < h->shape->nkeys; i++) /* traverse slots */
+    markvalue(g, &h->slots[i]);
   for (n = gnode(h, 0); n < limit; n++)    /* traverse hash part */
   {
     checkdeadkey(n);
@@ -432,15 +776,28 @@ static void traversestrongtable(global_State *g, Table *h) {
       markvalue(g, gval(n));  /* mark value */
     }
   }
+  genlink(g, obj2gco(h));
+}
+
+/*
+** mark the keys of a shaped table (strings are never weak, so this is
+** done whatever the table mode)
+*/
+static void traverseshape(global_State *g, Table *h) {
+  const Shape *s = h->shape;
+  for (uint32_t i = 0; i < s->nkeys; i++)
+    markobject(g, shapekey(s, i));
 }
 
 static lu_mem traversetable(global_State *g, Table *h) {
-  const char *weakkey, *weakvalue;
+  int weakkey, weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   markobjectN(g, h->metatable);
+  if (isshaped(h))
+    traverseshape(g, h);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
-      ((weakkey = strchr(svalue(mode), 'k')),
-       (weakvalue = strchr(svalue(mode), 'v')),
+      ((weakkey = luaS_strchr(tsvalue(mode), 'k')),
+       (weakvalue = luaS_strchr(tsvalue(mode), 'v')),
        (weakkey || weakvalue)))    /* is really weak? */
   {
     black2gray(h);  /* keep table gray */
@@ -453,8 +810,17 @@ static lu_mem traversetable(global_State *g, Table *h) {
   }
   else /* not weak */
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-         sizeof(Node) * cast(size_t, allocsizenode(h));
+  return sizetable(h);
+}
+
+static int sizeproto(const Proto *f) {
+  return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+         (f->fieldcache ? sizeof(FieldCache) * f->sizecode : 0) +
+         sizeof(Proto *) * f->sizep +
+         sizeof(TValue) * f->sizek +
+         sizeof(int) * f->sizelineinfo +
+         sizeof(LocVar) * f->sizelocvars +
+         sizeof(Upvaldesc) * f->sizeupvalues;
 }
 
 /*
@@ -475,12 +841,8 @@ static int traverseproto(global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++) /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
-  return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
-         sizeof(Proto *) * f->sizep +
-         sizeof(TValue) * f->sizek +
-         sizeof(int) * f->sizelineinfo +
-         sizeof(LocVar) * f->sizelocvars +
-         sizeof(Upvaldesc) * f->sizeupvalues;
+  genlink(g, obj2gco(f));
+  return sizeproto(f);
 }
 
 static lu_mem traverseCclosure(global_State *g, CClosure *cl) {
@@ -513,6 +875,11 @@ static lu_mem traverseLclosure(global_State *g, LClosure *cl) {
   return sizeLClosure(cl->nupvalues);
 }
 
+static lu_mem sizethread(const lua_State *th) {
+  return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
+          sizeof(CallInfo) * th->nci);
+}
+
 static lu_mem traversethread(global_State *g, lua_State *th) {
   StkId o = th->stack;
   if (o == nullptr)
@@ -533,20 +900,20 @@ static lu_mem traversethread(global_State *g, lua_State *th) {
       g->twups = th;
     }
   }
-  else if (g->gckind != KGC_EMERGENCY)
+  else if (!g->gcemergency)
     luaD_shrinkstack(th); /* do not change stack in emergency cycle */
-  return (sizeof(lua_State) + sizeof(TValue) * th->stacksize +
-          sizeof(CallInfo) * th->nci);
+  return sizethread(th);
 }
 
 /*
 ** traverse one gray object, turning it to black (except for threads,
-** which are always gray).
+** which are always gray). (Tables touched in the previous cycle may be
+** black in 'grayagain'.)
 */
 static void propagatemark(global_State *g) {
   lu_mem size;
   GCObject *o = g->gray;
-  lua_assert(isgray(o));
+  lua_assert(!iswhite(o));
   gray2black(o);
   switch (o->type.asVariantStrict())
   {
@@ -620,81 +987,806 @@ static void convergeephemerons(global_State *g) {
 
 /* }====================================================== */
 
+#if LUA_USE_PARALLELMARK
+
 /*
 ** {======================================================
-** Sweep Functions
+** Parallel marking
 ** =======================================================
 */
 
 /*
-** clear entries with unmarked keys from all weaktables in list 'l' up
-** to element 'f'
+** 'parallelpropagate' empties the gray list with a pool of threads
+** plus the collector itself (the "markers"). A marker claims a white
+** object by clearing its white bits with an atomic operation, so that
+** only one marker traverses each object; claimed gray objects go to the
+** marker's own list, and a marker with a long list lends a batch of it
+** to the idle ones. Markers only traverse objects whose traversal
+** changes nothing but the object itself: threads, weak tables (or
+** tables whose metatable has not cached the absence of '__mode') and
+** touched tables are left to the collector, which traverses them
+** between rounds.
 */
-static void clearkeys(global_State *g, GCObject *l, GCObject *f) {
-  for (; l != f; l = gco2t(l)->gclist)
+
+/* number of objects a marker lends at a time */
+#define MARKBATCH       64
+
+/*
+** relaxed atomic operations on mark bytes and on the 'touched' flag of
+** open upvalues; 'parfetchand' returns the previous value
+*/
+#if defined(__GNUC__)
+#define markedof(o)     __atomic_load_n(&(o)->marked, __ATOMIC_RELAXED)
+#define parfetchor(p, b)   __atomic_fetch_or(p, b, __ATOMIC_RELAXED)
+#define parfetchand(p, b)  __atomic_fetch_and(p, b, __ATOMIC_RELAXED)
+#define parsettouched(uv)  \
+  __atomic_store_n(&(uv)->u.open.touched, 1, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER)
+#define markedof(o)     (*cast(volatile uint8_t *, &(o)->marked))
+#define parfetchor(p, b)  \
+  cast_byte(_InterlockedOr8(cast(volatile char *, p), cast(char, b)))
+#define parfetchand(p, b)  \
+  cast_byte(_InterlockedAnd8(cast(volatile char *, p), cast(char, b)))
+#define parsettouched(uv)  \
+  _InterlockedExchange(cast(volatile long *, &(uv)->u.open.touched), 1)
+#else
+#error "LUA_USE_PARALLELMARK needs GCC-style atomic builtins or MSVC intrinsics"
+#endif
+
+#define pariswhite(o)   (markedof(o) & WHITEBITS)
+#define parblacken(o)   parfetchor(&(o)->marked, cast_byte(bitmask(BLACKBIT)))
+
+#define parmarkvalue(m, o) { checkconsistency(o); \
+  if (iscollectable(o) && pariswhite(gcvalue(o))) parmark(m, gcvalue(o)); }
+
+#define parmarkobject(m, t) { if (pariswhite(t)) parmark(m, obj2gco(t)); }
+
+#define parmarkobjectN(m, t)    { if (t) parmarkobject(m, t); }
+
+struct GCMarker {
+  global_State *g = nullptr;
+  GCObject *gray = nullptr;  /* gray objects of this marker */
+  int ngray = 0;  /* length of 'gray' */
+  std::mutex lock;  /* protects 'lent' */
+  GCObject *lent = nullptr;  /* batch of gray objects for other markers */
+  std::atomic<bool> haslent{false};
+  GCObject *left = nullptr;  /* gray objects left to the collector */
+  TString *slices = nullptr;  /* see 'compactslices' */
+  lu_mem memtrav = 0;
+};
+
+struct GCWorkers {
+  int n = 0;  /* number of markers (the collector is 'markers[0]') */
+  std::unique_ptr<GCMarker[]> markers;
+  std::vector<std::thread> threads;
+  std::mutex lock;  /* protects 'round', 'running', and 'quit' */
+  std::condition_variable wake;  /* a round started (or 'quit') */
+  std::condition_variable done;  /* all workers finished the round */
+  unsigned round = 0;
+  int running = 0;  /* workers still in the current round */
+  bool quit = false;
+  std::atomic<int> active{0};  /* markers that may still find work */
+};
+
+static void parmark(GCMarker *m, GCObject *o);
+
+static void parpush(GCMarker *m, GCObject *o) {
+  *getgclist(o) = m->gray;
+  m->gray = o;
+  m->ngray++;
+}
+
+/*
+** same as 'reallymarkobject', with the claim of 'o' done atomically
+*/
+static void parmark(GCMarker *m, GCObject *o) {
+reentry:
+  if (!(parfetchand(&o->marked, cast_byte(~WHITEBITS)) & WHITEBITS))
+    return;  /* another marker got it */
+  switch (o->type.asVariantStrict())
   {
-    Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    for (n = gnode(h, 0); n < limit; n++)
-      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n))))
+    case LuaType::Variant::ShortString:
+    {
+      parblacken(o);
+      m->memtrav += sizelstring(gco2ts(o)->shrlen);
+      break;
+    }
+#if LUA_NANBOXING
+    case LuaType::Variant::IntNumber:
+    {
+      parblacken(o);
+      m->memtrav += sizeof(BoxedInt);
+      break;
+    }
+#endif
+    case LuaType::Variant::LongString:
+    {
+      TString *ts = gco2ts(o);
+      parblacken(o);
+      m->memtrav += sizelngstr(ts);
+      if (isrope(ts))
       {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* and remove entry from table */
+        parmarkobject(m, ropeleft(ts));
+        parmarkobjectN(m, roperight(ts));
+      }
+      else if (isslice(ts))
+      {
+#if LUA_USE_SLICES
+        TString *parent = sliceparent(ts);
+        if (pariswhite(parent) && compactable(ts, parent))
+        {
+          slicegclist(ts) = m->slices;
+          m->slices = ts;
+          break;
+        }
+#endif
+        parmarkobject(m, sliceparent(ts));
+      }
+      break;
+    }
+    case LuaType::Variant::UserData:
+    {
+      TValue uvalue;
+      parmarkobjectN(m, gco2u(o)->metatable);
+      parblacken(o);
+      m->memtrav += sizeudata(gco2u(o));
+      getuservalue(m->g->mainthread, gco2u(o), &uvalue);
+      if (iscollectable(&uvalue) && pariswhite(gcvalue(&uvalue)))
+      {
+        o = gcvalue(&uvalue);
+        goto reentry;
       }
+      break;
+    }
+    default:
+      parpush(m, o);
   }
 }
 
 /*
-** clear entries with unmarked values from all weaktables in list 'l' up
-** to element 'f'
+** a table can be traversed by any marker if it is not touched and it
+** is surely not weak
 */
-static void clearvalues(global_State *g, GCObject *l, GCObject *f) {
-  for (; l != f; l = gco2t(l)->gclist)
+static int partable(Table *h) {
+  int age = (markedof(h) >> AGESHIFT) & 7;
+  return age < G_TOUCHED1 &&
+         (h->metatable == nullptr || (h->metatable->flags & (1u << TM_MODE)));
+}
+
+/*
+** traverse a gray object of marker 'm', or leave it to the collector
+*/
+static void partraverse(GCMarker *m, GCObject *o) {
+  switch (o->type.asVariantStrict())
   {
-    Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
-    uint32_t i;
-    for (i = 0; i < h->sizearray; i++)
+    case LuaType::Variant::Table:
     {
-      TValue *o = &h->array[i];
-      if (iscleared(g, o)) /* value was collected? */
-        setnilvalue(o); /* remove value */
+      Table *h = gco2t(o);
+      Node *n, *limit = gnodelast(h);
+      uint32_t i;
+      if (!partable(h))
+        break;
+      parblacken(o);
+      parmarkobjectN(m, h->metatable);
+      if (isshaped(h))
+      {
+        for (i = 0; i < h->shape->nkeys; i++)
+          parmarkobject(m, shapekey(h->shape, i));
+        for (i = 0; i < h->shape->nkeys; i++)
+          parmarkvalue(m, &h->slots[i]);
+      }
+      for (i = 0; i < boxedsize(h); i++)
+        parmarkvalue(m, &h->array[i]);
+      for (n = gnode(h, 0); n < limit; n++)
+      {
+        checkdeadkey(n);
+        if (ttisnil(gval(n)))
+        {  /* 'removeentry' */
+          if (iscollectable(gkey(n)) && pariswhite(gcvalue(gkey(n))))
+            setdeadvalue(wgkey(n));
+        }
+        else
+        {
+          parmarkvalue(m, gkey(n));
+          parmarkvalue(m, gval(n));
+        }
+      }
+      m->memtrav += sizetable(h);
+      return;
     }
-    for (n = gnode(h, 0); n < limit; n++)
-      if (!ttisnil(gval(n)) && iscleared(g, gval(n)))
+    case LuaType::Variant::LuaFunctionClosure:
+    {
+      LClosure *cl = gco2lcl(o);
+      parblacken(o);
+      parmarkobjectN(m, cl->p);
+      for (int i = 0; i < cl->nupvalues; i++)
       {
-        setnilvalue(gval(n));  /* remove value ... */
-        removeentry(n);  /* and remove entry from table */
+        UpVal *uv = cl->upvals[i];
+        if (uv != nullptr)
+        {
+          if (upisopen(uv) && m->g->gcstate != GCSinsideatomic)
+            parsettouched(uv);
+          else
+            parmarkvalue(m, uv->v);
+        }
       }
+      m->memtrav += sizeLClosure(cl->nupvalues);
+      return;
+    }
+    case LuaType::Variant::CFunctionClosure:
+    {
+      CClosure *cl = gco2ccl(o);
+      parblacken(o);
+      for (int i = 0; i < cl->nupvalues; i++)
+        parmarkvalue(m, &cl->upvalue[i]);
+      m->memtrav += sizeCClosure(cl->nupvalues);
+      return;
+    }
+    case LuaType::Variant::FunctionPrototype:
+    {
+      Proto *f = gco2p(o);
+      int i;
+      if (((markedof(f) >> AGESHIFT) & 7) >= G_TOUCHED1)
+        break;  /* touched: the collector must relink it */
+      parblacken(o);
+      if (f->cache && pariswhite(f->cache))
+        f->cache = nullptr;
+      parmarkobjectN(m, f->source);
+      for (i = 0; i < f->sizek; i++)
+        parmarkvalue(m, &f->k[i]);
+      for (i = 0; i < f->sizeupvalues; i++)
+        parmarkobjectN(m, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        parmarkobjectN(m, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        parmarkobjectN(m, f->locvars[i].varname);
+      m->memtrav += sizeproto(f);
+      return;
+    }
+    default:
+      break;
   }
+  *getgclist(o) = m->left;  /* leave it to the collector */
+  m->left = o;
 }
 
-void luaC_upvdeccount(lua_State *L, UpVal *uv)
-{
-  lua_assert(uv->refcount > 0);
-  uv->refcount--;
-  if (uv->refcount == 0 && !upisopen(uv))
-    LMem<UpVal>::luaM_free(L, uv);
+/*
+** move a batch of gray objects to 'm->lent', if nobody took the
+** previous one
+*/
+static void parlend(GCMarker *m) {
+  GCObject *first = m->gray, *last = first;
+  for (int i = 1; i < MARKBATCH; i++)
+    last = *getgclist(last);
+  m->gray = *getgclist(last);
+  m->ngray -= MARKBATCH;
+  std::lock_guard<std::mutex> lk(m->lock);
+  *getgclist(last) = m->lent;
+  m->lent = first;
+  m->haslent.store(true);
 }
 
-static void freeobj(lua_State* L, GCObject* o)
-{
-  switch (o->type.asVariantStrict())
+/*
+** take the batch lent by some marker (starting with 'm' itself)
+*/
+static int parborrow(GCWorkers *w, GCMarker *m) {
+  int first = cast_int(m - w->markers.get());
+  for (int i = 0; i < w->n; i++)
   {
-    case LuaType::Variant::FunctionPrototype: LGCFactory::luaC_freeobj(L, gco2p(o)); break;
-    case LuaType::Variant::LuaFunctionClosure: LGCFactory::luaC_freeobj(L, gco2lcl(o)); break;
-    case LuaType::Variant::CFunctionClosure: LGCFactory::luaC_freeobj(L, gco2ccl(o)); break;
-    case LuaType::Variant::Table: LGCFactory::luaC_freeobj(L, gco2t(o)); break;
-    case LuaType::Variant::Thread: LGCFactory::luaC_freeobj(L, gco2th(o)); break;
-    case LuaType::Variant::UserData: LGCFactory::luaC_freeobj(L, gco2u(o)); break;
-    case LuaType::Variant::ShortString: LGCFactory::luaC_freeobj(L, gco2ts(o)); break;
-    case LuaType::Variant::LongString: LGCFactory::luaC_freeobj(L, gco2ts(o)); break;
-    default: lua_assert(false);
+    GCMarker *other = &w->markers[(first + i) % w->n];
+    if (other->haslent.load())
+    {
+      std::lock_guard<std::mutex> lk(other->lock);
+      GCObject *o = other->lent;
+      other->lent = nullptr;
+      other->haslent.store(false);
+      while (o != nullptr)
+      {
+        GCObject *next = *getgclist(o);
+        parpush(m, o);
+        o = next;
+      }
+      if (m->gray != nullptr)
+        return 1;
+    }
   }
+  return 0;
 }
 
-void LGCFactory::luaC_free(lua_State* L, Proto* function)
-{
+static int anylent(GCWorkers *w) {
+  for (int i = 0; i < w->n; i++)
+    if (w->markers[i].haslent.load())
+      return 1;
+  return 0;
+}
+
+/*
+** mark until no marker has gray objects. A marker only stops being
+** 'active' with an empty list and nothing lent, so, when 'active' gets
+** to zero, all work is done.
+*/
+static void pardrain(GCWorkers *w, GCMarker *m) {
+  for (;;)
+  {
+    while (m->gray != nullptr)
+    {
+      GCObject *o = m->gray;
+      m->gray = *getgclist(o);
+      m->ngray--;
+      partraverse(m, o);
+      if (m->ngray >= 2 * MARKBATCH && !m->haslent.load())
+        parlend(m);
+    }
+    if (parborrow(w, m))
+      continue;
+    w->active.fetch_sub(1);
+    for (;;)
+    {
+      if (anylent(w))
+      {
+        w->active.fetch_add(1);
+        if (parborrow(w, m))
+          break;
+        w->active.fetch_sub(1);
+      }
+      if (w->active.load() == 0)
+        return;
+      std::this_thread::yield();
+    }
+  }
+}
+
+static void workerloop(GCWorkers *w, int i) {
+  unsigned round = 0;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lk(w->lock);
+      w->wake.wait(lk, [&] { return w->quit || w->round != round; });
+      if (w->quit)
+        return;
+      round = w->round;
+    }
+    pardrain(w, &w->markers[i]);
+    std::lock_guard<std::mutex> lk(w->lock);
+    if (--w->running == 0)
+      w->done.notify_one();
+  }
+}
+
+static void freeworkers(global_State *g) {
+  GCWorkers *w = g->gcworkers;
+  if (w == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> lk(w->lock);
+    w->quit = true;
+  }
+  w->wake.notify_all();
+  for (auto &t : w->threads)
+    t.join();
+  delete w;
+  g->gcworkers = nullptr;
+}
+
+/*
+** the pool is created at the first collection of a large heap. It stays
+** empty (and marking serial) if there are no threads to spare or they
+** cannot be created.
+*/
+static GCWorkers *getworkers(global_State *g) {
+  GCWorkers *w = g->gcworkers;
+  if (w == nullptr)
+  {
+    int n = LUAI_MARKWORKERS;
+    if (n <= 0)
+      n = cast_int(std::thread::hardware_concurrency()) - 1;
+    n = std::max(n, 0) + 1;
+    try
+    {
+      w = new GCWorkers();
+      w->markers.reset(new GCMarker[n]);
+      w->threads.reserve(n - 1);
+    }
+    catch (...)
+    {
+      delete w;
+      return nullptr;
+    }
+    for (int i = 0; i < n; i++)
+      w->markers[i].g = g;
+    try
+    {
+      for (w->n = 1; w->n < n; w->n++)
+        w->threads.emplace_back(workerloop, w, w->n);
+    }
+    catch (...)
+    {  /* go with the threads already running */
+    }
+    g->gcworkers = w;
+  }
+  return (w->n > 1) ? w : nullptr;
+}
+
+/*
+** one parallel round: share the gray list among the markers and mark
+** with all of them. Returns the objects left to the collector.
+*/
+static GCObject *parround(global_State *g, GCWorkers *w) {
+  GCObject *left = nullptr;
+  int i = 0;
+  while (g->gray != nullptr)
+  {
+    GCObject *o = g->gray;
+    g->gray = *getgclist(o);
+    parpush(&w->markers[i], o);
+    i = (i + 1) % w->n;
+  }
+  w->active.store(w->n);
+  {
+    std::lock_guard<std::mutex> lk(w->lock);
+    w->running = w->n - 1;
+    w->round++;
+  }
+  w->wake.notify_all();
+  pardrain(w, &w->markers[0]);
+  {
+    std::unique_lock<std::mutex> lk(w->lock);
+    w->done.wait(lk, [&] { return w->running == 0; });
+  }
+  for (i = 0; i < w->n; i++)
+  {
+    GCMarker *m = &w->markers[i];
+    lua_assert(m->gray == nullptr && m->lent == nullptr);
+    while (m->left != nullptr)
+    {
+      GCObject *o = m->left;
+      m->left = *getgclist(o);
+      *getgclist(o) = left;
+      left = o;
+    }
+    while (m->slices != nullptr)
+    {
+      TString *ts = m->slices;
+      m->slices = slicegclist(ts);
+      slicegclist(ts) = g->slices;
+      g->slices = ts;
+    }
+    g->GCmemtrav += m->memtrav;
+    m->memtrav = 0;
+  }
+  return left;
+}
+
+/*
+** 'propagateall' for large heaps: parallel rounds, with the objects
+** the markers left traversed here (their children go to the gray
+** list of the next round)
+*/
+static void parallelpropagate(global_State *g) {
+  GCWorkers *w = nullptr;
+  if (g->gray != nullptr && g->getTotalBytes() >= LUAI_PARMARKMIN &&
+      (g->gcworkers != nullptr || !g->gcemergency))
+    w = getworkers(g);
+  if (w == nullptr)
+  {
+    propagateall(g);
+    return;
+  }
+  while (g->gray != nullptr)
+  {
+    GCObject *left = parround(g, w);
+    while (left != nullptr)
+    {
+      GCObject *o = left;
+      left = *getgclist(o);
+      *getgclist(o) = g->gray;
+      g->gray = o;
+      propagatemark(g);
+    }
+  }
+}
+
+/* }====================================================== */
+
+#else
+
+#define parallelpropagate(g)    propagateall(g)
+#define freeworkers(g)          cast_void(0)
+
+#endif
+
+/*
+** {======================================================
+** Memory accounting (see 'lua_memusage')
+** =======================================================
+*/
+
+#if LUA_USE_MEMACCOUNT
+
+/*
+** Sampled objects, with their sites. Sampled objects have SAMPLEDBIT
+** set, so that only they are looked up when freed.
+*/
+struct MemProfile
+{
+  using Site = std::pair<std::string, int>;  /* source and line */
+  std::map<Site, size_t> sites;  /* sampled objects alive per site */
+  std::unordered_map<GCObject *, std::map<Site, size_t>::iterator> objs;
+  uint32_t rand;  /* for the distance to the next sample */
+};
+
+/* add the bytes of 'o' (and of the arrays it owns) to its categories */
+static void accountobj(GCObject *o, size_t *bytes) {
+  switch (o->type.asVariantStrict())
+  {
+    case LuaType::Variant::Table: {
+      Table *h = gco2t(o);
+      bytes[LUA_MEMTABLE] += sizeof(Table);
+      bytes[LUA_MEMARRAY] += arraycellsize(h) * h->sizearray;
+      bytes[LUA_MEMNODE] += sizetable(h) - sizeof(Table) -
+                            arraycellsize(h) * h->sizearray;
+      break;
+    }
+    case LuaType::Variant::ShortString:
+      bytes[LUA_MEMSTRING] += sizelstring(gco2ts(o)->shrlen);
+      break;
+    case LuaType::Variant::LongString:
+      bytes[LUA_MEMSTRING] += sizelngstr(gco2ts(o));
+      break;
+    case LuaType::Variant::LuaFunctionClosure:
+      bytes[LUA_MEMCLOSURE] += sizeLClosure(gco2lcl(o)->nupvalues);
+      break;
+    case LuaType::Variant::CFunctionClosure:
+      bytes[LUA_MEMCLOSURE] += sizeCClosure(gco2ccl(o)->nupvalues);
+      break;
+    case LuaType::Variant::FunctionPrototype:
+      bytes[LUA_MEMPROTO] += sizeproto(gco2p(o));
+      break;
+    case LuaType::Variant::UserData:
+      bytes[LUA_MEMUSERDATA] += sizeudata(gco2u(o));
+      break;
+    case LuaType::Variant::Thread:
+      bytes[LUA_MEMSTACK] += sizethread(gco2th(o));
+      break;
+#if LUA_NANBOXING
+    case LuaType::Variant::IntNumber:
+      bytes[LUA_MEMOTHER] += sizeof(BoxedInt);
+      break;
+#endif
+    default: lua_assert(0);
+  }
+}
+
+static void accountlist(GCObject *p, size_t *bytes) {
+  for (; p != nullptr; p = p->next)
+    accountobj(p, bytes);
+}
+
+/* next distance between samples: random, LUAI_MEMSAMPLE on average */
+static uint32_t nextsample(MemProfile *prof) {
+  uint32_t x = prof->rand;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  prof->rand = x;
+  return 1 + x % (2 * LUAI_MEMSAMPLE - 1);
+}
+
+/*
+** Sample a new object: attribute it to the current line of the
+** innermost Lua function in the stack. Sampling is best effort: if
+** there is no memory for it, the object is just not sampled.
+*/
+void luaC_sample(lua_State *L, GCObject *o) {
+  global_State *g = L->globalState;
+  MemProfile *prof = g->memprofile;
+  CallInfo *ci = L->ci;
+  const char *source = "=[C]";
+  int line = -1;
+  g->memsample = LUAI_MEMSAMPLE;  /* in case of errors */
+  try
+  {
+    if (prof == nullptr)
+    {
+      prof = g->memprofile = new MemProfile();
+      prof->rand = g->seed | 1;
+    }
+    g->memsample = nextsample(prof);
+    while (ci != nullptr && !isLua(ci))
+      ci = ci->previous;
+    if (ci != nullptr)
+    {
+      Proto *p = clLvalue(ci->func)->p;
+      int pc = pcRel(ci->u.l.savedpc, p);
+      source = (p->source != nullptr) ? getstr(p->source) : "=?";
+      line = getfuncline(p, (pc < 0) ? 0 : pc);
+    }
+    auto site = prof->sites.emplace(MemProfile::Site(source, line), 0).first;
+    prof->objs.emplace(o, site);
+    site->second++;
+    l_setbit(o->marked, SAMPLEDBIT);
+  }
+  catch (const std::bad_alloc&)
+  {
+  }
+}
+
+/* a sampled object is being freed */
+static void unsample(global_State *g, GCObject *o) {
+  MemProfile *prof = g->memprofile;
+  auto obj = prof->objs.find(o);
+  lua_assert(obj != prof->objs.end());
+  if (--obj->second->second == 0)  /* last sampled object of its site? */
+    prof->sites.erase(obj->second);
+  prof->objs.erase(obj);
+}
+
+#define checkunsample(g, o)  \
+  (testbit((o)->marked, SAMPLEDBIT) ? unsample(g, o) : cast_void(0))
+
+static void freeprofile(global_State *g) {
+  delete g->memprofile;
+  g->memprofile = nullptr;
+}
+
+#else
+
+#define checkunsample(g, o)     cast_void(0)
+#define freeprofile(g)          cast_void(0)
+
+#endif
+
+int luaC_memusage(lua_State *L, size_t *bytes) {
+#if LUA_USE_MEMACCOUNT
+  global_State *g = L->globalState;
+  size_t total = 0;
+  std::fill_n(bytes, LUA_MEMCATEGORIES, 0);
+  accountobj(g->mainthread, bytes);
+  accountlist(g->allgc, bytes);
+  accountlist(g->finobj, bytes);
+  accountlist(g->tobefnz, bytes);
+  accountlist(g->fixedgc, bytes);
+  for (int i = 0; i < LUA_MEMOTHER; i++)
+    total += bytes[i];
+  bytes[LUA_MEMOTHER] = (g->getTotalBytes() > total) ?
+                        g->getTotalBytes() - total : 0;
+  return 1;
+#else
+  (void)L; (void)bytes;
+  return 0;
+#endif
+}
+
+int luaC_memsites(lua_State *L, lua_MemSiteFn f, void *ud) {
+#if LUA_USE_MEMACCOUNT
+  struct Totals
+  {
+    size_t count = 0;
+    size_t bytes = 0;
+  };
+  MemProfile *prof = L->globalState->memprofile;
+  std::map<MemProfile::Site, Totals> totals;
+  std::vector<std::pair<const MemProfile::Site *, Totals>> sites;
+  if (prof != nullptr)
+  {
+    for (const auto &obj : prof->objs)
+    {
+      size_t bytes[LUA_MEMCATEGORIES] = {};
+      Totals &t = totals[obj.second->first];
+      accountobj(obj.first, bytes);
+      t.count += LUAI_MEMSAMPLE;
+      for (size_t b : bytes)
+        t.bytes += b * LUAI_MEMSAMPLE;
+    }
+  }
+  /* 'f' may run the collector, so report from a copy */
+  for (const auto &t : totals)
+    sites.emplace_back(&t.first, t.second);
+  std::sort(sites.begin(), sites.end(), [](const auto &a, const auto &b) {
+    return a.second.bytes > b.second.bytes;
+  });
+  for (const auto &s : sites)
+  {
+    lua_MemSite site = {s.first->first.c_str(), s.first->second,
+                        s.second.count, s.second.bytes};
+    f(ud, &site);
+  }
+  return 1;
+#else
+  (void)L; (void)f; (void)ud;
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Sweep Functions
+** =======================================================
+*/
+
+/*
+** clear entries with unmarked keys from all weaktables in list 'l' up
+** to element 'f'
+*/
+static void clearkeys(global_State *g, GCObject *l, GCObject *f) {
+  for (; l != f; l = gco2t(l)->gclist)
+  {
+    Table *h = gco2t(l);
+    Node *n, *limit = gnodelast(h);
+    for (n = gnode(h, 0); n < limit; n++)
+      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n))))
+      {
+        setnilvalue(gval(n));  /* remove value ... */
+        removeentry(n);  /* and remove entry from table */
+      }
+  }
+}
+
+/*
+** clear entries with unmarked values from all weaktables in list 'l' up
+** to element 'f'
+*/
+static void clearvalues(global_State *g, GCObject *l, GCObject *f) {
+  for (; l != f; l = gco2t(l)->gclist)
+  {
+    Table *h = gco2t(l);
+    Node *n, *limit = gnodelast(h);
+    uint32_t i;
+    for (i = 0; i < boxedsize(h); i++)
+    {
+      TValue *o = &h->array[i];
+      if (iscleared(g, o)) /* value was collected? */
+        setnilvalue(o); /* remove value */
+    }
+    for (i = 0; isshaped(h) && i < h->shape->nkeys; i++)
+    {
+      TValue *o = &h->slots[i];
+      if (iscleared(g, o)) /* value was collected? */
+        setnilvalue(o); /* remove value */
+    }
+    for (n = gnode(h, 0); n < limit; n++)
+      if (!ttisnil(gval(n)) && iscleared(g, gval(n)))
+      {
+        setnilvalue(gval(n));  /* remove value ... */
+        removeentry(n);  /* and remove entry from table */
+      }
+  }
+}
+
+void luaC_upvdeccount(lua_State *L, UpVal *uv)
+{
+  lua_assert(uv->refcount > 0);
+  uv->refcount--;
+  if (uv->refcount == 0 && !upisopen(uv))
+    LMem<UpVal>::luaM_free(L, uv);
+}
+
+static void freeobj(lua_State* L, GCObject* o)
+{
+  statfree(L->globalState, o);
+  checkunsample(L->globalState, o);
+  switch (o->type.asVariantStrict())
+  {
+    case LuaType::Variant::FunctionPrototype: LGCFactory::luaC_freeobj(L, gco2p(o)); break;
+    case LuaType::Variant::LuaFunctionClosure: LGCFactory::luaC_freeobj(L, gco2lcl(o)); break;
+    case LuaType::Variant::CFunctionClosure: LGCFactory::luaC_freeobj(L, gco2ccl(o)); break;
+    case LuaType::Variant::Table: LGCFactory::luaC_freeobj(L, gco2t(o)); break;
+    case LuaType::Variant::Thread: LGCFactory::luaC_freeobj(L, gco2th(o)); break;
+    case LuaType::Variant::UserData: LGCFactory::luaC_freeobj(L, gco2u(o)); break;
+    case LuaType::Variant::ShortString: LGCFactory::luaC_freeobj(L, gco2ts(o)); break;
+    case LuaType::Variant::LongString: LGCFactory::luaC_freeobj(L, gco2ts(o)); break;
+#if LUA_NANBOXING
+    case LuaType::Variant::IntNumber: LGCFactory::luaC_freeobj(L, gco2bi(o)); break;
+#endif
+    default: lua_assert(false);
+  }
+}
+
+void LGCFactory::luaC_free(lua_State* L, Proto* function)
+{
   function->~Proto();
   LMem<Proto>::luaM_free(L, function);
 }
@@ -731,6 +1823,13 @@ void LGCFactory::luaC_free(lua_State* L, Udata* udata)
   LMem<Udata>::luaM_freemem(L, udata, size);
 }
 
+#if LUA_NANBOXING
+void LGCFactory::luaC_free(lua_State* L, BoxedInt* box)
+{
+  LMem<BoxedInt>::luaM_free(L, box);
+}
+#endif
+
 void LGCFactory::luaC_free(lua_State* L, TString* string)
 {
   switch (string->type.asVariantStrict())
@@ -744,7 +1843,7 @@ void LGCFactory::luaC_free(lua_State* L, TString* string)
     }
     case LuaType::Variant::LongString:
     {
-      size_t size = sizelstring(string->u.lnglen);
+      size_t size = sizelngstr(string);
       string->~TString();
       LMem<TString>::luaM_freemem(L, string, size);
       break;
@@ -753,6 +1852,178 @@ void LGCFactory::luaC_free(lua_State* L, TString* string)
   }
 }
 
+#if LUA_USE_BGSWEEP
+
+/*
+** Sweeps of a collection leave the release of memory to a freeing
+** thread: while a 'SweepScope' is alive, 'luaM_rawrealloc' gives the
+** blocks it frees to 'luaC_freelater', which collects them in batches
+** for the thread. (Blocks of the state's arena are freed at once, as
+** that is cheap and the arena has no locks.) Only the calls to the allocator move there; the
+** destructors of swept objects still run here (they change the
+** string table, shapes, and upvalues), and the memory counts as freed
+** right away. Emergency collections free everything at once, as the
+** allocation that failed is about to be retried.
+*/
+
+thread_local GCFreer* luaM_sweeper = nullptr;
+
+/* number of blocks in a batch */
+#define FREEBATCH       256
+
+struct GCFreeBatch {
+  GCFreeBatch *next = nullptr;
+  int n = 0;
+  void *blocks[FREEBATCH];
+  size_t sizes[FREEBATCH];
+};
+
+struct GCFreer {
+  GCFreeBatch *current = nullptr;  /* batch being filled by the sweep */
+  std::mutex lock;  /* protects the fields below */
+  std::condition_variable wake;
+  GCFreeBatch *queue = nullptr;  /* batches to be freed */
+  GCFreeBatch *spare = nullptr;  /* empty batches */
+  bool quit = false;
+  std::thread thread;
+};
+
+static void freerloop(GCFreer *f) {
+  for (;;)
+  {
+    GCFreeBatch *b;
+    {
+      std::unique_lock<std::mutex> lk(f->lock);
+      f->wake.wait(lk, [&] { return f->quit || f->queue != nullptr; });
+      if (f->queue == nullptr)
+        return;  /* 'quit' and nothing left to free */
+      b = f->queue;
+      f->queue = b->next;
+    }
+    for (int i = 0; i < b->n; i++)
+      LuaAllocator<void>::alloc(b->blocks[i], b->sizes[i], 0);
+    b->n = 0;
+    std::lock_guard<std::mutex> lk(f->lock);
+    b->next = f->spare;
+    f->spare = b;
+  }
+}
+
+/*
+** give the current batch to the thread
+*/
+static void flushbatch(GCFreer *f) {
+  GCFreeBatch *b = f->current;
+  if (b != nullptr && b->n > 0)
+  {
+    {
+      std::lock_guard<std::mutex> lk(f->lock);
+      b->next = f->queue;
+      f->queue = b;
+    }
+    f->wake.notify_one();
+    f->current = nullptr;
+  }
+}
+
+void luaC_freelater(GCFreer *f, void *block, size_t size) {
+  GCFreeBatch *b = f->current;
+  if (b == nullptr)
+  {
+    {
+      std::lock_guard<std::mutex> lk(f->lock);
+      b = f->spare;
+      if (b != nullptr)
+        f->spare = b->next;
+    }
+    if (b == nullptr && (b = new (std::nothrow) GCFreeBatch()) == nullptr)
+    {  /* no batch; free it here */
+      LuaAllocator<void>::alloc(block, size, 0);
+      return;
+    }
+    f->current = b;
+  }
+  b->blocks[b->n] = block;
+  b->sizes[b->n] = size;
+  if (++b->n == FREEBATCH)
+    flushbatch(f);
+}
+
+/*
+** the thread starts at the first sweep; if it cannot be created,
+** sweeps free their blocks themselves
+*/
+static GCFreer *getfreer(global_State *g) {
+  if (g->gcemergency)
+    return nullptr;
+  if (g->gcfreer == nullptr)
+  {
+    GCFreer *f = new (std::nothrow) GCFreer();
+    if (f == nullptr)
+      return nullptr;
+    try
+    {
+      f->thread = std::thread(freerloop, f);
+    }
+    catch (...)
+    {  /* keep 'f' without a thread */
+    }
+    g->gcfreer = f;
+  }
+  return g->gcfreer->thread.joinable() ? g->gcfreer : nullptr;
+}
+
+/*
+** wait for the thread to free everything it got and stop it
+*/
+static void stopfreer(global_State *g) {
+  GCFreer *f = g->gcfreer;
+  if (f == nullptr)
+    return;
+  if (f->thread.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lk(f->lock);
+      f->quit = true;
+    }
+    f->wake.notify_one();
+    f->thread.join();
+  }
+  while (f->spare != nullptr)
+  {
+    GCFreeBatch *b = f->spare;
+    f->spare = b->next;
+    delete b;
+  }
+  delete f;
+  g->gcfreer = nullptr;
+}
+
+class SweepScope
+{
+public:
+  explicit SweepScope(global_State *g)
+    : sweeper(luaM_sweeper, getfreer(g))
+  {
+  }
+  ~SweepScope()
+  {
+    if (luaM_sweeper != nullptr)
+      flushbatch(luaM_sweeper);
+  }
+private:
+  Lua::ScopedValueSetter<GCFreer*> sweeper;
+};
+
+#define sweepinbackground(g)    SweepScope sweepscope_(g)
+
+#else
+
+#define sweepinbackground(g)    cast_void(0)
+#define stopfreer(g)            cast_void(0)
+
+#endif
+
 #define sweepwholelist(L, p)     sweeplist(L, p, MAX_LUMEM)
 
 /*
@@ -770,6 +2041,7 @@ static GCObject **sweeplist(lua_State *L, GCObject **p, lu_mem count) {
   {
     GCObject *curr = *p;
     int marked = curr->marked;
+    statcount(g, swept);
     if (isdeadm(ow, marked))    /* is 'curr' dead? */
     {
       *p = curr->next;  /* remove 'curr' from list */
@@ -808,12 +2080,25 @@ static GCObject **sweeptolive(lua_State *L, GCObject **p) {
 ** If possible, shrink string table
 */
 static void checkSizes(lua_State *L, global_State *g) {
-  if (g->gckind != KGC_EMERGENCY)
+  if (!g->gcemergency)
   {
     l_mem olddebt = g->GCdebt;
-    if (g->strt.nuse < g->strt.size / 4) /* string table too big? */
-      luaS_resize(L, g->strt.size / 2); /* shrink it a little */
-    g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
+    Stringtable *tb = &g->strt;
+    int size = (tb->newslots != nullptr) ? tb->newsize : tb->size;
+    /* string table (or the one it is growing into) too big? */
+    if (tb->nuse < size / 8 && size > MINSTRTABSIZE && tb->oldslots == nullptr)
+    {
+      while (tb->nuse < size / 8 && size > MINSTRTABSIZE)
+        size /= 2;
+      luaS_resize(L, size);
+    }
+    l_mem delta = g->GCdebt - olddebt;
+    /* update estimate (which may not count a new string-table array
+       allocated during the sweep and freed now) */
+    if (delta < 0 && cast(lu_mem, -delta) >= g->GCestimate)
+      g->GCestimate = g->getTotalBytes();
+    else
+      g->GCestimate += delta;
   }
 }
 
@@ -826,6 +2111,8 @@ static GCObject *udata2finalize(global_State *g) {
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
   if (issweepphase(g))
     makewhite(g, o); /* "sweep" object */
+  else if (getage(o) == G_OLD1)
+    g->firstold1 = o;  /* it is the first OLD1 object in the list */
   return o;
 }
 
@@ -852,6 +2139,7 @@ static void GCTM(lua_State *L, int propagateerrors)
     setobj2s(L, L->top + 1, &v);  /* ... and its argument */
     L->top += 2;  /* and (next line) call the finalizer */
     L->ci->callstatus |= CIST_FIN;  /* will run a finalizer */
+    statcount(g, finalizers);
     status = luaD_pcall(L, dothecall, nullptr, savestack(L, L->top - 2), 0);
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
     L->allowhook = oldah;  /* restore hooks */
@@ -861,6 +2149,7 @@ static void GCTM(lua_State *L, int propagateerrors)
       const char* error = "";
       if (status == LUA_ERRRUN)
       {  /* is there an error object? */
+        luaS_flatvalue(L, L->top - 1);
         const char *msg = (ttisstring(L->top - 1))
                           ? svalue(L->top - 1)
                           : "no message";
@@ -906,19 +2195,23 @@ static GCObject **findlast(GCObject **p) {
 
 /*
 ** move all unreachable objects (or 'all' objects) that need
-** finalization from list 'finobj' to list 'tobefnz' (to be finalized)
+** finalization from list 'finobj' to list 'tobefnz' (to be finalized).
+** (In generational mode, old objects are not collected, so it stops
+** at 'finobjold1'.)
 */
 static void separatetobefnz(global_State *g, int all) {
   GCObject *curr;
   GCObject **p = &g->finobj;
   GCObject **lastnext = findlast(&g->tobefnz);
-  while ((curr = *p) != nullptr)    /* traverse all finalizable objects */
+  while ((curr = *p) != g->finobjold1)    /* traverse all finalizable objects */
   {
     lua_assert(tofinalize(curr));
     if (!(iswhite(curr) || all)) /* not being collected? */
       p = &curr->next; /* don't bother with it */
     else
     {
+      if (curr == g->finobjsur)  /* removing 'finobjsur'? */
+        g->finobjsur = curr->next;  /* correct it */
       *p = curr->next;  /* remove 'curr' from 'finobj' list */
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
       *lastnext = curr;
@@ -927,6 +2220,22 @@ static void separatetobefnz(global_State *g, int all) {
   }
 }
 
+/*
+** if 'o' starts one of the generational sections of 'allgc', the
+** section must start at the next object, as 'o' leaves the list
+*/
+static void checkpointer(GCObject **p, GCObject *o) {
+  if (o == *p)
+    *p = o->next;
+}
+
+static void correctpointers(global_State *g, GCObject *o) {
+  checkpointer(&g->survival, o);
+  checkpointer(&g->old1, o);
+  checkpointer(&g->reallyold, o);
+  checkpointer(&g->firstold1, o);
+}
+
 /*
 ** if object 'o' has a finalizer, remove it from 'allgc' list (must
 ** search the list to find it) and link it in 'finobj' list.
@@ -945,6 +2254,8 @@ void luaC_checkfinalizer(lua_State *L, GCObject *o, Table *mt) {
       if (g->sweepgc == &o->next) /* should not remove 'sweepgc' object */
         g->sweepgc = sweeptolive(L, g->sweepgc); /* change 'sweepgc' */
     }
+    else
+      correctpointers(g, o);
     /* search for pointer pointing to 'o' */
     for (p = &g->allgc; *p != o; p = &(*p)->next)
     { /* empty */
@@ -997,16 +2308,21 @@ static void entersweep(lua_State *L) {
 
 void luaC_freeallobjects(lua_State *L) {
   global_State *g = L->globalState;
+  luaC_changemode(L, KGC_INC);
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
+  freeworkers(g);  /* no more marking */
+  stopfreer(g);  /* free here from now on */
+  if (g->arena != nullptr)
+    g->arena->dropall();  /* its pages go away with the state */
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
-  g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
   sweepwholelist(L, &g->allgc);
   sweepwholelist(L, &g->fixedgc);  /* collect fixed objects */
   lua_assert(g->strt.nuse == 0);
+  freeprofile(g);
 }
 
 static l_mem atomic(lua_State *L) {
@@ -1014,6 +2330,7 @@ static l_mem atomic(lua_State *L) {
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = nullptr;
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -1024,10 +2341,10 @@ static l_mem atomic(lua_State *L) {
   markmt(g);  /* mark global metatables */
   /* remark occasional upvalues of (maybe) dead threads */
   remarkupvals(g);
-  propagateall(g);  /* propagate changes */
+  parallelpropagate(g);  /* propagate changes */
   work = g->GCmemtrav;  /* stop counting (do not recount 'grayagain') */
   g->gray = grayagain;
-  propagateall(g);  /* traverse 'grayagain' list */
+  parallelpropagate(g);  /* traverse 'grayagain' list */
   g->GCmemtrav = 0;  /* restart counting */
   convergeephemerons(g);
   /* at this point, all strongly accessible objects are marked. */
@@ -1039,7 +2356,7 @@ static l_mem atomic(lua_State *L) {
   separatetobefnz(g, 0);  /* separate objects to be finalized */
   g->gcfinnum = 1;  /* there may be objects to be finalized */
   markbeingfnz(g);  /* mark objects that will be finalized */
-  propagateall(g);  /* remark, to propagate 'resurrection' */
+  parallelpropagate(g);  /* remark, to propagate 'resurrection' */
   g->GCmemtrav = 0;  /* restart counting */
   convergeephemerons(g);
   /* at this point, all resurrected objects are marked. */
@@ -1049,6 +2366,7 @@ static l_mem atomic(lua_State *L) {
   /* clear values from resurrected weak tables */
   clearvalues(g, g->weak, origweak);
   clearvalues(g, g->allweak, origall);
+  compactslices(L, g);
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   work += g->GCmemtrav;  /* complete counting */
@@ -1060,6 +2378,7 @@ static lu_mem sweepstep(lua_State *L, global_State *g,
   if (g->sweepgc)
   {
     l_mem olddebt = g->GCdebt;
+    sweepinbackground(g);
     g->sweepgc = sweeplist(L, g->sweepgc, GCSWEEPMAX);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
     if (g->sweepgc) /* is there still something to sweep? */
@@ -1073,6 +2392,7 @@ static lu_mem sweepstep(lua_State *L, global_State *g,
 
 static lu_mem singlestep(lua_State *L) {
   global_State *g = L->globalState;
+  timestep(g);
   switch (g->gcstate)
   {
     case GCSpause: {
@@ -1113,7 +2433,7 @@ static lu_mem singlestep(lua_State *L) {
       return 0;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && g->gckind != KGC_EMERGENCY)
+      if (g->tobefnz && !g->gcemergency)
       {
         int n = runafewfinalizers(L);
         return (n * GCFINALIZECOST);
@@ -1121,6 +2441,7 @@ static lu_mem singlestep(lua_State *L) {
       else    /* emergency mode or no more finalizers */
       {
         g->gcstate = GCSpause;  /* finish collection */
+        statcycle(g);
         return 0;
       }
     }
@@ -1138,6 +2459,457 @@ void luaC_runtilstate(lua_State *L, int statesmask) {
     singlestep(L);
 }
 
+/*
+** {======================================================
+** Generational Collector
+** =======================================================
+*/
+
+/*
+** an old closure is not traversed in minor collections, so its upvalues
+** must keep their values old (see 'luaC_upvalbarrier_')
+*/
+static void oldclosure(GCObject *o) {
+  if (o->type == LuaType::Variant::LuaFunctionClosure)
+  {
+    LClosure *cl = gco2lcl(o);
+    for (int i = 0; i < cl->nupvalues; i++)
+      if (cl->upvals[i] != nullptr)
+        cl->upvals[i]->old = 1;
+  }
+}
+
+/*
+** Sweep a list of objects, deleting dead ones and turning the others
+** into old objects, as they enter the generational mode. Threads are
+** always gray and must be in 'grayagain'; everything else is black.
+*/
+static void sweep2old(lua_State *L, GCObject **p) {
+  GCObject *curr;
+  global_State *g = L->globalState;
+  while ((curr = *p) != nullptr)
+  {
+    if (iswhite(curr))    /* is 'curr' dead? */
+    {
+      lua_assert(isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else    /* all surviving objects become old */
+    {
+      setage(curr, G_OLD);
+      if (curr->type == LuaType::Variant::Thread)    /* threads must be watched */
+      {
+        lua_State *th = gco2th(curr);
+        linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
+      }
+      else    /* everything else is black */
+      {
+        gray2black(curr);
+        oldclosure(curr);
+      }
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
+/*
+** Sweep for generational mode. Delete dead objects. (Because the
+** collection is not incremental, there are no "new white" objects
+** during the sweep. So, any white object must be dead.) For
+** non-dead objects, advance their ages and clear the color of
+** new objects. (Old objects keep their colors.)
+** The ages of G_TOUCHED1 and G_TOUCHED2 objects cannot be advanced
+** here, because these old-generation objects are usually not swept
+** here. They will all be advanced in 'correctgraylist'. That function
+** will also remove objects turned white here from any gray list.
+*/
+static GCObject **sweepgen(lua_State *L, global_State *g, GCObject **p,
+                           GCObject *limit, GCObject **pfirstold1) {
+  static const uint8_t nextage[] = {
+    G_SURVIVAL,  /* from G_NEW */
+    G_OLD1,      /* from G_SURVIVAL */
+    G_OLD1,      /* from G_OLD0 */
+    G_OLD,       /* from G_OLD1 */
+    G_OLD,       /* from G_OLD (do not change) */
+    G_TOUCHED1,  /* from G_TOUCHED1 (do not change) */
+    G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
+  };
+  int white = luaC_white(g);
+  GCObject *curr;
+  while ((curr = *p) != limit)
+  {
+    statcount(g, swept);
+    if (iswhite(curr))    /* is 'curr' dead? */
+    {
+      lua_assert(!isold(curr) && isdead(g, curr));
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else    /* correct mark and age */
+    {
+      if (getage(curr) == G_NEW)    /* new objects go back to white */
+      {
+        int marked = curr->marked & maskgcbits;  /* erase GC bits */
+        curr->marked = cast_byte(marked | (G_SURVIVAL << AGESHIFT) | white);
+      }
+      else    /* all other objects will be old, and so keep their color */
+      {
+        setage(curr, nextage[getage(curr)]);
+        if (getage(curr) == G_OLD1)
+        {
+          if (*pfirstold1 == nullptr)
+            *pfirstold1 = curr;  /* first OLD1 object in the list */
+          oldclosure(curr);
+        }
+      }
+      p = &curr->next;  /* go to next element */
+    }
+  }
+  return p;
+}
+
+/*
+** Traverse a list making all its elements white and clearing their
+** age. In incremental mode, all objects are 'new' all the time,
+** except for fixed strings (which are always old).
+*/
+static void whitelist(global_State *g, GCObject *p) {
+  int white = luaC_white(g);
+  for (; p != nullptr; p = p->next)
+    p->marked = cast_byte((p->marked & maskgcbits) | white);
+}
+
+/*
+** Correct a list of gray objects after a young collection. Return a
+** pointer to where rest of the list should be linked.
+** Because this correction is done after sweeping, young objects might
+** be turned white and still be in the list. They are only removed.
+** 'TOUCHED1' objects are advanced to 'TOUCHED2' and remain on the list;
+** non-white threads also remain on the list; 'TOUCHED2' objects become
+** regular old; they and anything else are removed from the list.
+*/
+static GCObject **correctgraylist(GCObject **p) {
+  GCObject *curr;
+  while ((curr = *p) != nullptr)
+  {
+    GCObject **next = getgclist(curr);
+    if (iswhite(curr))
+      *p = *next;  /* remove all white objects */
+    else if (getage(curr) == G_TOUCHED1)    /* touched in this cycle? */
+    {
+      lua_assert(isgray(curr));
+      gray2black(curr);  /* make it black, for next barrier */
+      changeage(curr, G_TOUCHED1, G_TOUCHED2);
+      p = next;  /* keep it in the list and go to next element */
+    }
+    else if (curr->type == LuaType::Variant::Thread)
+    {
+      lua_assert(isgray(curr));
+      p = next;  /* keep non-white threads on the list */
+    }
+    else    /* everything else is removed */
+    {
+      lua_assert(isold(curr));  /* young objects should be white here */
+      if (getage(curr) == G_TOUCHED2)    /* advance from TOUCHED2... */
+        changeage(curr, G_TOUCHED2, G_OLD);  /* ... to OLD */
+      gray2black(curr);  /* make object black (to be removed) */
+      *p = *next;
+    }
+  }
+  return p;
+}
+
+/*
+** Correct all gray lists, coalescing them into 'grayagain'.
+*/
+static void correctgraylists(global_State *g) {
+  GCObject **list = correctgraylist(&g->grayagain);
+  *list = g->weak; g->weak = nullptr;
+  list = correctgraylist(list);
+  *list = g->allweak; g->allweak = nullptr;
+  list = correctgraylist(list);
+  *list = g->ephemeron; g->ephemeron = nullptr;
+  correctgraylist(list);
+}
+
+/*
+** Mark black 'OLD1' objects when starting a new young collection.
+** Gray objects are already in some gray list, and so will be visited
+** in the atomic step.
+*/
+static void markold(global_State *g, GCObject *from, GCObject *to) {
+  GCObject *p;
+  for (p = from; p != to; p = p->next)
+  {
+    if (getage(p) == G_OLD1)
+    {
+      lua_assert(!iswhite(p));
+      if (isblack(p))
+      {
+        black2gray(p);  /* should be '2white', but gray works too */
+        reallymarkobject(g, p);
+      }
+    }
+  }
+}
+
+/*
+** Finish a young-generation collection. (Errors in finalizers go up,
+** as in 'runafewfinalizers'.)
+*/
+static void finishgencycle(lua_State *L, global_State *g) {
+  correctgraylists(g);
+  checkSizes(L, g);
+  g->gcstate = GCSpropagate;  /* skip restart */
+  if (!g->gcemergency)
+    while (g->tobefnz)
+      GCTM(L, 1);
+  statcycle(g);
+}
+
+/*
+** Does a young collection. First, mark 'OLD1' objects. Then does the
+** atomic step. Then, sweep all lists and advance pointers. Finally,
+** finish the collection.
+*/
+static void youngcollection(lua_State *L, global_State *g) {
+  GCObject **psurvival;  /* to point to first non-dead survival object */
+  GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  lua_assert(g->gcstate == GCSpropagate);
+  statcount(g, minors);
+  if (g->firstold1)    /* are there regular OLD1 objects? */
+  {
+    markold(g, g->firstold1, g->reallyold);  /* mark them */
+    g->firstold1 = nullptr;  /* no more OLD1 objects (for now) */
+  }
+  markold(g, g->finobj, g->finobjrold);
+  markold(g, g->tobefnz, nullptr);
+  atomic(L);
+
+  {
+    sweepinbackground(g);
+    /* sweep nursery and get a pointer to its last live element */
+    g->gcstate = GCSswpallgc;
+    psurvival = sweepgen(L, g, &g->allgc, g->survival, &g->firstold1);
+    /* sweep 'survival' */
+    sweepgen(L, g, psurvival, g->old1, &g->firstold1);
+    g->reallyold = g->old1;
+    g->old1 = *psurvival;  /* 'survival' survivals are old now */
+    g->survival = g->allgc;  /* all news are survivals */
+
+    /* repeat for 'finobj' lists */
+    dummy = nullptr;  /* no 'firstold1' optimization for 'finobj' lists */
+    psurvival = sweepgen(L, g, &g->finobj, g->finobjsur, &dummy);
+    /* sweep 'survival' */
+    sweepgen(L, g, psurvival, g->finobjold1, &dummy);
+    g->finobjrold = g->finobjold1;
+    g->finobjold1 = *psurvival;  /* 'survival' survivals are old now */
+    g->finobjsur = g->finobj;  /* all news are survivals */
+
+    sweepgen(L, g, &g->tobefnz, nullptr, &dummy);
+  }
+  finishgencycle(L, g);
+}
+
+/*
+** Clears all gray lists, sweeps objects, and prepare sublists to enter
+** generational mode. The sweeps remove dead objects and turn all
+** surviving objects to old. The main thread is not in 'allgc', so it
+** is done here. Threads go back to 'grayagain'; everything else is
+** turned black (not in any gray list).
+*/
+static void atomic2gen(lua_State *L, global_State *g) {
+  g->gray = g->grayagain = nullptr;
+  g->weak = g->allweak = g->ephemeron = nullptr;
+  {
+    sweepinbackground(g);
+    /* sweep all elements making them old */
+    g->gcstate = GCSswpallgc;
+    sweep2old(L, &g->allgc);
+    /* everything alive now is old */
+    g->reallyold = g->old1 = g->survival = g->allgc;
+    g->firstold1 = nullptr;  /* there are no OLD1 objects anywhere */
+
+    /* repeat for 'finobj' lists */
+    sweep2old(L, &g->finobj);
+    g->finobjrold = g->finobjold1 = g->finobjsur = g->finobj;
+
+    sweep2old(L, &g->tobefnz);
+  }
+
+  setage(g->mainthread, G_OLD);
+  linkgclist(g->mainthread, g->grayagain);
+
+  g->gckind = KGC_GEN;
+  g->lastatomic = 0;
+  g->GCestimate = g->getTotalBytes();  /* base for memory control */
+  finishgencycle(L, g);
+}
+
+/*
+** Set debt for the next minor collection, which will happen when
+** memory grows 'genminormul'%.
+*/
+static void setminordebt(global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, (g->getTotalBytes() / 100)) * g->genminormul));
+}
+
+/*
+** Enter generational mode. Must go until the end of an atomic cycle
+** to ensure that all objects are correctly marked and weak tables
+** are cleared. Then, turn all objects into old and finishes the
+** collection.
+*/
+static lu_mem entergen(lua_State *L, global_State *g) {
+  lu_mem numobjs;
+  luaC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  parallelpropagate(g);
+  numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
+  atomic2gen(L, g);
+  setminordebt(g);  /* set debt assuming next cycle will be minor */
+  return numobjs;
+}
+
+/*
+** Enter incremental mode. Turn all objects white, make all
+** intermediate lists point to NULL (to avoid invalid pointers),
+** and go to the pause state.
+*/
+static void enterinc(global_State *g) {
+  whitelist(g, g->allgc);
+  g->reallyold = g->old1 = g->survival = nullptr;
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  g->finobjrold = g->finobjold1 = g->finobjsur = nullptr;
+  g->mainthread->marked = cast_byte((g->mainthread->marked & maskgcbits) |
+                                    luaC_white(g));
+  g->gcstate = GCSpause;
+  g->gckind = KGC_INC;
+  g->lastatomic = 0;
+}
+
+/*
+** Change collector mode to 'newmode'.
+*/
+void luaC_changemode(lua_State *L, int newmode) {
+  global_State *g = L->globalState;
+  if (newmode != g->gckind)
+  {
+    if (newmode == KGC_GEN)    /* entering generational mode? */
+      entergen(L, g);
+    else
+      enterinc(g);  /* entering incremental mode */
+  }
+  g->lastatomic = 0;
+}
+
+/*
+** Does a full collection in generational mode.
+*/
+static lu_mem fullgen(lua_State *L, global_State *g) {
+  enterinc(g);
+  return entergen(L, g);
+}
+
+/*
+** Does a major collection after last collection was a "bad collection".
+**
+** When the program is building a big structure, it allocates lots of
+** memory but generates very little garbage. In those scenarios,
+** the generational mode just wastes time doing small collections, and
+** major collections are frequently what we call a "bad collection", a
+** collection that frees too few objects. To avoid the cost of switching
+** between generational mode and the incremental mode needed for full
+** (major) collections, the collector tries to stay in incremental mode
+** after a bad collection, and to switch back to generational mode only
+** after a "good" collection (one that traverses less than 9/8 objects
+** of the previous one).
+** The collector must choose whether to stay in incremental mode or to
+** switch back to generational mode before sweeping. At this point, it
+** does not know the real memory in use, so it cannot use memory to
+** decide whether to return to generational mode. Instead, it uses the
+** number of objects traversed (returned by 'atomic') as a proxy. The
+** field 'g->lastatomic' keeps this count from the last collection.
+** ('g->lastatomic != 0' also means that the last collection was bad.)
+*/
+static void stepgenfull(lua_State *L, global_State *g) {
+  lu_mem newatomic;  /* count of traversed objects */
+  lu_mem lastatomic = g->lastatomic;  /* count from last collection */
+  if (g->gckind == KGC_GEN)  /* still in generational mode? */
+    enterinc(g);  /* enter incremental mode */
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
+  parallelpropagate(g);
+  newatomic = atomic(L);  /* mark everybody */
+  if (newatomic < lastatomic + (lastatomic >> 3))    /* good collection? */
+  {
+    atomic2gen(L, g);  /* return to generational mode */
+    setminordebt(g);
+  }
+  else    /* another bad collection; stay in incremental mode */
+  {
+    g->GCestimate = g->getTotalBytes();  /* first estimate */;
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
+    setpause(g);
+    g->lastatomic = newatomic;
+  }
+}
+
+/*
+** Does a generational "step".
+** Usually, this means doing a minor collection and setting the debt to
+** make another collection when memory grows 'genminormul'% larger.
+**
+** However, there are exceptions. If memory grows 'genmajormul'%
+** larger than it was at the end of the last major collection (kept
+** in 'g->GCestimate'), the function does a major collection. At the
+** end, it checks whether the major collection was able to free a
+** decent amount of memory (at least half the growth in memory since
+** previous major collection). If so, the collector keeps its state,
+** and the next collection will probably be minor again. Otherwise,
+** we have what we call a "bad collection". In that case, set the field
+** 'g->lastatomic' to signal that fact, so that the next collection will
+** go to 'stepgenfull'.
+**
+** 'GCdebt <= 0' means an explicit call to GC step with "size" zero;
+** in that case, do a minor collection.
+*/
+static void genstep(lua_State *L, global_State *g) {
+  if (g->lastatomic != 0)  /* last collection was a bad one? */
+    stepgenfull(L, g);  /* do a full step */
+  else
+  {
+    lu_mem majorbase = g->GCestimate;  /* memory after last major collection */
+    lu_mem majorinc = (majorbase / 100) * g->genmajormul;
+    if (g->GCdebt > 0 && g->getTotalBytes() > majorbase + majorinc)
+    {
+      lu_mem numobjs = fullgen(L, g);  /* do a major collection */
+      if (g->getTotalBytes() < majorbase + (majorinc / 2))
+      {
+        /* collected at least half of memory growth since last major
+           collection; keep doing minor collections. */
+        lua_assert(g->lastatomic == 0);
+      }
+      else    /* bad collection */
+      {
+        g->lastatomic = numobjs;  /* signal that last collection was bad */
+        setpause(g);  /* do a long wait for next (major) collection */
+      }
+    }
+    else    /* regular case; do a minor collection */
+    {
+      youngcollection(L, g);
+      setminordebt(g);
+      g->GCestimate = majorbase;  /* preserve base value */
+    }
+  }
+  lua_assert(isdecGCmodegen(g));
+}
+
+/* }====================================================== */
+
 /*
 ** get GC debt and convert it from Kb to 'work units' (avoid zero debt
 ** and overflows)
@@ -1166,6 +2938,13 @@ void luaC_step(lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  timepause(g);
+  luaS_resizestep(L);  /* move any resize of 'strt' forward */
+  if (isdecGCmodegen(g))
+  {
+    genstep(L, g);
+    return;
+  }
   do    /* repeat until pause or enough "credit" (negative debt) */
   {
     lu_mem work = singlestep(L);  /* perform one single step */
@@ -1182,30 +2961,45 @@ void luaC_step(lua_State *L) {
 }
 
 /*
-** Performs a full GC cycle; if 'isemergency', set a flag to avoid
-** some operations which could change the interpreter state in some
-** unexpected ways (running finalizers and shrinking some structures).
-** Before running the collection, check 'keepinvariant'; if it is true,
-** there may be some objects marked as black, so the collector has
-** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** Performs a full GC cycle in incremental mode. Before running the
+** collection, check 'keepinvariant'; if it is true, there may be some
+** objects marked as black, so the collector has to sweep all objects
+** to turn them back to white (as white has not changed, nothing will
+** be collected).
 */
-void luaC_fullgc(lua_State *L, int isemergency) {
-  global_State *g = L->globalState;
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency)
-    g->gckind = KGC_EMERGENCY; /* set flag */
+static void fullinc(lua_State *L, global_State *g) {
   if (keepinvariant(g)) /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+  if (g->gcstate == GCSpropagate)
+  {  /* mark everything at once, maybe in parallel */
+    parallelpropagate(g);
+    g->gcstate = GCSatomic;
+  }
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == g->getTotalBytes());
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
   setpause(g);
 }
 
+/*
+** Performs a full GC cycle; if 'isemergency', set a flag to avoid
+** some operations which could change the interpreter state in some
+** unexpected ways (running finalizers and shrinking some structures).
+*/
+void luaC_fullgc(lua_State *L, int isemergency) {
+  global_State *g = L->globalState;
+  timepause(g);
+  lua_assert(!g->gcemergency);
+  g->gcemergency = isemergency;  /* set flag */
+  if (g->gckind == KGC_INC)
+    fullinc(L, g);
+  else
+    fullgen(L, g);
+  g->gcemergency = false;
+}
+
 /* }====================================================== */
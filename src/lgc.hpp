@@ -23,6 +23,52 @@
 ** is not being enforced (e.g., sweep phase).
 */
 
+/* start new states in generational mode (see 'luaC_changemode') */
+#if !defined(LUA_GENERATIONALGC)
+#define LUA_GENERATIONALGC      0
+#endif
+
+/*
+** mark large heaps with several threads in the atomic phase and in
+** full collections; LUAI_MARKWORKERS is the number of threads helping
+** the collector (0 for one less than the hardware threads), and
+** LUAI_PARMARKMIN is the smallest heap that is worth it
+*/
+#if !defined(LUA_USE_PARALLELMARK)
+#define LUA_USE_PARALLELMARK    0
+#endif
+
+#if !defined(LUAI_MARKWORKERS)
+#define LUAI_MARKWORKERS        0
+#endif
+
+#if !defined(LUAI_PARMARKMIN)
+#define LUAI_PARMARKMIN         (4 * 1024 * 1024)
+#endif
+
+/* free the blocks of swept objects in a background thread */
+#if !defined(LUA_USE_BGSWEEP)
+#define LUA_USE_BGSWEEP         0
+#endif
+
+/* keep statistics of the collector (see 'lua_gcstats') */
+#if !defined(LUA_USE_GCSTATS)
+#define LUA_USE_GCSTATS         0
+#endif
+
+/*
+** account the memory in use by kind of object, and sample one in
+** LUAI_MEMSAMPLE new objects to attribute memory to the source lines
+** that created it (see 'lua_memusage' and 'lua_memsites')
+*/
+#if !defined(LUA_USE_MEMACCOUNT)
+#define LUA_USE_MEMACCOUNT      0
+#endif
+
+#if !defined(LUAI_MEMSAMPLE)
+#define LUAI_MEMSAMPLE          512
+#endif
+
 /* how much to allocate before next GC step */
 #if !defined(GCSTEPSIZE)
 /* ~100 small strings */
@@ -71,7 +117,8 @@
 #define WHITE1BIT       1  /* object is white (type 1) */
 #define BLACKBIT        2  /* object is black */
 #define FINALIZEDBIT    3  /* object has been marked for finalization */
-/* bit 7 is currently used by tests (luaL_checkmemory) */
+/* bits 4-6 keep the age of objects in generational mode */
+#define SAMPLEDBIT      7  /* object is sampled by memory accounting */
 
 #define WHITEBITS       bit2mask(WHITE0BIT, WHITE1BIT)
 
@@ -91,6 +138,37 @@
 
 #define luaC_white(g)   cast(uint8_t, (g)->currentwhite & WHITEBITS)
 
+/*
+** Object age in generational mode. New objects become 'survival' after
+** one collection and old after two; old objects are not traversed in
+** minor collections, so a barrier from an old object to a young one
+** either makes the young one old ('old0', forward barrier) or marks
+** the old one as 'touched' (backward barrier), to be traversed in the
+** next two collections. An object is 'old1' in its first collection
+** as old, when it is still traversed, as it may point to survivals.
+*/
+#define G_NEW           0  /* created in current cycle */
+#define G_SURVIVAL      1  /* created in previous cycle */
+#define G_OLD0          2  /* marked old by frw. barrier in this cycle */
+#define G_OLD1          3  /* first full cycle as old */
+#define G_OLD           4  /* really old object (not to be visited) */
+#define G_TOUCHED1      5  /* old object touched this cycle */
+#define G_TOUCHED2      6  /* old object touched in previous cycle */
+
+#define AGESHIFT        4
+#define AGEBITS         (7 << AGESHIFT)
+
+#define getage(o)       (((o)->marked >> AGESHIFT) & 7)
+#define setage(o, a)  \
+  ((o)->marked = cast_byte(((o)->marked & ~AGEBITS) | ((a) << AGESHIFT)))
+#define isold(o)        (getage(o) > G_SURVIVAL)
+
+#define changeage(o, f, t)  \
+  check_exp(getage(o) == (f), (o)->marked ^= cast_byte(((f)^(t)) << AGESHIFT))
+
+/* is the collector in generational mode or doing a full major cycle? */
+#define isdecGCmodegen(g)  ((g)->gckind == KGC_GEN || (g)->lastatomic != 0)
+
 /*
 ** Does one step of collection when debt becomes positive. 'pre'/'pos'
 ** allows some adjustments to be done only when needed. macro
@@ -120,6 +198,43 @@
     (iscollectable((uv)->v) && !upisopen(uv)) ? \
     luaC_upvalbarrier_(L, uv) : cast_void(0))
 
+#if LUA_USE_GCSTATS
+
+static_assert(LUA_GCSTATSTATES == GCSpause + 1);
+static_assert(LUA_GCSTATPROTO == int(LuaType::Variant::FunctionPrototype));
+
+struct GCStats
+{
+  lua_GCStats s {};
+  uint64_t cycletime = 0;  /* GC time of the current cycle */
+  int depth = 0;  /* nested pauses (a finalizer may call a full GC) */
+};
+
+#define luaC_statnew(g, t, sz)  \
+  ((g)->gcstats->s.newobjs[int(novariant(t))]++, \
+   cast_void((g)->gcstats->s.newbytes[int(novariant(t))] += (sz)))
+
+/* an object of type 't' grew or shrank from 'osz' to 'nsz' bytes */
+#define luaC_statresize(g, t, osz, nsz)  \
+  ((nsz) > (osz) \
+     ? cast_void((g)->gcstats->s.newbytes[int(novariant(t))] += (nsz) - (osz)) \
+     : cast_void((g)->gcstats->s.freedbytes[int(novariant(t))] += (osz) - (nsz)))
+
+#else
+
+#define luaC_statnew(g, t, sz)  cast_void(0)
+#define luaC_statresize(g, t, osz, nsz)  cast_void(0)
+
+#endif
+
+#if LUA_USE_MEMACCOUNT
+LUAI_FUNC void luaC_sample(lua_State *L, GCObject *o);
+#define luaC_checksample(L, o)  \
+  ((--(L)->globalState->memsample == 0) ? luaC_sample(L, obj2gco(o)) : cast_void(0))
+#else
+#define luaC_checksample(L, o)  cast_void(0)
+#endif
+
 class LGCFactory
 {
 public:
@@ -138,6 +253,8 @@ public:
     object->type = type;
     object->next = g->allgc;
     g->allgc = object;
+    luaC_statnew(g, type, sz);
+    luaC_checksample(L, object);
     return object;
   }
 
@@ -160,6 +277,9 @@ private:
   static void luaC_free(lua_State* L, lua_State* L1);
   static void luaC_free(lua_State* L, Udata* udata);
   static void luaC_free(lua_State* L, TString* string);
+#if LUA_NANBOXING
+  static void luaC_free(lua_State* L, BoxedInt* box);
+#endif
 };
 
 LUAI_FUNC void luaC_fix(lua_State *L, GCObject *o);
@@ -167,8 +287,20 @@ LUAI_FUNC void luaC_freeallobjects(lua_State *L);
 LUAI_FUNC void luaC_step(lua_State *L);
 LUAI_FUNC void luaC_runtilstate(lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc(lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode(lua_State *L, int newmode);
 LUAI_FUNC void luaC_barrier_(lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_(lua_State *L, Table *o);
+LUAI_FUNC void luaC_protobarrier_(lua_State *L, Proto *p);
 LUAI_FUNC void luaC_upvalbarrier_(lua_State *L, UpVal *uv);
 LUAI_FUNC void luaC_checkfinalizer(lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_upvdeccount(lua_State *L, UpVal *uv);
+LUAI_FUNC int luaC_getstats(lua_State *L, lua_GCStats *s);
+LUAI_FUNC int luaC_memusage(lua_State *L, size_t *bytes);
+LUAI_FUNC int luaC_memsites(lua_State *L, lua_MemSiteFn f, void *ud);
+
+#if LUA_USE_BGSWEEP
+struct GCFreer;
+/* freeing thread of the sweep running in this thread (if any) */
+extern thread_local GCFreer* luaM_sweeper;
+LUAI_FUNC void luaC_freelater(GCFreer *f, void *block, size_t size);
+#endif
@@ -20,6 +20,7 @@
 #include <lauxlib.hpp>
 #include <lualib.hpp>
 #include <llimits.hpp>
+#include <lnumconv.hpp>
 
 /*
 ** Change this macro to accept other modes for 'fopen' besides
@@ -600,12 +601,24 @@ static int g_write(lua_State *L, FILE *f, int arg) {
   {
     if (lua_type(L, arg) == LuaType::Basic::Number)
     {
+#if LUA_USE_FASTNUMFMT
+      char buff[LUAI_MAXNUM2STR];
+      int len = lua_isinteger(L, arg)
+                ? luai_int2str(buff, lua_tointeger(L, arg))
+                : luai_flt2str(buff, lua_tonumber(L, arg), LUAI_NUMPREC, 'g',
+                               lua_getlocaledecpoint());
+      if (len >= 0)
+        len = (int)fwrite(buff, sizeof(char), len, f);
+      else  /* a float that 'luai_flt2str' leaves to the C library */
+        len = fprintf(f, LUA_NUMBER_FMT, (LUA_NUMBER)lua_tonumber(L, arg));
+#else
       /* optimization: could be done exactly as for strings */
       int len = lua_isinteger(L, arg)
                 ? fprintf(f, LUA_INTEGER_FMT,
                           (LUA_INTEGER)lua_tointeger(L, arg))
                 : fprintf(f, LUA_NUMBER_FMT,
                           (LUA_NUMBER)lua_tonumber(L, arg));
+#endif
       status = status && (len > 0);
     }
     else
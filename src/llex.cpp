@@ -127,8 +127,9 @@ TString *luaX_newstring(LexState *ls, const char *str, size_t l) {
     setbvalue(o, 1);  /* t[string] = true */
     luaC_checkGC(L);
   }
-  else /* string already present */
+  else if (!isshaped(ls->h))    /* string already present? */
     ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
+  /* (a shaped table only has short strings, which are already unique) */
   L->top--;  /* remove string from stack */
   return ts;
 }
@@ -217,7 +218,7 @@ static int read_numeral(LexState *ls, SemInfo *seminfo) {
       break;
   }
   save(ls, '\0');
-  if (luaO_str2num(luaZ_buffer(ls->buff), &obj) == 0) /* format error? */
+  if (luaO_str2num(ls->L, luaZ_buffer(ls->buff), &obj) == 0) /* format error? */
     lexerror(ls, "malformed number", TK_FLT);
   if (ttisinteger(&obj))
   {
@@ -85,6 +85,15 @@ union L_Umaxalign
 #define UNUSED(x)       ((void)(x))
 #endif
 
+/* hints for the branch layout of hot paths */
+#if defined(__GNUC__)
+#define l_likely(x)     __builtin_expect(((x) != 0), 1)
+#define l_unlikely(x)   __builtin_expect(((x) != 0), 0)
+#else
+#define l_likely(x)     (x)
+#define l_unlikely(x)   (x)
+#endif
+
 /* type casts (a macro highlights casts in the code) */
 #define cast(t, exp)    ((t)(exp))
 
@@ -41,6 +41,26 @@ void luaM_toobig(lua_State *L)
   luaG_runerror(L, "memory allocation error: block too big");
 }
 
+/*
+** Small blocks of a state with an arena come from it; while a
+** collection sweeps, other blocks being freed go to the freeing thread
+** (see 'luaC_freelater'). 'osize' is 0 for new blocks.
+*/
+void* luaM_rawrealloc(lua_State* L, void* block, size_t osize, size_t nsize)
+{
+  LuaArena* arena = L->globalState->arena;
+  if (arena != nullptr && (LuaArena::serves(osize) || LuaArena::serves(nsize)))
+    return arena->realloc(block, osize, nsize);
+#if LUA_USE_BGSWEEP
+  if (nsize == 0 && osize != 0 && luaM_sweeper != nullptr)
+  {  /* leave it to the freeing thread */
+    luaC_freelater(luaM_sweeper, block, osize);
+    return nullptr;
+  }
+#endif
+  return LuaAllocator<void>::alloc(block, osize, nsize);
+}
+
 void luaM_addGCDebt(lua_State* L, size_t size, size_t realosize)
 {
   global_State* g = L->globalState;
@@ -16,6 +16,7 @@ extern void luaM_toobig(lua_State* L);
 extern void luaM_addGCDebt(lua_State* L, size_t size, size_t realosize);
 extern void luaM_allocFail(lua_State* L);
 extern void luaM_tooMany(lua_State* L, const char* what, int32_t limit);
+extern void* luaM_rawrealloc(lua_State* L, void* block, size_t osize, size_t nsize);
 
 template<class T>
 class LMem
@@ -132,7 +133,7 @@ public:
     //  luaC_fullgc(L, 1);  /* force a GC whenever possible */
   #endif
 
-    newblock = LuaAllocator<T>::alloc(block, oldsize, size);
+    newblock = static_cast<T*>(luaM_rawrealloc(L, block, realosize, size));
     if (newblock == nullptr && size > 0)
       luaM_allocFail(L);
 
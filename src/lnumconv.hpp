@@ -0,0 +1,51 @@
+#pragma once
+/*
+** Conversions between numbers and text without the C library
+** See Copyright Notice in lua.h
+*/
+
+#include <lua.hpp>
+
+#if !defined(LUA_USE_FASTNUMFMT)
+#define LUA_USE_FASTNUMFMT      1
+#endif
+
+#if !defined(LUA_USE_FASTNUMPARSE)
+#define LUA_USE_FASTNUMPARSE    1
+#endif
+
+#if !defined(LUA_SHORTESTFLOATS)
+#define LUA_SHORTESTFLOATS      0
+#endif
+
+/*
+** precision of LUA_NUMBER_FMT for 'luai_flt2str'; with
+** LUA_SHORTESTFLOATS, floats are written with the fewest digits that
+** read back as the same float
+*/
+#if LUA_SHORTESTFLOATS
+#define LUAI_NUMPREC            (-1)
+#else
+#define LUAI_NUMPREC            14
+#endif
+
+/*
+** WARNING: these functions assume that lua_Number is an IEEE double.
+** 'luai_flt2str' only does the conversions it can do exactly, and
+** returns -1 for the others, which the caller must hand to 'snprintf'.
+** 'luai_str2flt' reads only decimal numerals with a '.' as radix mark,
+** with optional spaces around; it returns the address of the ending
+** '\0', or NULL for anything else and for the few numerals it cannot
+** convert exactly, which the caller must hand to 'strtod'.
+*/
+
+/* maximum length written by 'luai_int2str' (plus the final '\0') */
+#define LUAI_MAXINT2STR         (21 + 1)
+
+/* buffer size enough for 'luai_int2str' and for 'g' conversions */
+#define LUAI_MAXNUM2STR         32
+
+LUAI_FUNC int luai_int2str(char *buff, lua_Integer n);
+LUAI_FUNC int luai_flt2str(char *buff, lua_Number x, int prec, int conv,
+                           char point);
+LUAI_FUNC const char *luai_str2flt(const char *s, lua_Number *result);
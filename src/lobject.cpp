@@ -19,7 +19,9 @@
 #include <lctype.hpp>
 #include <ldebug.hpp>
 #include <ldo.hpp>
+#include <lgc.hpp>
 #include <lmem.hpp>
+#include <lnumconv.hpp>
 #include <lobject.hpp>
 #include <lstate.hpp>
 #include <lstring.hpp>
@@ -30,7 +32,7 @@ LUAI_DDEF const TValue luaO_nilobject_ = {NILCONSTANT};
 
 TString::~TString()
 {
-  if (this->type == LuaType::Variant::ShortString)
+  if (this->type == LuaType::Variant::ShortString && !istransient(this))
     luaS_remove(LGCFactory::getActiveState(), this); /* remove it from hash table */
 }
 
@@ -41,6 +43,7 @@ Proto::~Proto()
   lua_State* L = LGCFactory::getActiveState();
 
   LMem<Instruction>::luaM_freearray(L, this->code, this->sizecode);
+  LMem<FieldCache>::luaM_freearray(L, this->fieldcache, this->sizecode);
   LMem<Proto*>::luaM_freearray(L, this->p, this->sizep);
   LMem<TValue>::luaM_freearray(L, this->k, this->sizek);
   LMem<int>::luaM_freearray(L, this->lineinfo, this->sizelineinfo);
@@ -62,8 +65,11 @@ Table::~Table()
 {
   lua_State* L = LGCFactory::getActiveState();
   if (!isdummy(this))
-    LMem<Node>::luaM_freearray(L, this->node, cast(size_t, sizenode(this)));
-  LMem<TValue>::luaM_freearray(L, this->array, this->sizearray);
+    LMem<Node>::luaM_freemem(L, this->node, nodeblocksize(cast(size_t, sizenode(this))));
+  LMem<TValue>::luaM_freemem(L, this->array, arraycellsize(this) * this->sizearray);
+  LMem<TValue>::luaM_freearray(L, this->slots, this->sizeslots);
+  if (isshaped(this))
+    luaH_releaseshape(L, this->shape);
 }
 
 /*
@@ -156,6 +162,18 @@ static lua_Number numarith(lua_State *L, int op, lua_Number v1,
   }
 }
 
+#if LUA_NANBOXING
+/*
+** stores in 'obj' an integer too large for the payload of a value
+*/
+void luaO_boxint(lua_State *L, TValue *obj, lua_Integer i) {
+  BoxedInt *b = LGCFactory::luaC_newobj<BoxedInt>(L, LuaType::Variant::IntNumber,
+                                                  sizeof(BoxedInt));
+  b->i = i;
+  setgcovalue(L, obj, b);
+}
+#endif
+
 void luaO_arith(lua_State *L, int op, const TValue *p1, const TValue *p2,
                 TValue *res) {
   switch (op)
@@ -166,7 +184,7 @@ void luaO_arith(lua_State *L, int op, const TValue *p1, const TValue *p2,
       lua_Integer i1; lua_Integer i2;
       if (tointeger(p1, &i1) && tointeger(p2, &i2))
       {
-        setivalue(res, intarith(L, op, i1, i2));
+        setivalue(L, res, intarith(L, op, i1, i2));
         return;
       }
       else
@@ -186,7 +204,7 @@ void luaO_arith(lua_State *L, int op, const TValue *p1, const TValue *p2,
       lua_Number n1; lua_Number n2;
       if (ttisinteger(p1) && ttisinteger(p2))
       {
-        setivalue(res, intarith(L, op, ivalue(p1), ivalue(p2)));
+        setivalue(L, res, intarith(L, op, ivalue(p1), ivalue(p2)));
         return;
       }
       else if (tonumber(p1, &n1) && tonumber(p2, &n2))
@@ -327,12 +345,20 @@ static const char *l_str2dloc(const char *s, lua_Number *result, int mode) {
 ** mark. If the convertion fails, it may mean number has a dot but
 ** locale accepts something else. In that case, the code copies 's'
 ** to a buffer (because 's' is read-only), changes the dot to the
-** current locale radix mark, and tries to convert again.
+** current locale radix mark, and tries to convert again. Plain decimal
+** numerals with a dot are first tried with 'luai_str2flt', which does
+** not depend on the locale.
 */
 static const char *l_str2d(const char *s, lua_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if LUA_USE_FASTNUMPARSE
+  if ((endptr = luai_str2flt(s, result)) != nullptr)  /* common case */
+    return endptr;
+#endif
+  pmode = strpbrk(s, ".xXnN");
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n') /* reject 'inf' and 'nan' */
     return nullptr;
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -391,20 +417,38 @@ static const char *l_str2int(const char *s, lua_Integer *result) {
   }
 }
 
-size_t luaO_str2num(const char *s, TValue *o) {
-  lua_Integer i; lua_Number n;
+/*
+** converts numeral 's' to an integer (in '*i', setting '*isint') or
+** else to a float (in '*n'); returns 0 if it fails, else the string
+** size plus one. (It needs no state, unlike a TValue result.)
+*/
+size_t luaO_rawstr2num(const char *s, lua_Integer *i, lua_Number *n,
+                       int *isint) {
   const char *e;
-  if ((e = l_str2int(s, &i)) != nullptr) /* try as an integer */
+  if ((e = l_str2int(s, i)) != nullptr) /* try as an integer */
+    *isint = 1;
+  else if ((e = l_str2d(s, n)) != nullptr) /* else try as a float */
+    *isint = 0;
+  else
+    return 0; /* conversion failed */
+  return (e - s) + 1;  /* success; return string size */
+}
+
+size_t luaO_str2num(lua_State *L, const char *s, TValue *o) {
+  lua_Integer i; lua_Number n;
+  int isint;
+  size_t sz = luaO_rawstr2num(s, &i, &n, &isint);
+  if (sz == 0)
+    return 0;
+  else if (isint)
   {
-    setivalue(o, i);
+    setivalue(L, o, i);
   }
-  else if ((e = l_str2d(s, &n)) != nullptr) /* else try as a float */
+  else
   {
     setfltvalue(o, n);
   }
-  else
-    return 0; /* conversion failed */
-  return (e - s) + 1;  /* success; return string size */
+  return sz;
 }
 
 int luaO_utf8esc(char *buff, unsigned long x) {
@@ -438,21 +482,29 @@ void luaO_tostring(lua_State *L, StkId obj)
   size_t len;
   lua_assert(ttisnumber(obj));
   if (ttisinteger(obj))
+#if LUA_USE_FASTNUMFMT
+    len = luai_int2str(buff, ivalue(obj));
+#else
     len = lua_integer2str(buff, sizeof(buff), ivalue(obj));
+#endif
   else
   {
-    len = lua_number2str(buff, sizeof(buff), fltvalue(obj));
+    int l = -1;
+#if LUA_USE_FASTNUMFMT
+    l = luai_flt2str(buff, fltvalue(obj), LUAI_NUMPREC, 'g', lua_getlocaledecpoint());
+#endif
+    len = (l >= 0) ? l : lua_number2str(buff, sizeof(buff), fltvalue(obj));
     if (buff[strspn(buff, "-0123456789")] == '\0')    /* looks like an int? */
     {
       buff[len++] = lua_getlocaledecpoint();
       buff[len++] = '0';  /* adds '.0' to result */
     }
   }
-  setsvalue2s(L, obj, luaS_newlstr(L, buff, len));
+  setsvalue2s(L, obj, luaS_newtransient(L, buff, len));
 }
 
 static void pushstr(lua_State *L, const char *str, size_t l) {
-  setsvalue2s(L, L->top, luaS_newlstr(L, str, l));
+  setsvalue2s(L, L->top, luaS_newtransient(L, str, l));
   luaD_inctop(L);
 }
 
@@ -486,11 +538,11 @@ const char *luaO_pushvfstring(lua_State *L, const char *fmt, va_list argp) {
         break;
       }
       case 'd': {  /* an 'int' */
-        setivalue(L->top, va_arg(argp, int));
+        setivalue(L, L->top, va_arg(argp, int));
         goto top2str;
       }
       case 'I': {  /* a 'lua_Integer' */
-        setivalue(L->top, cast(lua_Integer, va_arg(argp, lua_Integer)));
+        setivalue(L, L->top, cast(lua_Integer, va_arg(argp, lua_Integer)));
         goto top2str;
       }
       case 'f': {  /* a 'lua_Number' */
@@ -528,6 +580,7 @@ top2str:  /* convert the top element to a string */
   pushstr(L, fmt, strlen(fmt));
   if (n > 0)
     luaV_concat(L, n + 1);
+  luaS_flatvalue(L, L->top - 1);
   return svalue(L->top - 1);
 }
 
@@ -7,6 +7,7 @@
 
 #include <cstdarg>
 #include <cstdint>
+#include <cstring>
 #include <llimits.hpp>
 #include <lua.hpp>
 
@@ -38,6 +39,284 @@ union Value
   lua_Number n;    /* float numbers */
 };
 
+/*
+** LUA_NANBOXING selects the NaN-boxed representation below: a TValue
+** is a single 64-bit word instead of a 'Value' plus a separate tag.
+*/
+#if !defined(LUA_NANBOXING)
+#define LUA_NANBOXING   0
+#endif
+
+#if LUA_NANBOXING
+
+/*
+** NaN-boxed values. Floats are stored as themselves; every NaN is
+** canonicalized to a positive quiet NaN when stored, so words with
+** the 16 high bits in 0xFFF1-0xFFFF never hold a float. All other
+** values use that space: bits 48-51 hold a small tag ('NBTag') and
+** bits 0-47 the payload (a pointer, a boolean or an integer).
+** Pointers must fit in 48 bits (true for user-space addresses on
+** x86-64 and AArch64). Integers that fit in 48 bits are kept inline;
+** others are boxed in a collectable 'BoxedInt' (tag NB_BIGINT), so
+** both tags mean an integer and no value is ever truncated.
+*/
+static_assert(sizeof(void*) == 8, "NaN boxing needs a 64-bit target");
+static_assert(sizeof(lua_Number) == 8, "NaN boxing needs double floats");
+
+enum NBTag : uint64_t
+{
+  NB_NIL = 1,
+  NB_BOOLEAN,
+  NB_LIGHTUSERDATA,
+  NB_DEADKEY,
+  NB_INTEGER,
+  NB_BIGINT,  /* first collectable tag */
+  NB_SHRSTR,
+  NB_LNGSTR,
+  NB_TABLE,
+  NB_USERDATA,
+  NB_THREAD,
+  NB_PROTO,
+  NB_LCL,
+  NB_CCL,  /* last collectable tag */
+  NB_LCF
+};
+
+#define NB_TAGSHIFT     48
+#define NB_PAYLOAD      ((uint64_t(1) << NB_TAGSHIFT) - 1)
+#define NB_TAGPREFIX    uint64_t(0xFFF0)
+#define NB_CANONNAN     uint64_t(0x7FF8000000000000)
+#define nbtag(t)        ((NB_TAGPREFIX + (t)) << NB_TAGSHIFT)
+
+/* does integer 'i' fit in the payload (as a 48-bit signed number)? */
+#define nbfitsint(i)    \
+  (((l_castS2U(i) + (uint64_t(1) << (NB_TAGSHIFT - 1))) >> NB_TAGSHIFT) == 0)
+
+#define TValuefields    uint64_t value_
+
+struct TValue
+{
+  TValuefields;
+};
+
+/* an integer that does not fit in the payload */
+struct BoxedInt : public GCObject
+{
+  lua_Integer i;
+};
+
+/* macro defining a nil value */
+#define NILCONSTANT     nbtag(NB_NIL)
+
+#define val_(o)         ((o)->value_)
+
+/* tag of a non-float value */
+#define nbtagof(o)      ((val_(o) >> NB_TAGSHIFT) - NB_TAGPREFIX)
+
+inline uint64_t luaO_nbfromfloat(lua_Number n)
+{
+  uint64_t u;
+  memcpy(&u, &n, sizeof(u));
+  return (u >= nbtag(NB_NIL)) ? NB_CANONNAN : u;
+}
+
+inline lua_Number luaO_nbtofloat(uint64_t u)
+{
+  lua_Number n;
+  memcpy(&n, &u, sizeof(n));
+  return n;
+}
+
+inline lua_Integer luaO_nbtoint(uint64_t u)
+{
+  if (l_likely((u >> NB_TAGSHIFT) == NB_TAGPREFIX + NB_INTEGER))
+    return cast(lua_Integer, cast(int64_t, u << 16) >> 16);
+  return static_cast<BoxedInt*>(reinterpret_cast<GCObject*>(u & NB_PAYLOAD))->i;
+}
+
+/* raw type tag of a value word */
+inline LuaType luaO_nbtype(uint64_t u)
+{
+  static constexpr LuaType types[] = {
+    LuaType::Variant::FloatNumber,  /* unused */
+    LuaType::Basic::Nil,
+    LuaType::Basic::Boolean,
+    LuaType::Basic::LightUserData,
+    LuaType::Variant::DeadKey,
+    LuaType::Variant::IntNumber,
+    LuaType::Variant::IntNumber,  /* boxed, but still a plain integer */
+    LuaType(LuaType::Variant::ShortString).asCollectable(),
+    LuaType(LuaType::Variant::LongString).asCollectable(),
+    LuaType(LuaType::Basic::Table).asCollectable(),
+    LuaType(LuaType::Basic::UserData).asCollectable(),
+    LuaType(LuaType::Basic::Thread).asCollectable(),
+    LuaType(LuaType::Variant::FunctionPrototype).asCollectable(),
+    LuaType(LuaType::Variant::LuaFunctionClosure).asCollectable(),
+    LuaType(LuaType::Variant::CFunctionClosure).asCollectable(),
+    LuaType::Variant::LightCFunction
+  };
+  if (u < nbtag(NB_NIL))
+    return LuaType::Variant::FloatNumber;
+  return types[(u >> NB_TAGSHIFT) - NB_TAGPREFIX];
+}
+
+/* tag for a collectable object */
+inline uint64_t luaO_nbgctag(LuaType t)
+{
+  switch (t.asVariant())
+  {
+    case LuaType::Variant::LuaFunctionClosure: return NB_LCL;
+    case LuaType::Variant::CFunctionClosure: return NB_CCL;
+    case LuaType::Variant::ShortString: return NB_SHRSTR;
+    case LuaType::Variant::LongString: return NB_LNGSTR;
+    case LuaType::Variant::Table: return NB_TABLE;
+    case LuaType::Variant::UserData: return NB_USERDATA;
+    case LuaType::Variant::Thread: return NB_THREAD;
+    case LuaType::Variant::IntNumber: return NB_BIGINT;
+    default: lua_assert(t == LuaType::Variant::FunctionPrototype); return NB_PROTO;
+  }
+}
+
+/* raw type tag of a TValue */
+#define rttype(o)       luaO_nbtype(val_(o))
+
+/* tag with no variants */
+#define novariant(x)    ((x).asBasic())
+
+/* type tag of a TValue */
+#define ttype(o)        (rttype(o).asVariant())
+
+/* type tag of a TValue with no variants (bits 0-3) */
+#define ttnov(o)        (novariant(rttype(o)))
+
+/* Macros to test type */
+#define checknbtag(o, t)        ((val_(o) >> NB_TAGSHIFT) == NB_TAGPREFIX + (t))
+#define checknbrange(o, l, h)   (nbtagof(o) - (l) <= uint64_t((h) - (l)))
+#define checktag(o, t)          (rttype(o) == (t))
+#define checktype(o, t)         (ttnov(o) == (t))
+#define ttisnumber(o)           (ttisfloat(o) || ttisinteger(o))
+#define ttisfloat(o)            (val_(o) < nbtag(NB_NIL))
+#define ttisinteger(o)          checknbrange((o), NB_INTEGER, NB_BIGINT)
+#define ttisnil(o)              checknbtag((o), NB_NIL)
+#define ttisboolean(o)          checknbtag((o), NB_BOOLEAN)
+#define ttislightuserdata(o)    checknbtag((o), NB_LIGHTUSERDATA)
+#define ttisstring(o)           checknbrange((o), NB_SHRSTR, NB_LNGSTR)
+#define ttisshrstring(o)        checknbtag((o), NB_SHRSTR)
+#define ttislngstring(o)        checknbtag((o), NB_LNGSTR)
+#define ttistable(o)            checknbtag((o), NB_TABLE)
+#define ttisfunction(o)         checknbrange((o), NB_LCL, NB_LCF)
+#define ttisCclosure(o)         checknbtag((o), NB_CCL)
+#define ttisLclosure(o)         checknbtag((o), NB_LCL)
+#define ttislcf(o)              checknbtag((o), NB_LCF)
+#define ttisfulluserdata(o)     checknbtag((o), NB_USERDATA)
+#define ttisthread(o)           checknbtag((o), NB_THREAD)
+#define ttisdeadkey(o)          checknbtag((o), NB_DEADKEY)
+
+/* Macros to access values */
+#define nbpayload(o)    (val_(o) & NB_PAYLOAD)
+#define nbgc(o)         cast(GCObject*, nbpayload(o))
+#define ivalue(o)       check_exp(ttisinteger(o), luaO_nbtoint(val_(o)))
+#define fltvalue(o)     check_exp(ttisfloat(o), luaO_nbtofloat(val_(o)))
+#define nvalue(o)       check_exp(ttisnumber(o), \
+                                  (ttisinteger(o) ? cast_num(ivalue(o)) : fltvalue(o)))
+#define gcvalue(o)      check_exp(iscollectable(o), nbgc(o))
+#define pvalue(o)       check_exp(ttislightuserdata(o), cast(void*, nbpayload(o)))
+#define tsvalue(o)      check_exp(ttisstring(o), gco2ts(nbgc(o)))
+#define uvalue(o)       check_exp(ttisfulluserdata(o), gco2u(nbgc(o)))
+#define clLvalue(o)     check_exp(ttisLclosure(o), gco2lcl(nbgc(o)))
+#define clCvalue(o)     check_exp(ttisCclosure(o), gco2ccl(nbgc(o)))
+#define fvalue(o)       check_exp(ttislcf(o), reinterpret_cast<lua_CFunction>(nbpayload(o)))
+#define hvalue(o)       check_exp(ttistable(o), gco2t(nbgc(o)))
+#define bvalue(o)       check_exp(ttisboolean(o), cast_int(cast(uint32_t, nbpayload(o))))
+#define thvalue(o)      check_exp(ttisthread(o), gco2th(nbgc(o)))
+/* a dead value may get the 'gc' field, but cannot access its contents */
+#define deadvalue(o)    check_exp(ttisdeadkey(o), cast(void *, nbpayload(o)))
+
+#define l_isfalse(o)    (ttisnil(o) || (ttisboolean(o) && bvalue(o) == 0))
+
+#define iscollectable(o)        checknbrange((o), NB_BIGINT, NB_CCL)
+
+/* Macros for internal tests */
+#define righttt(obj)            (ttype(obj) == gcvalue(obj)->type)
+
+#define checkliveness(L, obj) \
+  lua_longassert(!iscollectable(obj) || \
+                 (righttt(obj) && (L == NULL || !isdead(L->globalState, gcvalue(obj)))))
+
+/* Macros to set values */
+#define setnbvalue(o, t, p) \
+  (lua_assert((cast(uint64_t, p) & ~NB_PAYLOAD) == 0), \
+   val_(o) = nbtag(t) | cast(uint64_t, p))
+
+#define setfltvalue(obj, x) \
+  { TValue *io = (obj); val_(io) = luaO_nbfromfloat(x); }
+
+#define chgfltvalue(obj, x) \
+  { TValue *io = (obj); lua_assert(ttisfloat(io)); val_(io) = luaO_nbfromfloat(x); }
+
+/* integer known to fit in the payload (needs no box) */
+#define setsmallivalue(obj, x) \
+  { TValue *io = (obj); lua_Integer i_ = (x); lua_assert(nbfitsint(i_)); \
+    val_(io) = nbtag(NB_INTEGER) | (l_castS2U(i_) & NB_PAYLOAD); }
+
+#define setivalue(L, obj, x) \
+  { TValue *io = (obj); lua_Integer i_ = (x); \
+    if (l_likely(nbfitsint(i_))) val_(io) = nbtag(NB_INTEGER) | (l_castS2U(i_) & NB_PAYLOAD); \
+    else luaO_boxint(L, io, i_); }
+
+#define chgivalue(L, obj, x) \
+  { lua_assert(ttisinteger(obj)); setivalue(L, obj, x); }
+
+#define setnilvalue(obj) (val_(obj) = NILCONSTANT)
+
+#define setfvalue(obj, x) \
+  { TValue *io = (obj); setnbvalue(io, NB_LCF, reinterpret_cast<uintptr_t>(x)); }
+
+#define setpvalue(obj, x) \
+  { TValue *io = (obj); setnbvalue(io, NB_LIGHTUSERDATA, reinterpret_cast<uintptr_t>(x)); }
+
+#define setbvalue(obj, x) \
+  { TValue *io = (obj); setnbvalue(io, NB_BOOLEAN, cast(uint32_t, x)); }
+
+#define setgcovalue(L, obj, x) \
+  { TValue *io = (obj); GCObject *i_g = (x); \
+    setnbvalue(io, luaO_nbgctag(i_g->type), reinterpret_cast<uintptr_t>(i_g)); }
+
+#define setsvalue(L, obj, x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    setnbvalue(io, x_->type == LuaType::Variant::ShortString ? NB_SHRSTR : NB_LNGSTR, \
+               reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define setuvalue(L, obj, x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    setnbvalue(io, NB_USERDATA, reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define setthvalue(L, obj, x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    setnbvalue(io, NB_THREAD, reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define setclLvalue(L, obj, x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    setnbvalue(io, NB_LCL, reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define setclCvalue(L, obj, x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    setnbvalue(io, NB_CCL, reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define sethvalue(L, obj, x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    setnbvalue(io, NB_TABLE, reinterpret_cast<uintptr_t>(obj2gco(x_))); \
+    checkliveness(L, io); }
+
+#define setdeadvalue(obj)       (val_(obj) = nbtag(NB_DEADKEY) | nbpayload(obj))
+
+#else
+
 #define TValuefields    Value value_; LuaType type_
 
 struct TValue
@@ -121,11 +400,14 @@ struct TValue
 #define chgfltvalue(obj, x) \
   { TValue *io = (obj); lua_assert(ttisfloat(io)); val_(io).n = (x); }
 
-#define setivalue(obj, x) \
+#define setsmallivalue(obj, x) \
   { TValue *io = (obj); val_(io).i = (x); settt_(io, LuaType::Variant::IntNumber); }
 
-#define chgivalue(obj, x) \
-  { TValue *io = (obj); lua_assert(ttisinteger(io)); val_(io).i = (x); }
+#define setivalue(L, obj, x) \
+  { TValue *io = (obj); (void)L; val_(io).i = (x); settt_(io, LuaType::Variant::IntNumber); }
+
+#define chgivalue(L, obj, x) \
+  { TValue *io = (obj); (void)L; lua_assert(ttisinteger(io)); val_(io).i = (x); }
 
 #define setnilvalue(obj) settt_(obj, LuaType::Basic::Nil)
 
@@ -174,6 +456,8 @@ struct TValue
 
 #define setdeadvalue(obj)       settt_(obj, LuaType(LuaType::Variant::DeadKey))
 
+#endif
+
 #define setobj(L, obj1, obj2) \
   { TValue *io1 = (obj1); *io1 = *(obj2); \
     (void)L; checkliveness(L, io1); }
@@ -222,13 +506,12 @@ public:
   TString& operator=(const TString&) = delete;
   TString& operator=(TString&&) = delete;
 
-  uint8_t extra;  /* reserved words for short strings; "has hash" for longs */
-  uint8_t shrlen;  /* length for short strings */
+  uint8_t extra;  /* reserved words for short strings; LNG_* bits for longs */
+  uint8_t shrlen;  /* length for short strings; depth for ropes */
   uint32_t hash;
   union
   {
     size_t lnglen;  /* length for long strings */
-    TString* hnext;  /* linked list for hash table */
   } u;
 };
 
@@ -245,12 +528,78 @@ struct TStringAlign
   };
 };
 
+/*
+** Long strings may be "indirect", keeping in place of their bytes a
+** pointer to other strings:
+** - A rope is made by a concatenation ('luaS_concat') that did not copy
+** its operands: it keeps the two strings it joins, and its 'shrlen'
+** keeps its depth.
+** - A slice is a substring ('luaS_newslice') that shares the bytes of
+** its parent, a direct long string, from 'sliceoffset' on.
+** 'luaS_flatten' copies the bytes of an indirect string into a new
+** string when they are needed and turns it into a slice of that copy.
+** Only flat strings can go through 'getstr' (slices that do not end
+** with their parents can, but they have no '\0' after their bytes);
+** whoever may get a rope from a Lua value flattens it first.
+*/
+#if !defined(LUA_USE_ROPES)
+#define LUA_USE_ROPES           1
+#endif
+
+#if !defined(LUA_USE_SLICES)
+#define LUA_USE_SLICES          1
+#endif
+
+/* bits in 'extra' of long strings (short strings never use bit 5) */
+#define LNG_HASHED      1  /* string already has its hash */
+#define LNG_ROPE        2  /* indirect string is a rope */
+#define LNG_OPEN        4  /* slice does not end with its parent */
+#define LNG_EXPOSED     8  /* 'lua_tolstring' gave out the bytes of the slice */
+#define LNG_INDIRECT    0x20  /* string is a rope or a slice */
+
+/* address right after the header of a 'TString' */
+#define rawgetstr(ts)    check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(TStringAlign::UTString))
+
+#define ropeleft(ts)    (cast(TString **, rawgetstr(ts))[0])
+#define roperight(ts)   (cast(TString **, rawgetstr(ts))[1])
+#define sliceparent(ts) (cast(TString **, rawgetstr(ts))[0])
+#define sliceoffset(ts) (cast(size_t *, rawgetstr(ts))[1])
+#define slicegclist(ts) (cast(TString **, rawgetstr(ts))[2])
+
+#if LUA_USE_ROPES || LUA_USE_SLICES
+
+#define isindirect(ts)  ((ts)->extra & LNG_INDIRECT)
+#define isrope(ts)  \
+  (((ts)->extra & (LNG_INDIRECT | LNG_ROPE)) == (LNG_INDIRECT | LNG_ROPE))
+#define isslice(ts)  \
+  (((ts)->extra & (LNG_INDIRECT | LNG_ROPE)) == LNG_INDIRECT)
+
+/* true if the bytes of 'ts' can be read as a C string */
+#define isflat(ts)  \
+  (!isindirect(ts) || ((ts)->extra & (LNG_ROPE | LNG_OPEN)) == 0)
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'.
-** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(TStringAlign::UTString))
+  (isindirect(ts) \
+     ? check_exp(isslice(ts), rawgetstr(sliceparent(ts)) + sliceoffset(ts)) \
+     : rawgetstr(ts))
+
+#else
+
+#define isindirect(ts)  0
+#define isrope(ts)      0
+#define isslice(ts)     0
+#define isflat(ts)      1
+
+/*
+** Get the actual string (array of bytes) from a 'TString'.
+** (Access to 'extra' ensures that value is really a 'TString'.)
+*/
+#define getstr(ts)      rawgetstr(ts)
+
+#endif
 
 /* get the actual string (array of bytes) from a Lua value */
 #define svalue(o)       getstr(tsvalue(o))
@@ -277,10 +626,16 @@ public:
   Udata& operator=(const Udata&) = delete;
   Udata& operator=(Udata&&) = delete;
 
+#if !LUA_NANBOXING
   LuaType ttuv_;  /* user value's tag */
+#endif
   class Table* metatable;
   size_t len;  /* number of bytes */
+#if LUA_NANBOXING
+  TValue user_;  /* user value */
+#else
   union Value user_;  /* user value */
+#endif
 };
 
 struct UDataAlign
@@ -299,11 +654,20 @@ struct UDataAlign
 
 /*
 **  Get the address of memory block inside 'Udata'.
-** (Access to 'ttuv_' ensures that value is really a 'Udata'.)
+** (Access to 'len' ensures that value is really a 'Udata'.)
 */
 #define getudatamem(u)  \
-  check_exp(sizeof((u)->ttuv_), (cast(char*, (u)) + sizeof(UDataAlign::UUdata)))
+  check_exp(sizeof((u)->len), (cast(char*, (u)) + sizeof(UDataAlign::UUdata)))
 
+#if LUA_NANBOXING
+#define setuservalue(L, u, o) \
+  { const TValue *io = (o); Udata *iu = (u); \
+    iu->user_ = *io; checkliveness(L, io); }
+
+#define getuservalue(L, u, o) \
+  { TValue *io = (o); const Udata *iu = (u); \
+    *io = iu->user_; checkliveness(L, io); }
+#else
 #define setuservalue(L, u, o) \
   { const TValue *io = (o); Udata *iu = (u); \
     iu->user_ = io->value_; iu->ttuv_ = rttype(io); \
@@ -313,6 +677,7 @@ struct UDataAlign
   { TValue *io = (o); const Udata *iu = (u); \
     io->value_ = iu->user_; settt_(io, iu->ttuv_); \
     checkliveness(L, io); }
+#endif
 
 /*
 ** Description of an upvalue for function prototypes
@@ -367,6 +732,7 @@ public:
   LocVar* locvars;  /* information about local variables (debug information) */
   Upvaldesc* upvalues;  /* upvalue information */
   class LClosure* cache;  /* last-created closure with this prototype */
+  struct FieldCache* fieldcache;  /* inline caches, one per instruction */
   TString* source;  /* used for debug information */
   GCObject* gclist;
 };
@@ -456,10 +822,17 @@ union TKey
 };
 
 /* copy a value into a key without messing up field 'next' */
+#if LUA_NANBOXING
+#define setnodekey(L, key, obj) \
+  { TKey *k_ = (key); const TValue *io_ = (obj); \
+    k_->nk.value_ = io_->value_; \
+    (void)L; checkliveness(L, io_); }
+#else
 #define setnodekey(L, key, obj) \
   { TKey *k_ = (key); const TValue *io_ = (obj); \
     k_->nk.value_ = io_->value_; k_->nk.type_ = io_->type_; \
     (void)L; checkliveness(L, io_); }
+#endif
 
 struct Node
 {
@@ -467,6 +840,46 @@ struct Node
   TKey i_key;
 };
 
+/*
+** Inline cache of a table access with a constant short-string key:
+** the layout (hash part or shape) and position where the key was found
+** the last time the instruction ran. 'layout' is only compared, never
+** dereferenced, so it may refer to something that was already freed.
+*/
+struct FieldCache
+{
+  const void* layout;
+  uint32_t index;
+};
+
+/*
+** LUA_USE_SWISSTABLE selects the open-addressing hash part (see
+** ltable.cpp) instead of the chained scatter table.
+*/
+#if !defined(LUA_USE_SWISSTABLE)
+#define LUA_USE_SWISSTABLE      0
+#endif
+
+/*
+** LUA_USE_ORDEREDTABLES selects a hash part that keeps insertion order,
+** so that traversals are the same across platforms and runs.
+*/
+#if !defined(LUA_USE_ORDEREDTABLES)
+#define LUA_USE_ORDEREDTABLES   0
+#endif
+
+#if LUA_USE_SWISSTABLE && LUA_USE_ORDEREDTABLES
+#error "LUA_USE_SWISSTABLE and LUA_USE_ORDEREDTABLES are exclusive"
+#endif
+
+/*
+** LUA_USE_TYPEDARRAYS lets array parts holding only integers (or only
+** floats) store raw numbers instead of TValues (see ltable.hpp).
+*/
+#if !defined(LUA_USE_TYPEDARRAYS)
+#define LUA_USE_TYPEDARRAYS     0
+#endif
+
 class Table : public GCObject
 {
   friend class LGCFactory;
@@ -480,10 +893,38 @@ public:
 
   uint8_t flags;  /* 1<<p means tagmethod(p) is not present */
   uint8_t lsizenode;  /* log2 of size of 'node' array */
+#if LUA_USE_TYPEDARRAYS
+  uint8_t arraykind;  /* representation of the array part */
+  uint32_t arrayn;  /* number of elements in a typed array part */
+  uint32_t proxyindex;  /* position in the array part of 'proxy' */
+  TValue proxy;  /* copy of an element of a typed array part */
+#endif
   uint32_t sizearray;  /* size of 'array' array */
+#if LUA_USE_TYPEDARRAYS
+  union {
+    TValue* array;  /* array part */
+    lua_Integer* iarray;  /* array part of kind ARRAY_INT */
+    lua_Number* farray;  /* array part of kind ARRAY_FLT */
+  };
+#else
   TValue* array;  /* array part */
+#endif
   Node* node;
+#if LUA_USE_SWISSTABLE
+  uint8_t* ctrl;  /* control bytes of 'node' (NULL if using 'dummynode') */
+#elif LUA_USE_ORDEREDTABLES
+  Node* firstfree;  /* next entry to use (NULL if using 'dummynode') */
+#else
   Node* lastfree;  /* any free position is before this position */
+#endif
+  struct Shape* shape;  /* key layout of 'slots' (NULL if using 'node') */
+  TValue* slots;  /* values of the keys in 'shape' */
+  uint32_t sizeslots;  /* size of 'slots' array */
+  uint32_t lastnext;  /* traversal index returned by the last 'next' */
+  uint32_t border;  /* border found by the last '#' (only a hint) */
+#if LUA_USE_SWISSTABLE
+  uint32_t growthleft;  /* empty 'node' positions that may still be used */
+#endif
   Table* metatable;
   GCObject* gclist;
 };
@@ -513,7 +954,12 @@ LUAI_FUNC int luaO_utf8esc(char *buff, unsigned long x);
 LUAI_FUNC int luaO_ceillog2(uint32_t x);
 LUAI_FUNC void luaO_arith(lua_State *L, int op, const TValue *p1,
                           const TValue *p2, TValue *res);
-LUAI_FUNC size_t luaO_str2num(const char *s, TValue *o);
+LUAI_FUNC size_t luaO_rawstr2num(const char *s, lua_Integer *i, lua_Number *n,
+                                 int *isint);
+LUAI_FUNC size_t luaO_str2num(lua_State *L, const char *s, TValue *o);
+#if LUA_NANBOXING
+LUAI_FUNC void luaO_boxint(lua_State *L, TValue *obj, lua_Integer i);
+#endif
 LUAI_FUNC int luaO_hexavalue(int c);
 LUAI_FUNC void luaO_tostring(lua_State *L, StkId obj);
 LUAI_FUNC const char *luaO_pushvfstring(lua_State *L, const char *fmt,
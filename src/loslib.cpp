@@ -341,6 +341,22 @@ static int os_difftime(lua_State *L) {
 
 /* }====================================================== */
 
+/* compiled patterns have their classes resolved with the old locale */
+static void flushpatterns(lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_PATTERNS_TABLE) == LuaType::Basic::Table)
+  {
+    lua_pushnil(L);
+    while (lua_next(L, -2))
+    {
+      lua_pop(L, 1);  /* remove value */
+      lua_pushvalue(L, -1);
+      lua_pushnil(L);
+      lua_rawset(L, -4);  /* cache[pattern] = nil */
+    }
+  }
+  lua_pop(L, 1);
+}
+
 static int os_setlocale(lua_State *L) {
   static const int cat[] = {LC_ALL, LC_COLLATE, LC_CTYPE, LC_MONETARY,
                             LC_NUMERIC, LC_TIME};
@@ -348,7 +364,10 @@ static int os_setlocale(lua_State *L) {
                                          "numeric", "time", nullptr};
   const char *l = luaL_optstring(L, 1, NULL);
   int op = luaL_checkoption(L, 2, "all", catnames);
-  lua_pushstring(L, setlocale(cat[op], l));
+  const char *res = setlocale(cat[op], l);
+  if (l != NULL && res != NULL)
+    flushpatterns(L);
+  lua_pushstring(L, res);
   return 1;
 }
 
@@ -553,6 +553,7 @@ static void close_func(LexState *ls)
   leaveblock(fs);
   LMem<Instruction>::luaM_reallocvector(L, f->code, f->sizecode, fs->pc);
   f->sizecode = fs->pc;
+  luaF_newfieldcache(L, f);
   LMem<int>::luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc);
   f->sizelineinfo = fs->pc;
   LMem<TValue>::luaM_reallocvector(L, f->k, f->sizek, fs->nk);
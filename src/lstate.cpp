@@ -33,6 +33,14 @@
 #define LUAI_GCMUL      200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GENMINORMUL)
+#define LUAI_GENMINORMUL   20  /* minor collection after growing 20% */
+#endif
+
+#if !defined(LUAI_GENMAJORMUL)
+#define LUAI_GENMAJORMUL   100  /* major collection after doubling the heap */
+#endif
+
 /*
 ** a macro to help the creation of a unique random seed when a state is
 ** created; the seed is used to randomize hashes.
@@ -124,6 +132,7 @@ static void f_luaopen(lua_State *L, void *ud)
   global_State *g = L->globalState;
   UNUSED(ud);
   stack_init(L, L);  /* init stack */
+  luaH_initshapes(L);
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -170,10 +179,23 @@ global_State::global_State() = default;
 global_State::~global_State() = default;
 
 lua_State::lua_State()
+  : lua_State(LUAI_DEFAULTHEAP)
+{
+}
+
+lua_State::lua_State(LuaHeap heap)
 {
   this->globalState = new global_State();
 
   global_State* g = this->globalState;
+  if (heap == LuaHeap::Arena)
+    g->arena = new LuaArena();
+#if LUA_USE_GCSTATS
+  g->gcstats = new GCStats();
+#endif
+#if LUA_USE_MEMACCOUNT
+  g->memsample = LUAI_MEMSAMPLE;
+#endif
   this->next = nullptr;
   this->type = LuaType::Basic::Thread;
   g->currentwhite = bitmask(WHITE0BIT);
@@ -183,11 +205,16 @@ lua_State::lua_State()
   g->seed = makeseed(this);
   setnilvalue(&g->l_registry);
   g->gcstate = GCSpause;
-  g->gckind = KGC_NORMAL;
+  g->gckind = KGC_INC;
   g->totalbytes = sizeof(lua_State) + sizeof(global_State);
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->genminormul = LUAI_GENMINORMUL;
+  g->genmajormul = LUAI_GENMAJORMUL;
   f_luaopen(this, nullptr);
+#if LUA_GENERATIONALGC
+  luaC_changemode(this, KGC_GEN);
+#endif
   lua_atpanic(this, &panic);
 }
 
@@ -200,12 +227,14 @@ lua_State::lua_State(lua_State* L)
 
   // Add self to GC Debt
   luaM_addGCDebt(L, sizeof(lua_State), 0);
+  luaC_statnew(g, LuaType(LuaType::Basic::Thread), sizeof(lua_State));
 
   L1->marked = luaC_white(g);
   L1->type = LuaType::Basic::Thread;
   /* link it on list 'allgc' */
   L1->next = g->allgc;
   g->allgc = obj2gco(L1);
+  luaC_checksample(L, L1);
   /* anchor it on L stack */
   setthvalue(L, L->top, L1);
   api_incr_top(L);
@@ -228,10 +257,17 @@ lua_State::~lua_State()
     luaC_freeallobjects(this);  /* collect all objects */
     if (g->version) /* closing a fully built state? */
       luai_userstateclose(this);
-    LMem<TString*>::luaM_freearray(this, this->globalState->strt.hash, this->globalState->strt.size);
+    LMem<TString*>::luaM_freemem(this, g->strt.slots, strtblocksize(g->strt.size));
+    LMem<TString*>::luaM_freemem(this, g->strt.newslots, strtblocksize(g->strt.newsize));
+    LMem<TString*>::luaM_freemem(this, g->strt.oldslots, strtblocksize(g->strt.oldsize));
+    luaH_freeshapes(this);
     freestack(this);
     lua_assert(g->getTotalBytes() == sizeof(lua_State) + sizeof(global_State));
 
+    delete g->arena;
+#if LUA_USE_GCSTATS
+    delete g->gcstats;
+#endif
     delete this->globalState;
   }
   else
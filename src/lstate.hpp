@@ -6,6 +6,7 @@
 */
 
 #include <lua.hpp>
+#include <lallocator.hpp>
 #include <lobject.hpp>
 #include <ltm.hpp>
 #include <lzio.hpp>
@@ -23,6 +24,13 @@
  ** 'tobefnz': all objects ready to be finalized;
  ** 'fixedgc': all objects that are not to be collected (currently
  ** only small strings, such as reserved words).
+ **
+ ** In generational mode, 'allgc' keeps the new objects first, then the
+ ** survivals (from 'survival' on), then the objects old for one cycle
+ ** (from 'old1' on), and the really old ones (from 'reallyold' on);
+ ** 'firstold1' is the first OLD1 object anywhere in the list, if any.
+ ** 'finobj' is divided likewise by 'finobjsur', 'finobjold1', and
+ ** 'finobjrold'.
 
  */
 
@@ -41,8 +49,8 @@
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
 /* kinds of Garbage Collection */
-#define KGC_NORMAL      0
-#define KGC_EMERGENCY   1       /* gc was forced by an allocation failure */
+#define KGC_INC         0       /* incremental gc */
+#define KGC_GEN         1       /* generational gc */
 
 /*
 ** Information about a call.
@@ -97,11 +105,42 @@ struct CallInfo
 #define setoah(st, v)    ((st) = ((st) & ~CIST_OAH) | (v))
 #define getoah(st)      ((st) & CIST_OAH)
 
+/*
+** Open-addressing table of interned strings (linear probing). The array
+** of strings is followed by an array of control bytes: 0 for an empty
+** slot, 1 for a removed entry, or else 8 bits of the hash of the string
+** in the slot, so that probes seldom touch the strings themselves.
+** Resizes are incremental (see 'luaS_resize'): first the control bytes
+** of the new array ('newslots') are cleared a few at a time while
+** 'slots' is still in use; then it becomes 'slots' and the strings of
+** the previous array ('oldslots') are moved to it a few at a time,
+** while searches look at both arrays.
+*/
 struct Stringtable
 {
-  TString** hash = nullptr;
-  int nuse = 0;  /* number of elements */
-  int size = 0;
+  TString** slots = nullptr;
+  int nuse = 0;  /* number of strings (in 'slots' and 'oldslots') */
+  int size = 0;  /* power of 2 */
+  int nfilled = 0;  /* slots of 'slots' not empty (strings + removed) */
+  TString** newslots = nullptr;  /* next array, being cleared */
+  int newsize = 0;
+  int ncleared = 0;  /* control bytes of 'newslots' already cleared */
+  TString** oldslots = nullptr;  /* previous array, being migrated */
+  int oldsize = 0;
+  int oldnext = 0;  /* next slot of 'oldslots' to be migrated */
+};
+
+/* size in bytes of a string-table array with 'n' slots */
+#define strtblocksize(n)        ((sizeof(TString*) + 1) * (n))
+
+/*
+** Transitions between table shapes, indexed by (parent shape, key)
+*/
+struct Shapetable
+{
+  struct Shape** hash = nullptr;
+  uint32_t nuse = 0;  /* number of elements */
+  uint32_t size = 0;
 };
 
 /*
@@ -121,12 +160,15 @@ public:
   lu_mem GCmemtrav = 0;  /* memory traversed by the GC */
   lu_mem GCestimate = 0;  /* an estimate of the non-garbage memory in use */
   Stringtable strt;  /* hash table for strings */
+  struct Shape* rootshape = nullptr;  /* shape of empty tables (NULL if shapes are off) */
+  Shapetable shapes;  /* transitions between table shapes */
   TValue l_registry;
   uint32_t seed = 0;  /* randomized seed for hashes */
   uint8_t currentwhite = 0;
   uint8_t gcstate = 0;  /* state of garbage collector */
   uint8_t gckind = 0;  /* kind of GC running */
   bool gcrunning = false;  /* true if GC is running */
+  bool gcemergency = false;  /* true if this is an emergency collection */
   GCObject* allgc = nullptr;  /* list of all collectable objects */
   GCObject** sweepgc = nullptr;  /* current position of sweep in list */
   GCObject* finobj = nullptr;  /* list of collectable objects with finalizers */
@@ -137,10 +179,28 @@ public:
   GCObject* allweak = nullptr;  /* list of all-weak tables */
   GCObject* tobefnz = nullptr;  /* list of userdata to be GC */
   GCObject* fixedgc = nullptr;  /* list of objects not to be collected */
+  /* fields for generational collector */
+  GCObject* survival = nullptr;  /* start of objects that survived one GC cycle */
+  GCObject* old1 = nullptr;  /* start of old1 objects */
+  GCObject* reallyold = nullptr;  /* objects more than one cycle old ("really old") */
+  GCObject* firstold1 = nullptr;  /* first OLD1 object in the list (if any) */
+  GCObject* finobjsur = nullptr;  /* list of survival objects with finalizers */
+  GCObject* finobjold1 = nullptr;  /* list of old1 objects with finalizers */
+  GCObject* finobjrold = nullptr;  /* list of really old objects with finalizers */
+  lu_mem lastatomic = 0;  /* see function 'genstep' in file 'lgc.cpp' */
+  TString* slices = nullptr;  /* slices that may keep a much longer parent alive */
+  struct GCWorkers* gcworkers = nullptr;  /* mark threads (see 'parallelpropagate') */
+  struct GCFreer* gcfreer = nullptr;  /* freeing thread (see 'luaC_freelater') */
+  LuaArena* arena = nullptr;  /* allocator of small blocks (NULL for none) */
+  struct GCStats* gcstats = nullptr;  /* see 'lua_gcstats' */
+  struct MemProfile* memprofile = nullptr;  /* sampled objects (see 'luaC_sample') */
+  uint32_t memsample = 0;  /* objects to create before sampling one */
   class lua_State* twups = nullptr;  /* list of threads with open upvalues */
   uint32_t gcfinnum = 0;  /* number of finalizers to call in each GC step */
   int gcpause = 0;  /* size of pause between successive GCs */
   int gcstepmul = 0;  /* GC 'granularity' */
+  int genminormul = 0;  /* control for minor generational collections */
+  int genmajormul = 0;  /* control for major generational collections */
   lua_CFunction panic = nullptr;  /* to be called in unprotected errors */
   class lua_State* mainthread = nullptr;
   const lua_Number* version = nullptr;  /* pointer to version number */
@@ -158,6 +218,7 @@ class lua_State : public GCObject
 {
 public:
   lua_State();
+  explicit lua_State(LuaHeap heap);
   explicit lua_State(lua_State* L);
   ~lua_State();
 
@@ -193,6 +254,9 @@ public:
 #define gco2t(o)  check_exp((o)->type == LuaType::Variant::Table, static_cast<Table*>(o))
 #define gco2p(o)  check_exp((o)->type == LuaType::Variant::FunctionPrototype, static_cast<Proto*>(o))
 #define gco2th(o)  check_exp((o)->type == LuaType::Variant::Thread, static_cast<lua_State*>(o))
+#if LUA_NANBOXING
+#define gco2bi(o)  check_exp((o)->type == LuaType::Variant::IntNumber, static_cast<BoxedInt*>(o))
+#endif
 
 /* macro to convert a Lua object into a GCObject */
 #define obj2gco(v) \
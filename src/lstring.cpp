@@ -9,6 +9,7 @@
 
 #include <lprefix.hpp>
 
+#include <algorithm>
 #include <cstring>
 
 #include <lua.hpp>
@@ -23,9 +24,15 @@
 #define MEMERRMSG       "not enough memory"
 
 /*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
+** LUA_USE_FASTHASH hashes every byte of a string, 8 bytes at a time,
+** with a wyhash-style 64-bit multiply-mix function. Otherwise, Lua
+** will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to compute
+** its hash.
 */
+#if !defined(LUA_USE_FASTHASH)
+#define LUA_USE_FASTHASH        1
+#endif
+
 #if !defined(LUAI_HASHLIMIT)
 #define LUAI_HASHLIMIT          5
 #endif
@@ -42,6 +49,110 @@ int luaS_eqlngstr(TString *a, TString *b)
           (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
 }
 
+#if LUA_USE_FASTHASH
+
+/* multiplies 'a' by 'b', leaving the low half in 'a' and the high in 'b' */
+static inline void mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = cast(__uint128_t, *a) * *b;
+  *a = cast(uint64_t, r);
+  *b = cast(uint64_t, r >> 64);
+#else
+  uint64_t ha = *a >> 32, la = cast(uint32_t, *a);
+  uint64_t hb = *b >> 32, lb = cast(uint32_t, *b);
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = (t < rl);
+  uint64_t lo = t + (rm1 << 32);
+  c += (lo < t);
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+#endif
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+  mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t read8(const char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t read4(const char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static const uint64_t hashsecret[4] = {
+  0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+  0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+};
+
+/*
+** Long inputs go through three independent lanes of 16 bytes each, so
+** that the multiplications of a round can run in parallel.
+*/
+uint32_t luaS_hash(const char *str, size_t l, uint32_t seed)
+{
+  const uint64_t *s = hashsecret;
+  const char *p = str;
+  uint64_t h = seed ^ mix(seed ^ s[0], s[1]);
+  uint64_t a, b;
+  if (l <= 16)
+  {
+    if (l >= 4)
+    {
+      size_t q = (l >> 3) << 2;  /* 0 or 4 */
+      a = (read4(p) << 32) | read4(p + q);
+      b = (read4(p + l - 4) << 32) | read4(p + l - 4 - q);
+    }
+    else if (l > 0)
+    {
+      a = (cast(uint64_t, cast_byte(p[0])) << 16) |
+          (cast(uint64_t, cast_byte(p[l >> 1])) << 8) | cast_byte(p[l - 1]);
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else
+  {
+    size_t i = l;
+    if (i > 48)
+    {
+      uint64_t h1 = h, h2 = h;
+      do
+      {
+        h = mix(read8(p) ^ s[1], read8(p + 8) ^ h);
+        h1 = mix(read8(p + 16) ^ s[2], read8(p + 24) ^ h1);
+        h2 = mix(read8(p + 32) ^ s[3], read8(p + 40) ^ h2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      h ^= h1 ^ h2;
+    }
+    for (; i > 16; i -= 16, p += 16)
+      h = mix(read8(p) ^ s[1], read8(p + 8) ^ h);
+    a = read8(p + i - 16);  /* last 16 bytes (may overlap) */
+    b = read8(p + i - 8);
+  }
+  a ^= s[1];
+  b ^= h;
+  mum(&a, &b);
+  h = mix(a ^ s[0] ^ l, b ^ s[1]);
+  return cast(uint32_t, h ^ (h >> 32));
+}
+
+#else
+
 uint32_t luaS_hash(const char *str, size_t l, uint32_t seed)
 {
   uint32_t h = seed ^ cast(uint32_t, l);
@@ -51,49 +162,132 @@ uint32_t luaS_hash(const char *str, size_t l, uint32_t seed)
   return h;
 }
 
+#endif
+
 uint32_t luaS_hashlongstr(TString *ts)
 {
   lua_assert(ts->type == LuaType::Variant::LongString);
-  if (ts->extra == 0)    /* no hash? */
+  if (!(ts->extra & LNG_HASHED))    /* no hash? */
   {
     ts->hash = luaS_hash(getstr(ts), ts->u.lnglen, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+    ts->extra |= LNG_HASHED;  /* now it has its hash */
   }
   return ts->hash;
 }
 
+/* work done at each step of a resize of the string table */
+#define STRCLEARSTEP    256  /* control bytes cleared */
+#define STRMIGRATESTEP  16  /* slots migrated (times the shrink factor) */
+
+#define isresizing(tb)  ((tb)->newslots != nullptr || (tb)->oldslots != nullptr)
+
 /*
-** resizes the string table
+** control bytes of the string-table array 'slots', with 'n' slots: empty
+** slots end a search, removed ones do not
 */
-void luaS_resize(lua_State *L, int newsize)
+#define strctrl(slots, n)       cast(uint8_t *, (slots) + (n))
+
+#define CTRL_EMPTY      0
+#define CTRL_REMOVED    1
+
+/* control byte of a slot holding a string with hash 'h' */
+#define ctrlbyte(h)     cast_byte(((h) >> 24) < 2 ? ((h) >> 24) + 2 : ((h) >> 24))
+
+/*
+** puts string 'ts', which is not in the table yet, in the first free
+** slot of its probe sequence in 'tb->slots'
+*/
+static void putslot(Stringtable *tb, TString *ts)
 {
-  int i;
-  Stringtable* tb = &L->globalState->strt;
-  if (newsize > tb->size)    /* grow table if needed */
+  uint8_t *ctrl = strctrl(tb->slots, tb->size);
+  uint32_t mask = cast(uint32_t, tb->size - 1);
+  uint32_t i = ts->hash & mask;
+  while (ctrl[i] > CTRL_REMOVED)
+    i = (i + 1) & mask;
+  if (ctrl[i] == CTRL_EMPTY)
+    tb->nfilled++;
+  ctrl[i] = ctrlbyte(ts->hash);
+  tb->slots[i] = ts;
+}
+
+/*
+** does one step of a resize of the string table: clears a few control
+** bytes of the new array or, once it is all clear and in use, moves a
+** few strings from the previous array to it (and frees the previous
+** array when it is empty)
+*/
+void luaS_resizestep(lua_State *L)
+{
+  Stringtable *tb = &L->globalState->strt;
+  if (tb->newslots != nullptr)
   {
-    LMem<TString*>::luaM_reallocvector(L, tb->hash, tb->size, newsize);
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = nullptr;
+    int n = std::min(STRCLEARSTEP, tb->newsize - tb->ncleared);
+    memset(strctrl(tb->newslots, tb->newsize) + tb->ncleared, CTRL_EMPTY, n);
+    tb->ncleared += n;
+    if (tb->ncleared == tb->newsize)    /* new array ready? */
+    {
+      tb->oldslots = tb->slots;
+      tb->oldsize = tb->size;
+      tb->oldnext = 0;
+      tb->slots = tb->newslots;
+      tb->size = tb->newsize;
+      tb->nfilled = 0;
+      tb->newslots = nullptr;
+      tb->newsize = tb->ncleared = 0;
+    }
   }
-  for (i = 0; i < tb->size; i++)    /* rehash */
+  else if (tb->oldslots != nullptr)
   {
-    TString *p = tb->hash[i];
-    tb->hash[i] = nullptr;
-    while (p)    /* for each node in the list */
+    uint8_t *ctrl = strctrl(tb->oldslots, tb->oldsize);
+    /* after a large shrink, migration must still end before the new
+       array fills up */
+    int n = STRMIGRATESTEP * std::max(1, tb->oldsize / tb->size);
+    for (; n > 0 && tb->oldnext < tb->oldsize; n--)
+    {
+      int i = tb->oldnext++;
+      if (ctrl[i] > CTRL_REMOVED)
+      {
+        putslot(tb, tb->oldslots[i]);
+        ctrl[i] = CTRL_REMOVED;  /* keep probe sequences of 'oldslots' valid */
+      }
+    }
+    if (tb->oldnext == tb->oldsize)    /* migration done? */
     {
-      TString *hnext = p->u.hnext;  /* save next */
-      uint32_t h = lmod(p->hash, newsize);  /* new position */
-      p->u.hnext = tb->hash[h];  /* chain it */
-      tb->hash[h] = p;
-      p = hnext;
+      LMem<TString*>::luaM_freemem(L, tb->oldslots, strtblocksize(tb->oldsize));
+      tb->oldslots = nullptr;
+      tb->oldsize = tb->oldnext = 0;
     }
   }
-  if (newsize < tb->size)    /* shrink table if needed */
-  { /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    LMem<TString*>::luaM_reallocvector(L, tb->hash, tb->size, newsize);
+}
+
+/*
+** completes any resize going on
+*/
+static void finishresize(lua_State *L)
+{
+  Stringtable *tb = &L->globalState->strt;
+  while (isresizing(tb))
+    luaS_resizestep(L);
+}
+
+/*
+** starts resizing the string table to 'newsize' slots, replacing a new
+** array that is not in use yet; the work is done by 'luaS_resizestep',
+** as strings are created and as the collector runs
+*/
+void luaS_resize(lua_State *L, int newsize)
+{
+  Stringtable *tb = &L->globalState->strt;
+  if (tb->newslots != nullptr)
+  {
+    LMem<TString*>::luaM_freemem(L, tb->newslots, strtblocksize(tb->newsize));
+    tb->newslots = nullptr;
+    tb->newsize = tb->ncleared = 0;
   }
-  tb->size = newsize;
+  finishresize(L);  /* complete a migration going on */
+  tb->newslots = LMem<TString*>::luaM_malloc(L, strtblocksize(cast(size_t, newsize)));
+  tb->newsize = newsize;
+  tb->ncleared = 0;
 }
 
 /*
@@ -117,6 +311,7 @@ void luaS_init(lua_State *L)
 {
   global_State *g = L->globalState;
   luaS_resize(L, MINSTRTABSIZE);  /* initial size of string table */
+  finishresize(L);
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
   luaC_fix(L, obj2gco(g->memerrmsg));  /* it should never be collected */
@@ -146,48 +341,173 @@ TString *luaS_createlngstrobj(lua_State *L, size_t l)
   return ts;
 }
 
+/*
+** returns the index of string 'ts' in the string-table array 'slots',
+** or -1 if it is not there
+*/
+static int findslot(TString **slots, int size, const TString *ts)
+{
+  if (slots == nullptr)
+    return -1;
+  const uint8_t *ctrl = strctrl(slots, size);
+  uint32_t mask = cast(uint32_t, size - 1);
+  for (uint32_t i = ts->hash & mask; ctrl[i] != CTRL_EMPTY; i = (i + 1) & mask)
+    if (ctrl[i] > CTRL_REMOVED && slots[i] == ts)
+      return cast_int(i);
+  return -1;
+}
+
 void luaS_remove(lua_State *L, TString *ts)
 {
   Stringtable *tb = &L->globalState->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
-  while (*p != ts) /* find previous element */
-    p = &(*p)->u.hnext;
-  *p = (*p)->u.hnext;  /* remove element from its list */
+  int i = findslot(tb->slots, tb->size, ts);
+  if (i >= 0)
+    strctrl(tb->slots, tb->size)[i] = CTRL_REMOVED;
+  else    /* not migrated yet */
+  {
+    i = findslot(tb->oldslots, tb->oldsize, ts);
+    lua_assert(i >= 0);
+    strctrl(tb->oldslots, tb->oldsize)[i] = CTRL_REMOVED;
+  }
   tb->nuse--;
 }
 
 /*
-** checks whether short string exists and reuses it or creates a new one
+** looks for a short string with the given contents and hash 'h' in the
+** string-table array 'slots'
 */
-static TString *internshrstr(lua_State *L, const char *str, size_t l) {
-  TString *ts;
-  global_State *g = L->globalState;
-  uint32_t h = luaS_hash(str, l, g->seed);
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
-  lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != nullptr; ts = ts->u.hnext)
-    if (l == ts->shrlen &&
-        (memcmp(str, getstr(ts), l * sizeof(char)) == 0))
+static TString *findshrstr(TString **slots, int size, const char *str,
+                           size_t l, uint32_t h) {
+  if (slots == nullptr)
+    return nullptr;
+  const uint8_t *ctrl = strctrl(slots, size);
+  uint8_t c = ctrlbyte(h);
+  uint32_t mask = cast(uint32_t, size - 1);
+  for (uint32_t i = h & mask; ctrl[i] != CTRL_EMPTY; i = (i + 1) & mask)
+  {
+    if (ctrl[i] == c)
     {
-      /* found! */
-      if (isdead(g, ts)) /* dead (but not collected yet)? */
-        changewhite(ts); /* resurrect it */
-      return ts;
+      TString *ts = slots[i];
+      if (ts->hash == h && l == ts->shrlen &&
+          (memcmp(str, getstr(ts), l * sizeof(char)) == 0))
+        return ts;
     }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2)
+  }
+  return nullptr;
+}
+
+/*
+** looks for a short string with the given contents and hash 'h' in the
+** string table, resurrecting it if it is dead
+*/
+static TString *lookupshrstr(global_State *g, const char *str, size_t l,
+                             uint32_t h) {
+  lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  Stringtable *tb = &g->strt;
+  TString *ts = findshrstr(tb->slots, tb->size, str, l, h);
+  if (ts == nullptr)
+    ts = findshrstr(tb->oldslots, tb->oldsize, str, l, h);
+  if (ts != nullptr && isdead(g, ts)) /* dead (but not collected yet)? */
+    changewhite(ts); /* resurrect it */
+  return ts;
+}
+
+/*
+** makes room for one more string in the string table. A resize starts
+** when three quarters of the slots are used (the table grows, shrinks
+** or is just rebuilt without its removed entries, so that it ends up at
+** most half full) and must be done before seven eighths of them are.
+*/
+static void growstrtab(lua_State *L, Stringtable *tb) {
+  luaS_resizestep(L);
+  if (tb->nfilled >= tb->size - tb->size / 4 && !isresizing(tb))
   {
-    luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
+    int newsize = tb->size;
+    while (tb->nuse >= newsize / 2 && newsize <= MAX_INT/2)
+      newsize *= 2;
+    luaS_resize(L, newsize);
   }
+  if (tb->nfilled >= tb->size - tb->size / 8)    /* resize too slow? */
+    finishresize(L);
+}
+
+/*
+** links a new short string (whose 'hash' is set) into the string table
+*/
+static void linkshrstr(Stringtable *tb, TString *ts) {
+  putslot(tb, ts);
+  tb->nuse++;
+}
+
+/*
+** checks whether short string exists and reuses it or creates a new one
+*/
+static TString *internshrstr(lua_State *L, const char *str, size_t l) {
+  global_State *g = L->globalState;
+  uint32_t h = luaS_hash(str, l, g->seed);
+  TString *ts = lookupshrstr(g, str, l, h);
+  if (ts != nullptr)
+    return ts;
+  growstrtab(L, &g->strt);
   ts = createstrobj(L, l, LuaType::Variant::ShortString, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
-  ts->u.hnext = *list;
-  *list = ts;
-  g->strt.nuse++;
+  linkshrstr(&g->strt, ts);
+  return ts;
+}
+
+#if LUA_USE_LAZYINTERN
+
+uint32_t luaS_hashtransient(TString *ts)
+{
+  lua_assert(istransient(ts));
+  if (!(ts->extra & SHR_HASHED))    /* no hash? */
+  {
+    ts->hash = luaS_hash(getstr(ts), ts->shrlen, ts->hash);
+    ts->extra |= SHR_HASHED;  /* now it has its hash */
+  }
+  return ts->hash;
+}
+
+/*
+** returns the interned version of transient string 'ts': either an
+** interned string with the same contents or 'ts' itself, which is then
+** entered in the string table
+*/
+TString *luaS_intern(lua_State *L, TString *ts)
+{
+  uint32_t h = luaS_hashtransient(ts);
+  TString *twin = lookupshrstr(L->globalState, getstr(ts), ts->shrlen, h);
+  if (twin != nullptr)
+    return twin;
+  growstrtab(L, &L->globalState->strt);
+  ts->extra = 0;  /* no longer transient */
+  linkshrstr(&L->globalState->strt, ts);
   return ts;
 }
 
+#endif
+
+/*
+** new string that is not going to be interned unless it becomes a
+** table key (see LUA_USE_LAZYINTERN); a normal string otherwise
+*/
+TString *luaS_newtransient(lua_State *L, const char *str, size_t l)
+{
+#if LUA_USE_LAZYINTERN
+  if (l <= LUAI_MAXSHORTLEN) /* short string? */
+  {
+    TString *ts = createstrobj(L, l, LuaType::Variant::ShortString,
+                               L->globalState->seed);
+    memcpy(getstr(ts), str, l * sizeof(char));
+    ts->shrlen = cast_byte(l);
+    ts->extra = SHR_TRANSIENT;
+    return ts;
+  }
+#endif
+  return luaS_newlstr(L, str, l);
+}
+
 /*
 ** new string (with explicit length)
 */
@@ -229,6 +549,209 @@ TString *luaS_new(lua_State *L, const char *str)
   return p[0];
 }
 
+/*
+** 'strchr' for strings that may be ropes not flattened yet (used by the
+** collector, which cannot flatten them): 1 if 'c' appears before the
+** first '\0', -1 if a '\0' comes first, 0 if there is neither
+*/
+static int findbyte(TString *ts, int c)
+{
+  while (isrope(ts))
+  {
+    int res = findbyte(ropeleft(ts), c);
+    if (res != 0)
+      return res;
+    ts = roperight(ts);
+  }
+  const char *s = getstr(ts);
+  for (size_t i = 0; i < tsslen(ts); i++)
+  {
+    if (s[i] == c)
+      return 1;
+    else if (s[i] == '\0')
+      return -1;
+  }
+  return 0;
+}
+
+int luaS_strchr(TString *ts, int c)
+{
+  return findbyte(ts, c) > 0;
+}
+
+#if LUA_USE_ROPES || LUA_USE_SLICES
+
+/* copies the bytes of 'ts' to 'buff' */
+static void copyrope(TString *ts, char *buff)
+{
+  while (isrope(ts))
+  {
+    copyrope(ropeleft(ts), buff);
+    buff += tsslen(ropeleft(ts));
+    ts = roperight(ts);
+  }
+  memcpy(buff, getstr(ts), tsslen(ts) * sizeof(char));
+}
+
+/*
+** copies the bytes of indirect string 'ts' (which must be reachable by
+** the collector) into a new string, which 'ts' becomes a slice of, and
+** returns that new string
+*/
+TString *luaS_flatten(lua_State *L, TString *ts)
+{
+  lua_assert(isindirect(ts));
+  TString *flat = luaS_createlngstrobj(L, ts->u.lnglen);
+  copyrope(ts, getstr(flat));
+  ts->extra = (ts->extra & (LNG_HASHED | LNG_EXPOSED)) | LNG_INDIRECT;
+  ts->shrlen = 0;
+  sliceparent(ts) = flat;  /* the pieces (or old parent) are no longer needed */
+  sliceoffset(ts) = 0;
+  luaC_objbarrier(L, ts, flat);
+  return flat;
+}
+
+#endif
+
+/*
+** returns a string with the 'l' bytes of string 'ts' (which must be
+** reachable by the collector and not a rope) from 'off' on. Long
+** results share the bytes of 'ts' (or of its parent) unless shorter
+** than SLICEMINLEN.
+*/
+TString *luaS_newslice(lua_State *L, TString *ts, size_t off, size_t l)
+{
+  lua_assert(!isrope(ts) && off + l <= tsslen(ts));
+  if (off == 0 && l == tsslen(ts))
+    return ts;
+#if LUA_USE_SLICES
+  if (l >= SLICEMINLEN)
+  {
+    if (isslice(ts))
+    {
+      off += sliceoffset(ts);
+      ts = sliceparent(ts);
+    }
+    TString *slice = LGCFactory::luaC_newobj<TString>(L, LuaType::Variant::LongString, sizeindirect);
+    slice->hash = L->globalState->seed;
+    slice->extra = LNG_INDIRECT;
+    if (off + l < ts->u.lnglen)
+      slice->extra |= LNG_OPEN;  /* no '\0' after its bytes */
+    slice->shrlen = 0;
+    slice->u.lnglen = l;
+    sliceparent(slice) = ts;
+    sliceoffset(slice) = off;
+    slicegclist(slice) = nullptr;
+    return slice;
+  }
+#endif
+  return luaS_newtransient(L, getstr(ts) + off, l);
+}
+
+#if LUA_USE_ROPES
+
+#define ropedepth(ts)   (isrope(ts) ? (ts)->shrlen : 0)
+
+/* 'ts' itself or, if it is a slice with all the bytes of its parent,
+   that parent */
+static TString *flatstr(TString *ts)
+{
+  return (isslice(ts) && ts->u.lnglen == sliceparent(ts)->u.lnglen)
+           ? sliceparent(ts) : ts;
+}
+
+/*
+** creates a rope joining 'a' and 'b' (which must be reachable by the
+** collector)
+*/
+static TString *newrope(lua_State *L, TString *a, TString *b)
+{
+  a = flatstr(a);
+  b = flatstr(b);
+  TString *ts = LGCFactory::luaC_newobj<TString>(L, LuaType::Variant::LongString, sizeindirect);
+  ts->hash = L->globalState->seed;
+  ts->extra = LNG_INDIRECT | LNG_ROPE;
+  ts->shrlen = cast_byte(std::max(ropedepth(a), ropedepth(b)) + 1);
+  ts->u.lnglen = tsslen(a) + tsslen(b);
+  ropeleft(ts) = a;
+  roperight(ts) = b;
+  return ts;
+}
+
+/*
+** creates a flat string with the contents of 'a' followed by those of
+** 'b', both not ropes and together not longer than ROPELEAF
+*/
+static TString *joinleaves(lua_State *L, TString *a, TString *b)
+{
+  size_t la = tsslen(a);
+  size_t tl = la + tsslen(b);
+  char buff[ROPELEAF];
+  lua_assert(tl <= ROPELEAF);
+  memcpy(buff, getstr(a), la * sizeof(char));
+  memcpy(buff + la, getstr(b), tsslen(b) * sizeof(char));
+  return luaS_newtransient(L, buff, tl);
+}
+
+/*
+** Concatenates the strings at 'ra' and 'ra + 1' (which must be at
+** least ROPEMINLEN long together) and returns the result, also left at
+** 'ra'; 'ra + 1' is used to keep intermediate results reachable. The result is a rope
+** whose pieces are kept roughly balanced: repeatedly appending (or
+** prepending) small strings merges neighbouring pieces of similar
+** sizes, as in a binary counter, so that the depth grows with the
+** logarithm of the number of pieces; small pieces at the ends are
+** copied into a single leaf.
+*/
+TString *luaS_concat(lua_State *L, StkId ra)
+{
+  TString *a = flatstr(tsvalue(ra));
+  TString *b = flatstr(tsvalue(ra + 1));
+  lua_assert(tsslen(a) + tsslen(b) >= ROPEMINLEN);
+  if (!isrope(b) && isrope(a) && !isrope(roperight(a)) &&
+      tsslen(roperight(a)) + tsslen(b) <= ROPELEAF)
+  {  /* append 'b' to the last leaf of 'a' */
+    b = joinleaves(L, flatstr(roperight(a)), b);
+    setsvalue2s(L, ra + 1, b);
+    a = flatstr(ropeleft(a));  /* still reachable from 'ra' */
+  }
+  else if (!isrope(a) && isrope(b) && !isrope(ropeleft(b)) &&
+           tsslen(a) + tsslen(ropeleft(b)) <= ROPELEAF)
+  {  /* prepend 'a' to the first leaf of 'b' */
+    a = joinleaves(L, a, flatstr(ropeleft(b)));
+    setsvalue2s(L, ra, a);
+    b = flatstr(roperight(b));  /* still reachable from 'ra + 1' */
+  }
+  if (isrope(a) && tsslen(roperight(a)) <= 2 * tsslen(b))
+  {
+    do
+    {  /* move the last piece of 'a' into 'b' */
+      b = newrope(L, roperight(a), b);
+      setsvalue2s(L, ra + 1, b);
+      a = flatstr(ropeleft(a));  /* still reachable from 'ra' */
+    } while (isrope(a) && tsslen(roperight(a)) <= 2 * tsslen(b));
+  }
+  else
+  {
+    while (isrope(b) && tsslen(ropeleft(b)) <= 2 * tsslen(a))
+    {  /* move the first piece of 'b' into 'a' */
+      a = newrope(L, a, ropeleft(b));
+      setsvalue2s(L, ra, a);
+      b = flatstr(roperight(b));  /* still reachable from 'ra + 1' */
+    }
+  }
+  TString *ts = newrope(L, a, b);
+  setsvalue2s(L, ra, ts);
+  if (ts->shrlen > MAXROPEDEPTH)    /* too deep? */
+  {
+    ts = luaS_flatten(L, ts);
+    setsvalue2s(L, ra, ts);
+  }
+  return ts;
+}
+
+#endif
+
 Udata* luaS_newudata(lua_State *L, size_t s)
 {
   if (s > MAX_SIZE - sizeof(Udata))
@@ -10,6 +10,11 @@
 #include <lstate.hpp>
 
 #define sizelstring(l)  (sizeof(TStringAlign::UTString) + ((l) + 1) * sizeof(char))
+#define sizeindirect    (sizeof(TStringAlign::UTString) + 3 * sizeof(TString *))
+
+/* size of a long string object */
+#define sizelngstr(ts)  \
+  (isindirect(ts) ? sizeindirect : sizelstring((ts)->u.lnglen))
 
 #define sizeludata(l)   (sizeof(UDataAlign::UUdata) + (l))
 #define sizeudata(u)    sizeludata((u)->len)
@@ -18,23 +23,130 @@
                                               (sizeof(s)/sizeof(char))-1))
 
 /*
-** test whether a string is a reserved word
+** With LUA_USE_LAZYINTERN, short strings built at run time (by the API,
+** concatenation and number conversion) are "transient": they are not
+** entered in the string table nor hashed until they are used as a table
+** key, when 'luaH_newkey' interns them. So there may be a transient
+** copy of an interned string, and equality must compare contents when
+** either side is transient; interned strings are still compared by
+** address only. The hash of a transient string is computed on demand
+** and its 'extra' keeps the SHR_* flags below.
 */
-#define isreserved(s)   ((s)->type == LuaType::Variant::ShortString && (s)->extra > 0)
+#if !defined(LUA_USE_LAZYINTERN)
+#define LUA_USE_LAZYINTERN      0
+#endif
+
+#define SHR_TRANSIENT   0x80  /* string is not in the string table */
+#define SHR_HASHED      0x40  /* transient string already has its hash */
+
+#if LUA_USE_LAZYINTERN
+
+#define istransient(s)  ((s)->extra & SHR_TRANSIENT)
+
+/* hash of a short string */
+#define luaS_shrhash(s) \
+  (((s)->extra & (SHR_TRANSIENT | SHR_HASHED)) == SHR_TRANSIENT \
+     ? luaS_hashtransient(s) : (s)->hash)
+
+/*
+** equality for short strings: same instance or, if one of them is
+** transient, same contents
+*/
+#define eqshrstr(a, b) \
+  check_exp((a)->type == LuaType::Variant::ShortString, \
+            (a) == (b) || \
+            ((istransient(a) || istransient(b)) && \
+             (a)->shrlen == (b)->shrlen && \
+             memcmp(getstr(a), getstr(b), (a)->shrlen) == 0))
+
+#else
+
+#define istransient(s)  0
+#define luaS_shrhash(s) ((s)->hash)
 
 /*
 ** equality for short strings, which are always internalized
 */
 #define eqshrstr(a, b)   check_exp((a)->type == LuaType::Variant::ShortString, (a) == (b))
 
+#endif
+
+/*
+** Concatenations shorter than ROPEMINLEN are copied; longer ones make
+** ropes (see 'lobject.hpp'). Small pieces at the ends of a rope are
+** copied into leaves of up to ROPELEAF bytes, and a concatenation that
+** would make a rope deeper than MAXROPEDEPTH is flattened right away.
+*/
+#define ROPEMINLEN      512
+#define ROPELEAF        512
+#define MAXROPEDEPTH    48
+
+/*
+** Substrings shorter than SLICEMINLEN are copied; longer ones make
+** slices (see 'lobject.hpp'). A slice of a string more than SLICEWASTE
+** times longer than itself gets its own copy of its bytes when the
+** collector finds that only slices keep that string alive, unless
+** 'lua_tolstring' already gave out a pointer to the bytes of the slice
+** (which C code may keep while it runs the collector).
+*/
+#define SLICEMINLEN     64
+#define SLICEWASTE      4
+
+/* may the collector copy the bytes of slice 'ts' of 'parent'? */
+#define compactable(ts, parent)  \
+  (!((ts)->extra & LNG_EXPOSED) && \
+   (parent)->u.lnglen / SLICEWASTE > (ts)->u.lnglen)
+
+#if LUA_USE_ROPES || LUA_USE_SLICES
+
+/* flatten the string in 'o', if it is not flat */
+#define luaS_flatvalue(L, o) \
+  (ttisstring(o) && !isflat(tsvalue(o)) \
+     ? cast_void(luaS_flatten(L, tsvalue(o))) : cast_void(0))
+
+/* the bytes of the string in 'o' go out of the core (see 'compactable') */
+#define luaS_expose(o) \
+  (ttislngstring(o) && isslice(tsvalue(o)) \
+     ? cast_void(tsvalue(o)->extra |= LNG_EXPOSED) : cast_void(0))
+
+/* flatten the string in 'o', if it is a rope (its bytes can then be
+   read, as for hashing or comparing for equality) */
+#define luaS_unrope(L, o) \
+  (ttisstring(o) && isrope(tsvalue(o)) \
+     ? cast_void(luaS_flatten(L, tsvalue(o))) : cast_void(0))
+
+#else
+
+#define luaS_flatvalue(L, o)    cast_void(0)
+#define luaS_expose(o)          cast_void(0)
+#define luaS_unrope(L, o)       cast_void(0)
+
+#endif
+
+/*
+** test whether a string is a reserved word
+*/
+#define isreserved(s) \
+  ((s)->type == LuaType::Variant::ShortString && (s)->extra > 0 && \
+   !istransient(s))
+
 LUAI_FUNC uint32_t luaS_hash(const char *str, size_t l, uint32_t seed);
 LUAI_FUNC uint32_t luaS_hashlongstr(TString *ts);
 LUAI_FUNC int luaS_eqlngstr(TString *a, TString *b);
 LUAI_FUNC void luaS_resize(lua_State *L, int newsize);
+LUAI_FUNC void luaS_resizestep(lua_State *L);
 LUAI_FUNC void luaS_clearcache(global_State *g);
 LUAI_FUNC void luaS_init(lua_State *L);
 LUAI_FUNC void luaS_remove(lua_State *L, TString *ts);
 LUAI_FUNC Udata *luaS_newudata(lua_State *L, size_t s);
 LUAI_FUNC TString *luaS_newlstr(lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_newtransient(lua_State *L, const char *str, size_t l);
+LUAI_FUNC TString *luaS_intern(lua_State *L, TString *ts);
+LUAI_FUNC uint32_t luaS_hashtransient(TString *ts);
 LUAI_FUNC TString *luaS_new(lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj(lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_flatten(lua_State *L, TString *ts);
+LUAI_FUNC TString *luaS_newslice(lua_State *L, TString *ts, size_t off,
+                                 size_t l);
+LUAI_FUNC TString *luaS_concat(lua_State *L, StkId ra);
+LUAI_FUNC int luaS_strchr(TString *ts, int c);
@@ -17,11 +17,19 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define LUAI_FINDAVX2   /* AVX2 search chosen at run time */
+#endif
 
 #include <lua.hpp>
 #include <lauxlib.hpp>
 #include <lualib.hpp>
 #include <llimits.hpp>
+#include <lnumconv.hpp>
 
 /*
 ** maximum number of captures that a pattern can do during
@@ -63,7 +71,7 @@ static lua_Integer posrelat(lua_Integer pos, size_t len) {
 
 static int str_sub(lua_State *L) {
   size_t l;
-  const char *s = luaL_checklstring(L, 1, &l);
+  luaL_checklstring(L, 1, &l);
   lua_Integer start = posrelat(luaL_checkinteger(L, 2), l);
   lua_Integer end = posrelat(luaL_optinteger(L, 3, -1), l);
   if (start < 1)
@@ -71,7 +79,7 @@ static int str_sub(lua_State *L) {
   if (end > (lua_Integer)l)
     end = l;
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (size_t)(end - start) + 1);
+    lua_pushsubstring(L, 1, (size_t)start - 1, (size_t)(end - start) + 1);
   else
     lua_pushliteral(L, "");
   return 1;
@@ -204,14 +212,26 @@ static int str_dump(lua_State *L) {
 #define CAP_UNFINISHED  (-1)
 #define CAP_POSITION    (-2)
 
+#if !defined(LUA_USE_PATTERNCACHE)
+#define LUA_USE_PATTERNCACHE    1
+#endif
+
+#if LUA_USE_PATTERNCACHE
+struct CPattern;
+#endif
+
 typedef struct MatchState
 {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
   lua_State *L;
+  int srcidx;  /* index of source string (to push substrings of it) */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   uint8_t level;  /* total number of captures (finished or unfinished) */
+#if LUA_USE_PATTERNCACHE
+  const struct CPattern *cp;  /* compiled pattern (NULL to interpret it) */
+#endif
   struct
   {
     const char *init;
@@ -533,29 +553,131 @@ init: /* using goto's to optimize tail recursion */
   return s;
 }
 
+/* index of the lowest bit set in 'm' (which is not zero) */
+static inline unsigned lowestbit(uint32_t m) {
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctz(m);
+#else
+  unsigned i = 0;
+  while (!(m & 1u))
+  {
+    m >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+/*
+** search with 'memchr' on the 1st char (1 <= l2 <= l1). With 'giveup',
+** returns 's1' (via '*rest') when the 1st char turns out to be frequent
+** enough to make a vector search faster.
+*/
+static const char *memfind(const char *s1, size_t l1,
+                           const char *s2, size_t l2, const char **rest) {
+  const char *init;  /* to search for a '*s2' inside 's1' */
+  const char *start = s1;
+  size_t misses = 0;
+  l2--;  /* 1st char will be checked by 'memchr' */
+  l1 = l1-l2;  /* 's2' cannot be found after that */
+  while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != nullptr)
+  {
+    init++;   /* 1st char is already checked */
+    if (memcmp(init, s2+1, l2) == 0)
+      return init-1;
+    else    /* correct 'l1' and 's1' to try again */
+    {
+      l1 -= init-s1;
+      s1 = init;
+      if (rest && ++misses >= 16 && (size_t)(s1 - start) < misses * 64)
+      {
+        *rest = s1;  /* too many candidates; let the caller go on */
+        return nullptr;
+      }
+    }
+  }
+  return nullptr;  /* not found */
+}
+
+/*
+** The vector searches compare the first and the last char of 's2'
+** against a whole block of positions at once, so that only positions
+** matching both go to 'memcmp'; a frequent first char does not stop
+** the scan at every occurrence as in 'memfind'. (2 <= l2 <= l1)
+*/
+#if defined(__SSE2__)
+static const char *findsse2(const char *s1, size_t l1,
+                            const char *s2, size_t l2) {
+  const __m128i first = _mm_set1_epi8(s2[0]);
+  const __m128i last = _mm_set1_epi8(s2[l2 - 1]);
+  size_t i;
+  for (i = 0; i + l2 - 1 + 16 <= l1; i += 16)
+  {
+    __m128i bf = _mm_loadu_si128((const __m128i *)(s1 + i));
+    __m128i bl = _mm_loadu_si128((const __m128i *)(s1 + i + l2 - 1));
+    uint32_t m = (uint32_t)_mm_movemask_epi8(
+                   _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+    for (; m != 0; m &= m - 1)
+    {
+      const char *c = s1 + i + lowestbit(m);
+      if (memcmp(c + 1, s2 + 1, l2 - 2) == 0)
+        return c;
+    }
+  }
+  return memfind(s1 + i, l1 - i, s2, l2, nullptr);  /* last block */
+}
+#endif
+
+#if defined(LUAI_FINDAVX2)
+__attribute__((target("avx2")))
+static const char *findavx2(const char *s1, size_t l1,
+                            const char *s2, size_t l2) {
+  const __m256i first = _mm256_set1_epi8(s2[0]);
+  const __m256i last = _mm256_set1_epi8(s2[l2 - 1]);
+  size_t i;
+  for (i = 0; i + l2 - 1 + 32 <= l1; i += 32)
+  {
+    __m256i bf = _mm256_loadu_si256((const __m256i *)(s1 + i));
+    __m256i bl = _mm256_loadu_si256((const __m256i *)(s1 + i + l2 - 1));
+    uint32_t m = (uint32_t)_mm256_movemask_epi8(
+                   _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+    for (; m != 0; m &= m - 1)
+    {
+      const char *c = s1 + i + lowestbit(m);
+      if (memcmp(c + 1, s2 + 1, l2 - 2) == 0)
+        return c;
+    }
+  }
+  return memfind(s1 + i, l1 - i, s2, l2, nullptr);  /* last block */
+}
+#endif
+
 static const char *lmemfind(const char *s1, size_t l1,
                             const char *s2, size_t l2) {
   if (l2 == 0)
     return s1; /* empty strings are everywhere */
   else if (l2 > l1)
     return nullptr; /* avoids a negative 'l1' */
+  else if (l2 == 1)
+    return (const char *)memchr(s1, *s2, l1);
   else
   {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != nullptr)
-    {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else    /* correct 'l1' and 's1' to try again */
-      {
-        l1 -= init-s1;
-        s1 = init;
-      }
-    }
-    return nullptr;  /* not found */
+#if defined(__SSE2__)
+    /* 'memchr' is hard to beat while the 1st char is rare */
+    const char *rest = nullptr;
+    const char *res = memfind(s1, l1, s2, l2, &rest);
+    if (rest == nullptr)
+      return res;
+    l1 -= rest - s1;
+    s1 = rest;
+#if defined(LUAI_FINDAVX2)
+    if (__builtin_cpu_supports("avx2"))
+      return findavx2(s1, l1, s2, l2);
+#endif
+    return findsse2(s1, l1, s2, l2);
+#else
+    return memfind(s1, l1, s2, l2, nullptr);
+#endif
   }
 }
 
@@ -564,7 +686,7 @@ static void push_onecapture(MatchState *ms, int i, const char *s,
   if (i >= ms->level)
   {
     if (i == 0) /* ms->level == 0, too */
-      lua_pushlstring(ms->L, s, e - s); /* add whole match */
+      lua_pushsubstring(ms->L, ms->srcidx, s - ms->src_init, e - s); /* add whole match */
     else
       luaL_error(ms->L, "invalid capture index %%%d", i + 1);
   }
@@ -576,7 +698,7 @@ static void push_onecapture(MatchState *ms, int i, const char *s,
     if (l == CAP_POSITION)
       lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
     else
-      lua_pushlstring(ms->L, ms->capture[i].init, l);
+      lua_pushsubstring(ms->L, ms->srcidx, ms->capture[i].init - ms->src_init, l);
   }
 }
 
@@ -589,25 +711,607 @@ static int push_captures(MatchState *ms, const char *s, const char *e) {
   return nlevels;  /* number of strings pushed */
 }
 
+#if defined(__SSE2__)
+/* whether any of the 16 chars at 'p' is in SPECIALS */
+static inline int specials16(const char *p) {
+  const __m128i v = _mm_loadu_si128((const __m128i *)p);
+#define eqs(c)  _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+  __m128i m = _mm_or_si128(_mm_or_si128(_mm_or_si128(eqs('^'), eqs('$')),
+                                        _mm_or_si128(eqs('*'), eqs('+'))),
+                           _mm_or_si128(_mm_or_si128(eqs('?'), eqs('.')),
+                                        _mm_or_si128(eqs('('), eqs('['))));
+  m = _mm_or_si128(m, _mm_or_si128(eqs('%'), eqs('-')));
+#undef eqs
+  return _mm_movemask_epi8(m) != 0;
+}
+#endif
+
 /* check whether pattern has no special characters */
 static int nospecials(const char *p, size_t l) {
-  size_t upto = 0;
-  do
+  size_t i;
+#if defined(__SSE2__)
+  if (l >= 16)  /* test 16 chars at a time, the last block overlapping */
   {
-    if (strpbrk(p + upto, SPECIALS))
-      return 0; /* pattern has a special character */
-    upto += strlen(p + upto) + 1;  /* may have more after \0 */
-  } while (upto <= l);
+    for (i = 0; i + 16 < l; i += 16)
+      if (specials16(p + i))
+        return 0; /* pattern has a special character */
+    return !specials16(p + l - 16);
+  }
+#endif
+  for (i = 0; i < l; i++)  /* (patterns may contain '\0') */
+    switch (p[i])
+    {
+      case '^': case '$': case '*': case '+': case '?':
+      case '.': case '(': case '[': case '%': case '-':
+        return 0; /* pattern has a special character (see SPECIALS) */
+    }
   return 1;  /* no special chars found */
 }
 
-static void prepstate(MatchState *ms, lua_State *L,
+#if LUA_USE_PATTERNCACHE
+/*
+** {======================================================
+** COMPILED PATTERNS
+** The pattern functions compile their pattern once into a list of
+** items, each character class expanded into a 256-bit set, and keep
+** it in a per-state weak table keyed by the pattern string. Besides
+** sparing the re-parsing of the pattern at every step, the compiled
+** form tells which characters a match must start with, so that an
+** unanchored search jumps over the subject with 'memchr' (or a set
+** scan) instead of trying a match at every position. Malformed
+** patterns (whose errors must be raised only when the matcher reaches
+** them) and very long ones are left to the interpreter above.
+** =======================================================
+*/
+
+/* patterns longer than this are not compiled */
+#if !defined(MAXCPATTERN)
+#define MAXCPATTERN     256
+#endif
+
+/* maximum number of different sets in a compiled pattern */
+#define MAXCSETS        32
+
+enum
+{
+  CI_END, CI_CHAR, CI_ANY, CI_SET, CI_OPEN, CI_POSITION, CI_CLOSE,
+  CI_DOLLAR, CI_BALANCE, CI_FRONTIER, CI_BACKREF
+};
+
+typedef struct CItem
+{
+  uint8_t op;
+  uint8_t rep;  /* suffix of a single-char item ('*', '+', '-', '?' or 0) */
+  uint8_t a;  /* char, set index, capture digit or 1st '%b' delimiter */
+  uint8_t b;  /* 2nd '%b' delimiter */
+} CItem;
+
+typedef uint8_t CSet[32];
+
+typedef struct CPattern
+{
+  uint16_t nitems;  /* number of items (including the final CI_END) */
+  uint16_t nsets;  /* number of sets */
+  uint16_t prefixlen;  /* length of the literal every match starts with */
+  int16_t firstset;  /* set every match starts with (-1 if none) */
+  /* followed by the items, the sets and the prefix */
+} CPattern;
+
+#define citems(cp)      ((const CItem *)((cp) + 1))
+#define csets(cp)       ((const CSet *)(citems(cp) + (cp)->nitems))
+#define cprefix(cp)     ((const char *)(csets(cp) + (cp)->nsets))
+
+#define testset(st,c)   ((st)[(c) >> 3] & (1u << ((c) & 7)))
+#define addtoset(st,c)  ((st)[(c) >> 3] |= (uint8_t)(1u << ((c) & 7)))
+
+static int csingle(const CPattern *cp, const CItem *it, int c) {
+  switch (it->op)
+  {
+    case CI_CHAR: return (c == it->a);
+    case CI_ANY: return 1;
+    default: return testset(csets(cp)[it->a], c);
+  }
+}
+
+static const char *cmatch(MatchState *ms, const char *s, const CItem *it);
+
+static const char *cmax_expand(MatchState *ms, const char *s,
+                               const CItem *it) {
+  const CItem *next = it + 1;
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  switch (it->op)
+  {
+    case CI_CHAR:
+      while (s + i < ms->src_end && uchar(s[i]) == it->a)
+        i++;
+      break;
+    case CI_ANY:
+      i = ms->src_end - s;
+      break;
+    default: {
+      const uint8_t *st = csets(ms->cp)[it->a];
+      while (s + i < ms->src_end && testset(st, uchar(s[i])))
+        i++;
+      break;
+    }
+  }
+  /* keeps trying to match with the maximum repetitions */
+  for (; i >= 0; i--)
+  {
+    const char *res;
+    if (next->op == CI_CHAR && next->rep == 0 &&  /* cannot match here? */
+        (s + i == ms->src_end || uchar(s[i]) != next->a))
+      continue;
+    if ((res = cmatch(ms, s + i, next)) != nullptr)
+      return res;
+  }
+  return nullptr;
+}
+
+static const char *cmin_expand(MatchState *ms, const char *s,
+                               const CItem *it) {
+  const CItem *next = it + 1;
+  for (;;)
+  {
+    const char *res;
+    if (!(next->op == CI_CHAR && next->rep == 0 &&  /* can match here? */
+          (s == ms->src_end || uchar(*s) != next->a)) &&
+        (res = cmatch(ms, s, next)) != nullptr)
+      return res;
+    else if (s < ms->src_end && csingle(ms->cp, it, uchar(*s)))
+      s++; /* try with one more repetition */
+    else
+      return nullptr;
+  }
+}
+
+static const char *cmatchbalance(MatchState *ms, const char *s,
+                                 int b, int e) {
+  int cont = 1;
+  if (s >= ms->src_end || uchar(*s) != b)
+    return nullptr;
+  while (++s < ms->src_end)
+  {
+    if (uchar(*s) == e)
+    {
+      if (--cont == 0)
+        return s+1;
+    }
+    else if (uchar(*s) == b)
+      cont++;
+  }
+  return nullptr;  /* string ends out of balance */
+}
+
+static const char *cstart_capture(MatchState *ms, const char *s,
+                                  const CItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES)
+    luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res = cmatch(ms, s, it)) == nullptr) /* match failed? */
+    ms->level--; /* undo capture */
+  return res;
+}
+
+static const char *cend_capture(MatchState *ms, const char *s,
+                                const CItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, it)) == nullptr) /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED; /* undo capture */
+  return res;
+}
+
+/* same as 'match', over the items of 'ms->cp' */
+static const char *cmatch(MatchState *ms, const char *s, const CItem *it) {
+  if (ms->matchdepth-- == 0)
+    luaL_error(ms->L, "pattern too complex");
+init: /* using goto's to optimize tail recursion */
+  switch (it->op)
+  {
+    case CI_END:
+      break;
+    case CI_OPEN:
+      s = cstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    case CI_POSITION:
+      s = cstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    case CI_CLOSE:
+      s = cend_capture(ms, s, it + 1);
+      break;
+    case CI_DOLLAR:
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    case CI_BALANCE: {
+      s = cmatchbalance(ms, s, it->a, it->b);
+      if (s != nullptr)
+      {
+        it++; goto init;
+      }
+      break;
+    }
+    case CI_FRONTIER: {
+      const uint8_t *st = csets(ms->cp)[it->a];
+      int previous = (s == ms->src_init) ? 0 : uchar(*(s - 1));
+      int current = (s < ms->src_end) ? uchar(*s) : 0;
+      if (!testset(st, previous) && testset(st, current))
+      {
+        it++; goto init;
+      }
+      s = nullptr;  /* match failed */
+      break;
+    }
+    case CI_BACKREF: {
+      s = match_capture(ms, s, it->a);
+      if (s != nullptr)
+      {
+        it++; goto init;
+      }
+      break;
+    }
+    default: {  /* single char plus optional suffix */
+      if (!(s < ms->src_end && csingle(ms->cp, it, uchar(*s))))
+      {
+        if (it->rep == '*' || it->rep == '?' || it->rep == '-')
+        {
+          it++; goto init;  /* accept empty */
+        }
+        s = nullptr;  /* '+' or no suffix */
+      }
+      else /* matched once */
+        switch (it->rep)
+        {
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = cmatch(ms, s + 1, it + 1)) != nullptr)
+              s = res;
+            else
+            {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+          /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;
+        }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+/* 'classend' that returns NULL for a malformed class */
+static const char *cclassend(const char *p, const char *p_end) {
+  switch (*p++)
+  {
+    case L_ESC:
+      return (p == p_end) ? nullptr : p+1;
+    case '[': {
+      if (*p == '^')
+        p++;
+      do    /* look for a ']' */
+      {
+        if (p == p_end)
+          return nullptr;
+        if (*(p++) == L_ESC && p < p_end)
+          p++; /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default:
+      return p;
+  }
+}
+
+static void addclass(uint8_t *st, int cl) {
+  int c;
+  for (c = 0; c <= UCHAR_MAX; c++)
+    if (match_class(c, cl))
+      addtoset(st, c);
+}
+
+/* set of the characters matched by class [p, ep) (as 'singlematch') */
+static void compileclass(uint8_t *st, const char *p, const char *ep) {
+  memset(st, 0, sizeof(CSet));
+  switch (*p)
+  {
+    case '.':
+      memset(st, 0xff, sizeof(CSet));
+      break;
+    case L_ESC:
+      addclass(st, uchar(*(p+1)));
+      break;
+    case '[': {
+      const char *ec = ep - 1;  /* as 'matchbracketclass' */
+      int neg = (*(p+1) == '^');
+      if (neg)
+        p++;
+      while (++p < ec)
+      {
+        if (*p == L_ESC)
+        {
+          p++;
+          addclass(st, uchar(*p));
+        }
+        else if ((*(p+1) == '-') && (p+2 < ec))
+        {
+          int c;
+          for (c = uchar(*p); c <= uchar(*(p+2)); c++)
+            addtoset(st, c);
+          p += 2;
+        }
+        else
+          addtoset(st, uchar(*p));
+      }
+      if (neg)
+      {
+        size_t i;
+        for (i = 0; i < sizeof(CSet); i++)
+          st[i] = (uint8_t)~st[i];
+      }
+      break;
+    }
+    default:
+      addtoset(st, uchar(*p));
+  }
+}
+
+/* index of set 'st' among the 'ns' sets, adding it if new (-1 if full) */
+static int internset(CSet *sets, int *ns, const uint8_t *st) {
+  int i;
+  for (i = 0; i < *ns; i++)
+    if (memcmp(sets[i], st, sizeof(CSet)) == 0)
+      return i;
+  if (*ns == MAXCSETS)
+    return -1;
+  memcpy(sets[*ns], st, sizeof(CSet));
+  return (*ns)++;
+}
+
+/* make 'it' test the characters of 'st' */
+static int setitem(CItem *it, CSet *sets, int *ns, const uint8_t *st) {
+  int i, n = 0, c = 0;
+  for (i = 0; i <= UCHAR_MAX; i++)
+    if (testset(st, i))
+    {
+      n++; c = i;
+    }
+  if (n == UCHAR_MAX + 1)
+    it->op = CI_ANY;
+  else if (n == 1)
+  {
+    it->op = CI_CHAR; it->a = uchar(c);
+  }
+  else
+  {
+    int idx = internset(sets, ns, st);
+    if (idx < 0)
+      return 0;
+    it->op = CI_SET; it->a = uchar(idx);
+  }
+  return 1;
+}
+
+/*
+** Compile pattern 'p' into a new userdata, pushed on the stack; push
+** nothing and return NULL if it does not compile.
+*/
+static const CPattern *newcpattern(lua_State *L, const char *p, size_t lp) {
+  CItem items[MAXCPATTERN + 1];
+  CSet sets[MAXCSETS];
+  CSet st;
+  const char *p_end = p + lp;
+  int ni = 0, ns = 0, i;
+  size_t prefixlen = 0;
+  int firstset = -1;
+  char prefix[MAXCPATTERN];
+  CPattern *cp;
+  while (p < p_end)
+  {
+    CItem *it = &items[ni++];
+    it->rep = it->a = it->b = 0;
+    switch (*p)
+    {
+      case '(': {
+        if (*(p + 1) == ')')
+        {
+          it->op = CI_POSITION; p += 2;
+        }
+        else
+        {
+          it->op = CI_OPEN; p++;
+        }
+        continue;
+      }
+      case ')': {
+        it->op = CI_CLOSE; p++;
+        continue;
+      }
+      case '$': {
+        if ((p + 1) != p_end)
+          goto dflt;
+        it->op = CI_DOLLAR; p++;
+        continue;
+      }
+      case L_ESC: {
+        if (p + 1 == p_end)
+          return nullptr;  /* ends with '%' */
+        switch (*(p + 1))
+        {
+          case 'b': {
+            if (p + 3 >= p_end)
+              return nullptr;  /* missing arguments to '%b' */
+            it->op = CI_BALANCE; it->a = uchar(p[2]); it->b = uchar(p[3]);
+            p += 4;
+            continue;
+          }
+          case 'f': {
+            const char *ep;
+            int idx;
+            p += 2;
+            if (p == p_end || *p != '[' || (ep = cclassend(p, p_end)) == nullptr)
+              return nullptr;
+            compileclass(st, p, ep);
+            if ((idx = internset(sets, &ns, st)) < 0)
+              return nullptr;
+            it->op = CI_FRONTIER; it->a = uchar(idx);
+            p = ep;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it->op = CI_BACKREF; it->a = uchar(p[1]);
+            p += 2;
+            continue;
+          }
+          default: goto dflt;
+        }
+      }
+      default: dflt: {
+        const char *ep = cclassend(p, p_end);
+        if (ep == nullptr)
+          return nullptr;
+        compileclass(st, p, ep);
+        if (!setitem(it, sets, &ns, st))
+          return nullptr;
+        if (ep < p_end && (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?'))
+          it->rep = uchar(*ep++);
+        p = ep;
+      }
+    }
+  }
+  items[ni++].op = CI_END;
+  /* find what every match starts with (skipping leading captures) */
+  for (i = 0; i < LUA_MAXCAPTURES &&
+              (items[i].op == CI_OPEN || items[i].op == CI_POSITION); i++) ;
+  for (; items[i].op == CI_CHAR && (items[i].rep == 0 || items[i].rep == '+'); i++)
+  {
+    prefix[prefixlen++] = (char)items[i].a;
+    if (items[i].rep == '+')
+      break;
+  }
+  if (prefixlen == 0)
+  {
+    if (items[i].op == CI_BALANCE)
+      prefix[prefixlen++] = (char)items[i].a;
+    else if (items[i].op == CI_SET && (items[i].rep == 0 || items[i].rep == '+'))
+      firstset = items[i].a;
+  }
+  cp = (CPattern *)lua_newuserdata(L, sizeof(CPattern) + ni * sizeof(CItem) +
+                                      ns * sizeof(CSet) + prefixlen);
+  cp->nitems = (uint16_t)ni;
+  cp->nsets = (uint16_t)ns;
+  cp->prefixlen = (uint16_t)prefixlen;
+  cp->firstset = (int16_t)firstset;
+  memcpy((void *)citems(cp), items, ni * sizeof(CItem));
+  memcpy((void *)csets(cp), sets, ns * sizeof(CSet));
+  memcpy((void *)cprefix(cp), prefix, prefixlen);
+  return cp;
+}
+
+/*
+** Push the compiled form of the pattern 'p' (at index 'arg'), or nil
+** if it does not compile, and return it. The cache is the first
+** upvalue of the pattern functions.
+*/
+static const CPattern *getcpattern(lua_State *L, int arg,
+                                   const char *p, size_t lp) {
+  const CPattern *cp;
+  if (lp <= MAXCPATTERN)
+  {
+    lua_pushvalue(L, arg);
+    if (lua_rawget(L, lua_upvalueindex(1)) == LuaType::Basic::UserData)
+      return (const CPattern *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if ((cp = newcpattern(L, p, lp)) != nullptr)
+    {
+      lua_pushvalue(L, arg);
+      lua_pushvalue(L, -2);
+      lua_rawset(L, lua_upvalueindex(1));  /* cache[pattern] = cp */
+      return cp;
+    }
+  }
+  lua_pushnil(L);
+  return nullptr;
+}
+
+static const char *domatch(MatchState *ms, const char *s, const char *p) {
+  if (ms->cp)
+    return cmatch(ms, s, citems(ms->cp));
+  else
+    return match(ms, s, p);
+}
+
+/* first position from 's' where a match may start (NULL if none) */
+static const char *nextstart(MatchState *ms, const char *s) {
+  const CPattern *cp = ms->cp;
+  if (cp == nullptr)
+    return s;
+  else if (cp->prefixlen > 0)
+    return lmemfind(s, ms->src_end - s, cprefix(cp), cp->prefixlen);
+  else if (cp->firstset >= 0)
+  {
+    const uint8_t *st = csets(cp)[cp->firstset];
+    for (; s < ms->src_end; s++)
+      if (testset(st, uchar(*s)))
+        return s;
+    return nullptr;
+  }
+  else
+    return s;
+}
+
+/* create the cache of compiled patterns */
+static void createpatterncache(lua_State *L) {
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "v");
+  lua_setfield(L, -2, "__mode");  /* programs go away when not in use */
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_PATTERNS_TABLE);
+}
+
+#define loadpattern(ms,L,arg,p,lp)  ((ms)->cp = getcpattern(L, arg, p, lp))
+
+/* }====================================================== */
+
+#else
+
+#define domatch(ms,s,p)         match(ms,s,p)
+#define nextstart(ms,s)         (s)
+#define loadpattern(ms,L,arg,p,lp)  ((void)0)
+
+#endif
+
+static void prepstate(MatchState *ms, lua_State *L, int srcidx,
                       const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->srcidx = srcidx;
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
   ms->p_end = p + lp;
+#if LUA_USE_PATTERNCACHE
+  ms->cp = nullptr;
+#endif
 }
 
 static void reprepstate(MatchState* ms)
@@ -649,12 +1353,15 @@ static int str_find_aux(lua_State *L, int find) {
     {
       p++; lp--;  /* skip anchor character */
     }
-    prepstate(&ms, L, s, ls, p, lp);
+    prepstate(&ms, L, 1, s, ls, p, lp);
+    loadpattern(&ms, L, 2, p, lp);
     do
     {
       const char *res;
+      if (!anchor && (s1 = nextstart(&ms, s1)) == nullptr)
+        break;  /* cannot match anywhere ahead */
       reprepstate(&ms);
-      if ((res = match(&ms, s1, p)) != nullptr)
+      if ((res = domatch(&ms, s1, p)) != nullptr)
       {
         if (find)
         {
@@ -695,8 +1402,10 @@ static int gmatch_aux(lua_State *L) {
   for (src = gm->src; src <= gm->ms.src_end; src++)
   {
     const char *e;
+    if ((src = nextstart(&gm->ms, src)) == nullptr)
+      break;  /* cannot match anywhere ahead */
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != nullptr && e != gm->lastmatch)
+    if ((e = domatch(&gm->ms, src, gm->p)) != nullptr && e != gm->lastmatch)
     {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
@@ -712,9 +1421,17 @@ static int gmatch(lua_State *L) {
   GMatchState *gm;
   lua_settop(L, 2);  /* keep them on closure to avoid being collected */
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
-  prepstate(&gm->ms, L, s, ls, p, lp);
+  prepstate(&gm->ms, L, lua_upvalueindex(1), s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = nullptr;
+#if LUA_USE_PATTERNCACHE
+  if (*p == '^')  /* not an anchor here, unlike in the cached program */
+    lua_pushnil(L);
+  else
+    loadpattern(&gm->ms, L, 2, p, lp);
+  lua_pushcclosure(L, gmatch_aux, 4);  /* also keep the program */
+#else
   lua_pushcclosure(L, gmatch_aux, 3);
+#endif
   return 1;
 }
 
@@ -798,17 +1515,25 @@ static int str_gsub(lua_State *L) {
   luaL_argcheck(L, tr == LuaType::Basic::Number || tr == LuaType::Basic::String ||
                 tr == LuaType::Basic::Function || tr == LuaType::Basic::Table, 3,
                 "string/function/table expected");
-  luaL_buffinit(L, &b);
   if (anchor)
   {
     p++; lp--;  /* skip anchor character */
   }
-  prepstate(&ms, L, src, srcl, p, lp);
+  prepstate(&ms, L, 1, src, srcl, p, lp);
+  loadpattern(&ms, L, 2, p, lp);
+  luaL_buffinit(L, &b);
   while (n < max_s)
   {
-    const char *e;
+    const char *e, *next;
+    if (!anchor && (next = nextstart(&ms, src)) != src)
+    {  /* copy what cannot start a match */
+      if (next == nullptr)
+        break;
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != nullptr && e != lastmatch)    /* match? */
+    if ((e = domatch(&ms, src, p)) != nullptr && e != lastmatch)    /* match? */
     {
       n++;
       add_value(&ms, &b, src, e, tr);  /* add replacement to buffer */
@@ -1038,6 +1763,26 @@ static const char *scanformat(lua_State *L, const char *strfrmt, char *form) {
   return p;
 }
 
+#if LUA_USE_FASTNUMFMT
+/*
+** format 'n' as 'form' with 'luai_flt2str', when 'form' has no flags
+** or width and is an 'e', 'f' or 'g'; -1 otherwise or if it cannot
+*/
+static int fastfloat(char *buff, const char *form, lua_Number n) {
+  const char *f = form + 1;  /* skip '%' */
+  int prec = 6;
+  if (*f == '.')
+  {
+    prec = 0;
+    while (isdigit(uchar(*++f)))
+      prec = prec * 10 + (*f - '0');
+  }
+  if ((*f != 'e' && *f != 'f' && *f != 'g') || *(f + 1) != '\0')
+    return -1;
+  return luai_flt2str(buff, n, prec, *f, lua_getlocaledecpoint());
+}
+#endif
+
 /*
 ** add length modifier into formats
 */
@@ -1081,6 +1826,13 @@ static int str_format(lua_State *L) {
         case 'd': case 'i':
         case 'o': case 'u': case 'x': case 'X': {
           lua_Integer n = luaL_checkinteger(L, arg);
+#if LUA_USE_FASTNUMFMT
+          if ((form[1] == 'd' || form[1] == 'i') && form[2] == '\0')
+          {
+            nb = luai_int2str(buff, n);
+            break;
+          }
+#endif
           addlenmod(form, LUA_INTEGER_FRMLEN);
           nb = l_sprintf(buff, MAX_ITEM, form, (LUA_INTEGER)n);
           break;
@@ -1093,6 +1845,10 @@ static int str_format(lua_State *L) {
         case 'e': case 'E': case 'f':
         case 'g': case 'G': {
           lua_Number n = luaL_checknumber(L, arg);
+#if LUA_USE_FASTNUMFMT
+          if ((nb = fastfloat(buff, form, n)) >= 0)
+            break;
+#endif
           addlenmod(form, LUA_NUMBER_FRMLEN);
           nb = l_sprintf(buff, MAX_ITEM, form, (LUA_NUMBER)n);
           break;
@@ -1604,6 +2360,16 @@ static const luaL_Reg strlib[] = {
   {nullptr, nullptr}
 };
 
+#if LUA_USE_PATTERNCACHE
+static const luaL_Reg patlib[] = {
+  {"find", str_find},
+  {"gmatch", gmatch},
+  {"gsub", str_gsub},
+  {"match", str_match},
+  {nullptr, nullptr}
+};
+#endif
+
 static void createmetatable(lua_State *L) {
   lua_createtable(L, 0, 1);  /* table to be metatable for strings */
   lua_pushliteral(L, "");  /* dummy string */
@@ -1620,6 +2386,10 @@ static void createmetatable(lua_State *L) {
 */
 LUAMOD_API int luaopen_string(lua_State *L) {
   luaL_newlib(L, strlib);
+#if LUA_USE_PATTERNCACHE
+  createpatterncache(L);
+  luaL_setfuncs(L, patlib, 1);  /* pattern functions share the cache */
+#endif
   createmetatable(L);
   return 1;
 }
@@ -20,10 +20,26 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_USE_SWISSTABLE, the hash part is instead an open-addressing
+** table probed one group of control bytes at a time (see ltable.hpp).
+** With LUA_USE_ORDEREDTABLES, it keeps its entries in insertion order,
+** chained from a separate array of buckets, so that traversals do not
+** depend on hash values.
+** Alternatively, a table whose hash part only has short-string keys may
+** keep them in a shape shared with other tables (see ltable.hpp).
+** With LUA_USE_TYPEDARRAYS, an array part holding only integers (or only
+** floats) keeps them unboxed (see ltable.hpp).
 */
 
 #include <cmath>
 #include <climits>
+#include <cstring>
+#if LUA_USE_TYPEDARRAYS
+#include <algorithm>
+#endif
+#if LUA_USE_SWISSTABLE && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <lua.hpp>
 #include <ldebug.hpp>
 #include <ldo.hpp>
@@ -50,11 +66,80 @@
 */
 #define MAXHBITS        (MAXABITS - 1)
 
-#define hashpow2(t, n)           (gnode(t, lmod((n), sizenode(t))))
+#if LUA_USE_GCSTATS
 
-#define hashstr(t, str)          hashpow2(t, (str)->hash)
-#define hashboolean(t, p)        hashpow2(t, p)
-#define hashint(t, i)            hashpow2(t, i)
+/*
+** charges the bytes that the arrays of a table gain or lose in a scope
+** to the statistics of tables (see 'lua_gcstats'); scopes must not nest
+*/
+class TableSizeStat
+{
+public:
+  TableSizeStat(lua_State *L, const Table *t)
+    : g(L->globalState), t(t), before(sizetable(t))
+  {
+  }
+  ~TableSizeStat()
+  {
+    luaC_statresize(this->g, LuaType(LuaType::Basic::Table), this->before, sizetable(this->t));
+  }
+private:
+  global_State *g;
+  const Table *t;
+  lu_mem before;
+};
+
+#define statresize(L, t)        TableSizeStat sizestat_(L, t)
+
+#else
+
+#define statresize(L, t)        cast_void(0)
+
+#endif
+
+#if LUA_USE_SWISSTABLE
+
+/*
+** The 'main position' of a key is its mixed hash: the high bits choose
+** the first group to probe and the top 7 bits are kept in the control
+** byte, so that most mismatches are rejected without touching 'node'.
+*/
+using MainPosition = uint64_t;
+
+static inline uint64_t hashmix(uint64_t h) {
+  h *= UINT64_C(0x9E3779B97F4A7C15);
+  return h ^ (h >> 32);
+}
+
+#define h1(h)           cast(uint32_t, (h) >> 7)
+#define h2(h)           cast(uint8_t, (h) & 0x7F)
+
+#define hashpow2(t, n)           hashmix(n)
+#define hashmod(t, n)            hashmix(n)
+#define hashpointer(t, p)        hashmix(cast(size_t, p))
+
+#define numgroups(t)    (ctrlsize(cast(uint32_t, sizenode(t))) / GROUPSIZE)
+
+#elif LUA_USE_ORDEREDTABLES
+
+/* the 'main position' of a key is its bucket in 'gbucket' */
+using MainPosition = uint32_t;
+
+#define hashpow2(t, n)           cast(uint32_t, lmod((n), sizenode(t)))
+
+/*
+** for some types, it is better to avoid modulus by power of 2, as
+** they tend to have many 2 factors.
+*/
+#define hashmod(t, n)    cast(uint32_t, (n) % ((sizenode(t)-1)|1))
+
+#define hashpointer(t, p)        hashmod(t, point2uint(p))
+
+#else
+
+using MainPosition = Node *;
+
+#define hashpow2(t, n)           (gnode(t, lmod((n), sizenode(t))))
 
 /*
 ** for some types, it is better to avoid modulus by power of 2, as
@@ -64,6 +149,12 @@
 
 #define hashpointer(t, p)        hashmod(t, point2uint(p))
 
+#endif
+
+#define hashstr(t, str)          hashpow2(t, luaS_shrhash(str))
+#define hashboolean(t, p)        hashpow2(t, p)
+#define hashint(t, i)            hashpow2(t, l_castS2U(i))
+
 #define dummynode               (&dummynode_)
 
 static const Node dummynode_ = {
@@ -106,7 +197,7 @@ static int l_hashfloat(lua_Number n) {
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
 */
-static Node *mainposition(const Table *t, const TValue *key) {
+static MainPosition mainposition([[maybe_unused]] const Table *t, const TValue *key) {
   switch (ttype(key))
   {
     case LuaType::Variant::IntNumber:
@@ -129,6 +220,137 @@ static Node *mainposition(const Table *t, const TValue *key) {
   }
 }
 
+#if LUA_USE_SWISSTABLE
+
+/*
+** bit mask of the positions in group 'g' whose control byte is 'c'
+*/
+static inline uint32_t matchctrl(const uint8_t *g, uint8_t c) {
+#if defined(__SSE2__)
+  __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g));
+  return cast(uint32_t, _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, c)))));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < GROUPSIZE; i++)
+    m |= cast(uint32_t, g[i] == c) << i;
+  return m;
+#endif
+}
+
+/* index of the lowest bit set in 'm' (which is not zero) */
+static inline uint32_t lowestbit(uint32_t m) {
+#if defined(__GNUC__)
+  return cast(uint32_t, __builtin_ctz(m));
+#else
+  uint32_t i = 0;
+  while (!(m & 1u))
+  {
+    m >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+/*
+** search the probe sequence of main position 'mp' for a key satisfying
+** 'eq'. Groups are probed in triangular order, which visits all of them;
+** the search stops at the first group with an empty position.
+*/
+template <typename Eq>
+static Node *findnode(const Table *t, MainPosition mp, Eq eq) {
+  if (isdummy(t))
+    return nullptr;
+  uint32_t mask = numgroups(t) - 1;
+  uint32_t g = h1(mp) & mask;
+  uint8_t frag = h2(mp);
+  for (uint32_t i = 1; ; i++)
+  {
+    const uint8_t *ctrl = t->ctrl + g * GROUPSIZE;
+    for (uint32_t m = matchctrl(ctrl, frag); m != 0; m &= m - 1)
+    {
+      Node *n = gnode(t, g * GROUPSIZE + lowestbit(m));
+      if (eq(gkey(n)))
+        return n;
+    }
+    if (matchctrl(ctrl, CTRL_EMPTY) != 0 || i > mask)
+      return nullptr;  /* not found */
+    g = (g + i) & mask;
+  }
+}
+
+/*
+** claims the first empty position in the probe sequence of 'mp'
+*/
+static Node *getfreepos(Table *t, MainPosition mp) {
+  lua_assert(t->growthleft > 0);
+  uint32_t mask = numgroups(t) - 1;
+  uint32_t g = h1(mp) & mask;
+  for (uint32_t i = 1; ; i++)
+  {
+    uint8_t *ctrl = t->ctrl + g * GROUPSIZE;
+    uint32_t m = matchctrl(ctrl, CTRL_EMPTY);
+    if (m != 0)
+    {
+      uint32_t j = lowestbit(m);
+      ctrl[j] = h2(mp);
+      t->growthleft--;
+      return gnode(t, g * GROUPSIZE + j);
+    }
+    g = (g + i) & mask;
+  }
+}
+
+/*
+** number of keys a hash part of 'size' nodes takes before growing;
+** a single group may be filled up, larger tables keep 1/8 free.
+*/
+static uint32_t maxload(uint32_t size) {
+  return (size <= GROUPSIZE) ? size : size - size / 8;
+}
+
+#elif LUA_USE_ORDEREDTABLES
+
+/*
+** search the entries chained from bucket 'mp' for a key satisfying 'eq'
+*/
+template <typename Eq>
+static Node *findnode(const Table *t, MainPosition mp, Eq eq) {
+  if (isdummy(t))
+    return nullptr;
+  for (int i = gbucket(t, mp); i != 0; )
+  {
+    Node *n = gnode(t, i - 1);
+    if (eq(gkey(n)))
+      return n;
+    i = gnext(n);
+  }
+  return nullptr;  /* not found */
+}
+
+#else
+
+/*
+** search the collision chain starting at main position 'mp' for a key
+** satisfying 'eq'
+*/
+template <typename Eq>
+static Node *findnode(const Table *t, MainPosition mp, Eq eq) {
+  UNUSED(t);
+  Node *n = mp;
+  for (;;)
+  {
+    if (eq(gkey(n)))
+      return n;
+    int nx = gnext(n);
+    if (nx == 0)
+      return nullptr;  /* not found */
+    n += nx;
+  }
+}
+
+#endif
+
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
 ** the array part of the table, 0 otherwise.
@@ -143,6 +365,175 @@ static uint32_t arrayindex(const TValue *key) {
   return 0;  /* 'key' did not match some condition */
 }
 
+#if LUA_USE_TYPEDARRAYS
+
+static_assert(sizeof(lua_Integer) == sizeof(lua_Number),
+              "typed array parts need same-sized integers and floats");
+
+/*
+** returns element 'i' (counting from 0) of a typed array part through
+** the table's proxy
+*/
+static const TValue *arrayproxy(Table *t, uint32_t i) {
+  t->proxyindex = i;
+  if (i >= t->arrayn)
+  {
+    setnilvalue(&t->proxy);
+  }
+  else if (t->arraykind == ARRAY_INT)
+  {
+    setsmallivalue(&t->proxy, t->iarray[i]);
+  }
+  else
+  {
+    setfltvalue(&t->proxy, t->farray[i]);
+  }
+  return &t->proxy;
+}
+
+/*
+** tries to store 'v' as element 'i' of a typed array part; returns
+** false if the array part cannot represent the result. (An empty array
+** part takes the kind of its first element. Boxed integers are left
+** out, so that 'arrayproxy' never allocates.)
+*/
+static int typedstore(Table *t, uint32_t i, const TValue *v) {
+  if (ttisnil(v))
+  {
+    if (i + 1 == t->arrayn)    /* removing the last element? */
+      t->arrayn = i;
+    return (i >= t->arrayn);  /* else it would open a hole */
+  }
+  if (i > t->arrayn)    /* would open a hole? */
+    return 0;
+  if (ttisinteger(v) && !iscollectable(v) &&
+      (t->arraykind == ARRAY_INT || t->arrayn == 0))
+  {
+    t->arraykind = ARRAY_INT;
+    t->iarray[i] = ivalue(v);
+  }
+  else if (ttisfloat(v) && (t->arraykind == ARRAY_FLT || t->arrayn == 0))
+  {
+    t->arraykind = ARRAY_FLT;
+    t->farray[i] = fltvalue(v);
+  }
+  else
+    return 0;
+  if (i == t->arrayn)
+    t->arrayn++;
+  return 1;
+}
+
+/*
+** converts a typed array part to TValues
+*/
+static void boxarray(lua_State *L, Table *t) {
+  uint32_t size = t->sizearray;
+  TValue *a = LMem<TValue>::luaM_newvector(L, size);
+  for (uint32_t i = 0; i < size; i++)
+    setobj2t(L, &a[i], arrayproxy(t, i));
+  LMem<lua_Integer>::luaM_freearray(L, t->iarray, size);
+  t->array = a;
+  t->arraykind = ARRAY_BOXED;
+}
+
+/*
+** converts an array part of TValues to a typed one, if all its
+** elements are integers (or all are floats) and there are no holes
+** between them
+*/
+static void unboxarray(lua_State *L, Table *t) {
+  uint32_t size = t->sizearray;
+  uint32_t n = 0;
+  while (n < size && !ttisnil(&t->array[n]))
+    n++;
+  for (uint32_t i = n; i < size; i++)
+    if (!ttisnil(&t->array[i]))
+      return;  /* there is a hole */
+  bool isint = (n == 0 || ttisinteger(&t->array[0]));
+  for (uint32_t i = 0; i < n; i++)
+    if (isint ? !ttisinteger(&t->array[i]) || iscollectable(&t->array[i])
+              : !ttisfloat(&t->array[i]))
+      return;
+  lua_Integer *a = LMem<lua_Integer>::luaM_newvector(L, size);
+  for (uint32_t i = 0; i < n; i++)
+  {
+    if (isint)
+      a[i] = ivalue(&t->array[i]);
+    else
+      reinterpret_cast<lua_Number *>(a)[i] = fltvalue(&t->array[i]);
+  }
+  LMem<TValue>::luaM_freearray(L, t->array, size);
+  t->iarray = a;
+  t->arraykind = isint ? ARRAY_INT : ARRAY_FLT;
+  t->arrayn = n;
+}
+
+void luaH_storeproxy(lua_State *L, Table *t) {
+  uint32_t i = t->proxyindex;
+  lua_assert(istyped(t) && i < t->sizearray);
+  if (!typedstore(t, i, &t->proxy))
+  {
+    TValue v;
+    statresize(L, t);
+    setobj(L, &v, &t->proxy);  /* 'boxarray' reuses the proxy */
+    boxarray(L, t);
+    setobj2t(L, &t->array[i], &v);
+  }
+}
+
+#endif
+
+/* element 'i' (counting from 0) of the array part */
+static const TValue *arrayslot(Table *t, uint32_t i) {
+#if LUA_USE_TYPEDARRAYS
+  if (istyped(t))
+    return arrayproxy(t, i);
+#endif
+  return &t->array[i];
+}
+
+/* true if element 'i' (counting from 0) of the array part is nil */
+static bool arrayisnil(const Table *t, uint32_t i) {
+#if LUA_USE_TYPEDARRAYS
+  if (istyped(t))
+    return (i >= t->arrayn);
+#endif
+  return ttisnil(&t->array[i]);
+}
+
+/*
+** Key arrays with more than SHAPESCANKEYS keys have, after 'key', an
+** index with 2 * 'size' positions (open addressing on the address of
+** the key), each one 0 or a slot + 1.
+*/
+#define hasindex(a)     ((a)->size > SHAPESCANKEYS)
+#define keyindex(a)     cast(uint8_t *, &(a)->key[(a)->size])
+#define indexmask(a)    (2 * (a)->size - 1)
+#define indexpos(a, k)  (((point2uint(k) * 0x9E3779B9u) >> 24) & indexmask(a))
+
+/*
+** returns the slot of 'key' in shape 's', or -1 if it is not there
+*/
+static int shapeindex(const Shape *s, const TString *key) {
+  const ShapeKeys *a = s->keys;
+  if (s->nkeys <= SHAPESCANKEYS)
+  {
+    for (uint32_t i = 0; i < s->nkeys; i++)
+      if (eqshrstr(a->key[i], key))
+        return cast_int(i);
+    return -1;
+  }
+  const uint8_t *index = keyindex(a);
+  for (uint32_t i = indexpos(a, key); index[i] != 0; i = (i + 1) & indexmask(a))
+  {
+    uint32_t slot = index[i] - 1u;
+    if (eqshrstr(a->key[slot], key))  /* keys of an array are all different */
+      return (slot < s->nkeys) ? cast_int(slot) : -1;
+  }
+  return -1;
+}
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -155,43 +546,67 @@ static uint32_t findindex(lua_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (i != 0 && i <= t->sizearray) /* is 'key' inside array part? */
     return i; /* yes; that's the index */
+  i = t->lastnext - t->sizearray;  /* position returned by the last 'next' */
+  if (isshaped(t) ? (i - 1 < t->shape->nkeys && ttisshrstring(key) &&
+                     shapekey(t->shape, i - 1) == tsvalue(key))
+                  : (i - 1 < cast(uint32_t, allocsizenode(t)) &&
+                     luaV_rawequalobj(gkey(gnode(t, i - 1)), key)))
+    return t->lastnext;  /* a traversal going on: no need to search */
+  if (isshaped(t))
+  {
+    int slot = ttisshrstring(key) ? shapeindex(t->shape, tsvalue(key)) : -1;
+    if (slot < 0)
+      luaG_runerror(L, "invalid key to 'next'"); /* key not found */
+    /* slots are numbered after array elements */
+    return (cast(uint32_t, slot) + 1) + t->sizearray;
+  }
   else
   {
-    int nx;
-    Node *n = mainposition(t, key);
-    for (;;)    /* check whether 'key' is somewhere in the chain */
-    { /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||
-          (ttisdeadkey(gkey(n)) && iscollectable(key) &&
-           deadvalue(gkey(n)) == gcvalue(key)))
-      {
-        i = cast_int(n - gnode(t, 0));  /* key index in hash table */
-        /* hash elements are numbered after array ones */
-        return (i + 1) + t->sizearray;
-      }
-      nx = gnext(n);
-      if (nx == 0)
-        luaG_runerror(L, "invalid key to 'next'"); /* key not found */
-      else
-        n += nx;
-    }
+    MainPosition mp = mainposition(t, key);
+    Node *n = findnode(t, mp, [key](const TValue *k) {
+      return luaV_rawequalobj(k, key);
+    });
+    if (n == nullptr)    /* key may be dead already, but it is ok to use it in 'next' */
+      n = findnode(t, mp, [key](const TValue *k) {
+        return ttisdeadkey(k) && iscollectable(key) && deadvalue(k) == gcvalue(key);
+      });
+    if (n == nullptr)
+      luaG_runerror(L, "invalid key to 'next'"); /* key not found */
+    i = cast(uint32_t, n - gnode(t, 0));  /* key index in hash table */
+    /* hash elements are numbered after array ones */
+    return (i + 1) + t->sizearray;
   }
 }
 
 int luaH_next(lua_State *L, Table *t, StkId key) {
+  luaS_unrope(L, key);
   uint32_t i = findindex(L, t, key);  /* find original element */
   for (; i < t->sizearray; i++) /* try first array part */
-    if (!ttisnil(&t->array[i]))    /* a non-nil value? */
+    if (!arrayisnil(t, i))    /* a non-nil value? */
     {
-      setivalue(key, i + 1);
-      setobj2s(L, key+1, &t->array[i]);
+      setivalue(L, key, i + 1);
+      setobj2s(L, key+1, arrayslot(t, i));
+      t->lastnext = i + 1;
       return 1;
     }
+  if (isshaped(t))
+  {
+    for (i -= t->sizearray; i < t->shape->nkeys; i++) /* slots */
+      if (!ttisnil(&t->slots[i]))
+      {
+        setsvalue2s(L, key, shapekey(t->shape, i));
+        setobj2s(L, key+1, &t->slots[i]);
+        t->lastnext = (i + 1) + t->sizearray;
+        return 1;
+      }
+    return 0;  /* no more elements */
+  }
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) /* hash part */
     if (!ttisnil(gval(gnode(t, i))))    /* a non-nil value? */
     {
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      t->lastnext = (i + 1) + t->sizearray;
       return 1;
     }
   return 0;  /* no more elements */
@@ -266,7 +681,7 @@ static uint32_t numusearray(const Table *t, uint32_t *nums) {
     }
     /* count elements in range (2^(lg - 1), 2^lg] */
     for (; i <= lim; i++)
-      if (!ttisnil(&t->array[i-1]))
+      if (!arrayisnil(t, i - 1))
         lc++;
     nums[lg] += lc;
     ause += lc;
@@ -293,6 +708,14 @@ static int numusehash(const Table *t, uint32_t *nums, uint32_t *pna) {
 
 static void setarrayvector(lua_State *L, Table *t, uint32_t size) {
   uint32_t i;
+#if LUA_USE_TYPEDARRAYS
+  if (istyped(t))    /* new elements are past 'arrayn', so they are nil */
+  {
+    LMem<lua_Integer>::luaM_reallocvector(L, t->iarray, t->sizearray, size);
+    t->sizearray = size;
+    return;
+  }
+#endif
   LMem<TValue>::luaM_reallocvector(L, t->array, t->sizearray, size);
   for (i = t->sizearray; i < size; i++)
     setnilvalue(&t->array[i]);
@@ -304,16 +727,27 @@ static void setnodevector(lua_State *L, Table *t, uint32_t size) {
   {
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
+#if LUA_USE_SWISSTABLE
+    t->ctrl = nullptr;  /* signal that it is using dummy node */
+    t->growthleft = 0;
+#elif LUA_USE_ORDEREDTABLES
+    t->firstfree = nullptr;  /* signal that it is using dummy node */
+#else
     t->lastfree = nullptr;  /* signal that it is using dummy node */
+#endif
   }
   else
   {
     int i;
     int lsize = luaO_ceillog2(size);
+#if LUA_USE_SWISSTABLE
+    if (maxload(twoto(lsize)) < size)    /* would be too loaded? */
+      lsize++;
+#endif
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = LMem<Node>::luaM_newvector(L, size);
+    t->node = LMem<Node>::luaM_malloc(L, nodeblocksize(size));
     for (i = 0; i < (int)size; i++)
     {
       Node *n = gnode(t, i);
@@ -322,14 +756,63 @@ static void setnodevector(lua_State *L, Table *t, uint32_t size) {
       setnilvalue(gval(n));
     }
     t->lsizenode = cast_byte(lsize);
+#if LUA_USE_SWISSTABLE
+    t->ctrl = cast(uint8_t *, gnode(t, size));
+    memset(t->ctrl, CTRL_EMPTY, size);
+    memset(t->ctrl + size, CTRL_SENTINEL, ctrlsize(size) - size);
+    t->growthleft = maxload(size);
+#elif LUA_USE_ORDEREDTABLES
+    memset(&gbucket(t, 0), 0, sizeof(int) * size);  /* all buckets empty */
+    t->firstfree = gnode(t, 0);  /* all entries are free */
+#else
     t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
   }
 }
 
+static void setslotvector(lua_State *L, Table *t, uint32_t size);
+static uint32_t unshape(lua_State *L, Table *t, uint32_t extra);
+
+#if LUA_USE_TYPEDARRAYS
+/*
+** true if some entry of the hash part of 't' would move to an array
+** part of size 'nasize'
+*/
+static int hasarraykeys(const Table *t, uint32_t nasize) {
+  for (int i = 0; i < allocsizenode(t); i++)
+  {
+    const Node *n = gnode(t, i);
+    uint32_t k = arrayindex(gkey(n));
+    if (k != 0 && k <= nasize && !ttisnil(gval(n)))
+      return 1;
+  }
+  return 0;
+}
+#endif
+
 void luaH_resize(lua_State *L, Table *t, uint32_t nasize,
                  uint32_t nhsize) {
   uint32_t i;
   int j;
+  statresize(L, t);
+  if (isshaped(t))
+  {
+    if (nasize >= t->sizearray && nhsize <= MAXSHAPEKEYS)
+    { /* table can stay in shape mode */
+      if (nasize > t->sizearray)
+        setarrayvector(L, t, nasize);
+      if (nhsize > t->sizeslots)
+        setslotvector(L, t, nhsize);
+      return;
+    }
+    nhsize += unshape(L, t, 0);  /* entries already moved to 'node' */
+  }
+#if LUA_USE_TYPEDARRAYS
+  /* elements moving between the two parts are moved as TValues (and
+     the array part may become typed again at the end) */
+  if (istyped(t) && (nasize < t->arrayn || hasarraykeys(t, nasize)))
+    boxarray(L, t);
+#endif
   uint32_t oldasize = t->sizearray;
   int oldhsize = allocsizenode(t);
   Node *nold = t->node;  /* save old hash ... */
@@ -337,7 +820,9 @@ void luaH_resize(lua_State *L, Table *t, uint32_t nasize,
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
   setnodevector(L, t, nhsize);
-  if (nasize < oldasize)    /* array part must shrink? */
+  if (nasize < oldasize && istyped(t))    /* vanishing slice is all nil? */
+    setarrayvector(L, t, nasize);
+  else if (nasize < oldasize)    /* array part must shrink? */
   {
     t->sizearray = nasize;
     /* re-insert elements from vanishing slice */
@@ -347,8 +832,9 @@ void luaH_resize(lua_State *L, Table *t, uint32_t nasize,
     /* shrink array */
     LMem<TValue>::luaM_reallocvector(L, t->array, oldasize, nasize);
   }
-  /* re-insert elements from hash part */
-  for (j = oldhsize - 1; j >= 0; j--)
+  /* re-insert elements from hash part (in order, which keeps the
+     insertion order of ordered tables) */
+  for (j = 0; j < oldhsize; j++)
   {
     Node *old = nold + j;
     if (!ttisnil(gval(old)))
@@ -357,7 +843,11 @@ void luaH_resize(lua_State *L, Table *t, uint32_t nasize,
       setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
   }
   if (oldhsize > 0) /* not the dummy node? */
-    LMem<Node>::luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    LMem<Node>::luaM_freemem(L, nold, nodeblocksize(cast(size_t, oldhsize))); /* free old hash */
+#if LUA_USE_TYPEDARRAYS
+  if (!istyped(t))
+    unboxarray(L, t);
+#endif
 }
 
 void luaH_resizearray(lua_State *L, Table *t, uint32_t nasize) {
@@ -365,6 +855,17 @@ void luaH_resizearray(lua_State *L, Table *t, uint32_t nasize) {
   luaH_resize(L, t, nasize, nsize);
 }
 
+/*
+** Grows the parts of 't' that are smaller than 'nasize' (array part)
+** or 'nhsize' (hash part or shape slots); never shrinks them.
+*/
+void luaH_reserve(lua_State *L, Table *t, uint32_t nasize, uint32_t nhsize) {
+  uint32_t hsize = isshaped(t) ? t->sizeslots : cast(uint32_t, allocsizenode(t));
+  if (nasize > t->sizearray || nhsize > hsize)
+    luaH_resize(L, t, (nasize > t->sizearray) ? nasize : t->sizearray,
+                (nhsize > hsize) ? nhsize : hsize);
+}
+
 /*
 ** nums[i] = number of keys 'k' where 2^(i - 1) < k <= 2^i
 */
@@ -392,6 +893,297 @@ static void rehash(lua_State *L, Table *t, const TValue *ek) {
 ** }=============================================================
 */
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/* size of a key array with room for 'size' keys */
+static size_t sizeshapekeys(uint32_t size) {
+  return sizeof(ShapeKeys) + sizeof(TString *) * (size - 1) +
+         (size > SHAPESCANKEYS ? 2 * size : 0);
+}
+
+/* does shape 's' have its own key array (allocated after it)? */
+#define ownskeys(s)     ((s)->keys == cast(ShapeKeys *, (s) + 1))
+
+static size_t sizeshape(const Shape *s) {
+  return sizeof(Shape) + (ownskeys(s) ? sizeshapekeys(s->keys->size) : 0);
+}
+
+/* adds 'key' to the keys in use of 'a' */
+static void appendkey(ShapeKeys *a, TString *key) {
+  uint32_t slot = a->n++;
+  lua_assert(slot < a->size);
+  a->key[slot] = key;
+  if (hasindex(a))
+  {
+    uint8_t *index = keyindex(a);
+    uint32_t i = indexpos(a, key);
+    while (index[i] != 0)
+      i = (i + 1) & indexmask(a);
+    index[i] = cast_byte(slot + 1);
+  }
+}
+
+/* removes the last key in use of 'a' */
+static void droplastkey(ShapeKeys *a) {
+  uint32_t n = a->n - 1;
+  if (hasindex(a))
+  {
+    memset(keyindex(a), 0, 2 * a->size);  /* rebuild the index */
+    a->n = 0;
+    for (uint32_t i = 0; i < n; i++)
+      appendkey(a, a->key[i]);
+  }
+  a->n = n;
+}
+
+#define transitionpos(g, s, h) \
+  lmod(point2uint(s) ^ (h), (g)->shapes.size)
+
+/* the key added by a transition into shape 's' */
+#define lastkey(s)      shapekey(s, (s)->nkeys - 1)
+
+static Shape *findtransition(global_State *g, const Shape *s, TString *key) {
+  if (g->shapes.size == 0)
+    return nullptr;
+  for (Shape *c = g->shapes.hash[transitionpos(g, s, key->hash)]; c != nullptr; c = c->hnext)
+    if (c->parent == s && lastkey(c) == key)
+      return c;
+  return nullptr;
+}
+
+/*
+** make sure the transition table has room for one more entry
+*/
+static void growtransitions(lua_State *L) {
+  Shapetable *tb = &L->globalState->shapes;
+  if (tb->nuse < tb->size)
+    return;
+  uint32_t oldsize = tb->size;
+  uint32_t newsize = (oldsize == 0) ? 64 : oldsize * 2;
+  Shape **newhash = LMem<Shape *>::luaM_newvector(L, newsize);
+  for (uint32_t i = 0; i < newsize; i++)
+    newhash[i] = nullptr;
+  for (uint32_t i = 0; i < oldsize; i++)    /* rehash all transitions */
+  {
+    Shape *c = tb->hash[i];
+    while (c)
+    {
+      Shape *next = c->hnext;
+      uint32_t h = lmod(point2uint(c->parent) ^ c->keyhash, newsize);
+      c->hnext = newhash[h];
+      newhash[h] = c;
+      c = next;
+    }
+  }
+  LMem<Shape *>::luaM_freearray(L, tb->hash, oldsize);
+  tb->hash = newhash;
+  tb->size = newsize;
+}
+
+static void removetransition(global_State *g, Shape *c) {
+  Shape **p = &g->shapes.hash[transitionpos(g, c->parent, c->keyhash)];
+  while (*p != c)
+    p = &(*p)->hnext;
+  *p = c->hnext;
+  g->shapes.nuse--;
+}
+
+/*
+** creates the shape 'parent' + 'key' (or a root shape, if 'parent' is
+** NULL) and registers it as a transition from 'parent'
+*/
+static Shape *newshape(lua_State *L, Shape *parent, TString *key) {
+  global_State *g = L->globalState;
+  uint32_t nkeys = (parent != nullptr) ? parent->nkeys + 1 : 0;
+  ShapeKeys *a = (parent != nullptr) ? parent->keys : nullptr;
+  uint32_t size = 0;  /* room of a new key array (0 if sharing 'a') */
+  if (parent != nullptr)
+  {
+    growtransitions(L);  /* before creating the shape, as it may fail */
+    if (a == nullptr || a->n != parent->nkeys || a->n == a->size)
+      for (size = 4; size < nkeys; size *= 2) {}
+  }
+  Shape *s = cast(Shape *, LMem<char>::luaM_malloc(L, sizeof(Shape) +
+                           (size > 0 ? sizeshapekeys(size) : 0)));
+  s->parent = parent;
+  s->hnext = nullptr;
+  s->keys = a;
+  s->nkeys = nkeys;
+  s->nchildren = 0;
+  s->refcount = 0;
+  s->keyhash = (key != nullptr) ? key->hash : 0;
+  if (parent != nullptr)
+  {
+    if (size > 0)  /* copy the keys of 'parent' into a new array? */
+    {
+      s->keys = cast(ShapeKeys *, s + 1);
+      s->keys->n = 0;
+      s->keys->size = size;
+      if (hasindex(s->keys))
+        memset(keyindex(s->keys), 0, 2 * size);
+      for (uint32_t i = 0; i < parent->nkeys; i++)
+        appendkey(s->keys, shapekey(parent, i));
+    }
+    appendkey(s->keys, key);
+    parent->refcount++;
+    parent->nchildren++;
+    uint32_t h = transitionpos(g, parent, s->keyhash);
+    s->hnext = g->shapes.hash[h];
+    g->shapes.hash[h] = s;
+    g->shapes.nuse++;
+  }
+  return s;
+}
+
+/*
+** drops one reference to shape 's', freeing it (and then dropping its
+** reference to its parent) when it is no longer used
+*/
+void luaH_releaseshape(lua_State *L, Shape *s) {
+  while (s != nullptr && --s->refcount == 0)
+  {
+    Shape *parent = s->parent;
+    if (parent != nullptr)
+    {
+      removetransition(L->globalState, s);
+      parent->nchildren--;
+      /* a shape without children uses the whole key array */
+      lua_assert(s->keys->n == s->nkeys);
+      if (!ownskeys(s))
+        droplastkey(s->keys);
+    }
+    LMem<char>::luaM_freemem(L, cast(char *, s), sizeshape(s));
+    s = parent;
+  }
+}
+
+void luaH_initshapes(lua_State *L) {
+#if LUA_USE_SHAPES
+  global_State *g = L->globalState;
+  g->rootshape = newshape(L, nullptr, nullptr);
+  g->rootshape->refcount = 1;  /* owned by the global state */
+#else
+  UNUSED(L);
+#endif
+}
+
+void luaH_freeshapes(lua_State *L) {
+  global_State *g = L->globalState;
+  if (g->rootshape != nullptr)
+    luaH_releaseshape(L, g->rootshape);
+  g->rootshape = nullptr;
+  lua_assert(g->shapes.nuse == 0);
+  LMem<Shape *>::luaM_freearray(L, g->shapes.hash, g->shapes.size);
+  g->shapes.hash = nullptr;
+  g->shapes.size = 0;
+}
+
+/*
+** returns the shape 's' + 'key', or NULL if it would be too big or 's'
+** already has too many transitions
+*/
+static Shape *addshapekey(lua_State *L, Shape *s, TString *key) {
+  global_State *g = L->globalState;
+  if (s->nkeys >= MAXSHAPEKEYS)
+    return nullptr;
+  Shape *c = findtransition(g, s, key);
+  if (c == nullptr)
+  {
+    if (s->nchildren >= ((s == g->rootshape) ? MAXROOTCHILDREN : MAXSHAPECHILDREN))
+      return nullptr;  /* megamorphic */
+    c = newshape(L, s, key);
+  }
+  return c;
+}
+
+static void setslotvector(lua_State *L, Table *t, uint32_t size) {
+  LMem<TValue>::luaM_reallocvector(L, t->slots, t->sizeslots, size);
+  for (uint32_t i = t->sizeslots; i < size; i++)
+    setnilvalue(&t->slots[i]);
+  t->sizeslots = size;
+}
+
+/*
+** moves the entries of a shaped table into a new hash part with room
+** for 'extra' more keys; returns the number of entries moved
+*/
+static uint32_t unshape(lua_State *L, Table *t, uint32_t extra) {
+  Shape *s = t->shape;
+  TValue *slots = t->slots;
+  uint32_t sizeslots = t->sizeslots;
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < s->nkeys; i++)
+    if (!ttisnil(&slots[i]))
+      n++;
+  setnodevector(L, t, n + extra);  /* may fail; table is still intact */
+  t->shape = nullptr;
+  t->slots = nullptr;
+  t->sizeslots = 0;
+  for (uint32_t i = 0; i < s->nkeys; i++)
+    if (!ttisnil(&slots[i]))
+    {
+      TValue k;
+      setsvalue(L, &k, shapekey(s, i));
+      setobjt2t(L, luaH_newkey(L, t, &k), &slots[i]);
+    }
+  LMem<TValue>::luaM_freearray(L, slots, sizeslots);
+  luaH_releaseshape(L, s);
+  return n;
+}
+
+/*
+** 'luaH_newkey' for a shaped table: a short-string key moves the table
+** to the next shape; an integer key may grow the array part (as
+** 'rehash' would do). Any other case moves the table out of shape mode
+** and returns NULL, so that the key goes to the new hash part.
+*/
+static TValue *shapenewkey(lua_State *L, Table *t, const TValue *key) {
+  Shape *s = t->shape;
+  if (ttisshrstring(key))
+  {
+    uint32_t slot = s->nkeys;
+    if (slot >= t->sizeslots && slot < MAXSHAPEKEYS)    /* grow slots? */
+    {
+      uint32_t size = (slot < 2) ? 4 : slot * 2;
+      statresize(L, t);
+      setslotvector(L, t, (size < MAXSHAPEKEYS) ? size : MAXSHAPEKEYS);
+    }
+    Shape *c = addshapekey(L, s, tsvalue(key));
+    if (c != nullptr)
+    {
+      c->refcount++;
+      t->shape = c;
+      luaH_releaseshape(L, s);
+      luaC_barrierback(L, t, key);
+      lua_assert(ttisnil(&t->slots[slot]));
+      return &t->slots[slot];
+    }
+  }
+  else if (arrayindex(key) != 0)
+  {
+    uint32_t nums[MAXABITS + 1] = {};
+    uint32_t na = numusearray(t, nums);
+    na += countint(key, nums);
+    uint32_t asize = computesizes(nums, &na);
+    if (arrayindex(key) <= asize)    /* key fits in the new array part? */
+    {
+      luaH_resize(L, t, asize, 0);
+      return cast(TValue *, arrayslot(t, arrayindex(key) - 1));
+    }
+  }
+  statresize(L, t);
+  unshape(L, t, 1);
+  return nullptr;
+}
+
+/*
+** }=============================================================
+*/
+
 Table *luaH_new(lua_State *L)
 {
   Table* t = LGCFactory::luaC_newobj<Table>(L, LuaType::Basic::Table, sizeof(Table));
@@ -399,10 +1191,72 @@ Table *luaH_new(lua_State *L)
   t->flags = cast_byte(~0);
   t->array = nullptr;
   t->sizearray = 0;
+#if LUA_USE_TYPEDARRAYS
+  t->arraykind = ARRAY_INT;  /* an empty typed array part */
+  t->arrayn = 0;
+  t->proxyindex = 0;
+  setnilvalue(&t->proxy);
+#endif
+  t->slots = nullptr;
+  t->sizeslots = 0;
+  t->lastnext = 0;
+  t->border = 0;
+  t->shape = L->globalState->rootshape;
+  if (t->shape != nullptr)
+    t->shape->refcount++;
   setnodevector(L, t, 0);
   return t;
 }
 
+#if LUA_USE_SWISSTABLE
+
+/*
+** inserts a new key into the hash part, at the first empty position of
+** its probe sequence; the table is rehashed when it has no more room.
+** Keys are never removed, so positions whose value is nil are only
+** reclaimed by a rehash.
+*/
+static TValue *newnodekey(lua_State *L, Table *t, const TValue *key) {
+  if (t->growthleft == 0)    /* no room for another key? */
+  {
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  Node *n = getfreepos(t, mainposition(t, key));
+  setnodekey(L, &n->i_key, key);
+  luaC_barrierback(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+#elif LUA_USE_ORDEREDTABLES
+
+/*
+** appends a new key to the entries of the hash part and links it into
+** its bucket; the table is rehashed when all entries were used. Keys
+** are never removed, so entries whose value is nil are only reclaimed
+** (keeping the order of the others) by a rehash.
+*/
+static TValue *newnodekey(lua_State *L, Table *t, const TValue *key) {
+  if (isdummy(t) || t->firstfree == gnode(t, sizenode(t)))    /* full? */
+  {
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+  Node *n = t->firstfree++;
+  MainPosition mp = mainposition(t, key);
+  setnodekey(L, &n->i_key, key);
+  gnext(n) = gbucket(t, mp);
+  gbucket(t, mp) = cast_int(n - gnode(t, 0)) + 1;
+  luaC_barrierback(L, t, key);
+  lua_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+#else
+
 static Node *getfreepos(Table *t) {
   if (!isdummy(t))
     while (t->lastfree > t->node)
@@ -415,29 +1269,14 @@ static Node *getfreepos(Table *t) {
 }
 
 /*
-** inserts a new key into a hash table; first, check whether key's main
+** inserts a new key into the hash part; first, check whether key's main
 ** position is free. If not, check whether colliding node is in its main
 ** position or not: if it is not, move colliding node to an empty place and
 ** put new key in its main position; otherwise (colliding node is in its main
 ** position), new key goes to an empty position.
 */
-TValue *luaH_newkey(lua_State *L, Table *t, const TValue *key) {
-  Node *mp;
-  TValue aux;
-  if (ttisnil(key))
-    luaG_runerror(L, "table index is nil");
-  else if (ttisfloat(key))
-  {
-    lua_Integer k;
-    if (luaV_tointeger(key, &k, 0))    /* does index fit in an integer? */
-    {
-      setivalue(&aux, k);
-      key = &aux;  /* insert it as an integer */
-    }
-    else if (luai_numisnan(fltvalue(key)))
-      luaG_runerror(L, "table index is NaN");
-  }
-  mp = mainposition(t, key);
+static TValue *newnodekey(lua_State *L, Table *t, const TValue *key) {
+  Node *mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t))    /* main position is taken? */
   {
     Node *othern;
@@ -479,51 +1318,105 @@ TValue *luaH_newkey(lua_State *L, Table *t, const TValue *key) {
   return gval(mp);
 }
 
+#endif
+
+/*
+** inserts a new key into a table (which must not have it yet)
+*/
+TValue *luaH_newkey(lua_State *L, Table *t, const TValue *key) {
+  TValue aux;
+  if (ttisnil(key))
+    luaG_runerror(L, "table index is nil");
+  else if (ttisfloat(key))
+  {
+    lua_Integer k;
+    if (luaV_tointeger(key, &k, 0))    /* does index fit in an integer? */
+    {
+      setivalue(L, &aux, k);
+      key = &aux;  /* insert it as an integer */
+    }
+    else if (luai_numisnan(fltvalue(key)))
+      luaG_runerror(L, "table index is NaN");
+  }
+#if LUA_USE_LAZYINTERN
+  else if (ttisshrstring(key) && istransient(tsvalue(key)))
+  { /* keys are always interned */
+    setsvalue(L, &aux, luaS_intern(L, tsvalue(key)));
+    key = &aux;
+  }
+#endif
+#if LUA_USE_ROPES
+  else if (ttislngstring(key) && isrope(tsvalue(key)))
+  { /* keys are never ropes: insert its flat string */
+    setsvalue(L, &aux, luaS_flatten(L, tsvalue(key)));
+    key = &aux;
+  }
+#endif
+  if (isshaped(t))
+  {
+    TValue *slot = shapenewkey(L, t, key);
+    if (slot != nullptr)
+      return slot;
+    /* else table left shape mode; insert key in its new hash part */
+  }
+  return newnodekey(L, t, key);
+}
+
 /*
 ** search function for integers
 */
 const TValue *luaH_getint(Table *t, lua_Integer key) {
   /* (1 <= key && key <= t->sizearray) */
   if (l_castS2U(key) - 1 < t->sizearray)
-    return &t->array[key - 1];
+    return arrayslot(t, cast(uint32_t, key - 1));
   else
   {
-    Node *n = hashint(t, key);
-    for (;;)    /* check whether 'key' is somewhere in the chain */
-    {
-      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
-        return gval(n); /* that's it */
-      else
-      {
-        int nx = gnext(n);
-        if (nx == 0)
-          break;
-        n += nx;
-      }
-    }
-    return luaO_nilobject;
+    Node *n = findnode(t, hashint(t, key), [key](const TValue *k) {
+      return ttisinteger(k) && ivalue(k) == key;
+    });
+    return (n != nullptr) ? gval(n) : luaO_nilobject;
   }
 }
 
+/* equality test for a short-string key (to be used with 'findnode') */
+#define shrstreq(key) \
+  [key](const TValue *k) { return ttisshrstring(k) && eqshrstr(tsvalue(k), key); }
+
 /*
 ** search function for short strings
 */
 const TValue *luaH_getshortstr(Table *t, TString *key) {
-  Node *n = hashstr(t, key);
   lua_assert(key->type == LuaType::Variant::ShortString);
-  for (;;)    /* check whether 'key' is somewhere in the chain */
+  if (isshaped(t))
   {
-    const TValue *k = gkey(n);
-    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
-      return gval(n); /* that's it */
-    else
-    {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject; /* not found */
-      n += nx;
-    }
+    int slot = shapeindex(t->shape, key);
+    return (slot >= 0) ? &t->slots[slot] : luaO_nilobject;
   }
+  Node *n = findnode(t, hashstr(t, key), shrstreq(key));
+  return (n != nullptr) ? gval(n) : luaO_nilobject;
+}
+
+/*
+** slow path of 'luaH_getshortstrcached': normal search for a short
+** string, remembering in 'fc' where the key was found.
+*/
+const TValue *luaH_getshortstrmiss(Table *t, TString *key, FieldCache *fc) {
+  if (isshaped(t))
+  {
+    int slot = shapeindex(t->shape, key);
+    if (slot < 0)
+      return luaO_nilobject; /* not found */
+    fc->layout = t->shape;
+    fc->index = cast(uint32_t, slot);
+    return &t->slots[slot];
+  }
+  lua_assert(key->type == LuaType::Variant::ShortString);
+  Node *n = findnode(t, hashstr(t, key), shrstreq(key));
+  if (n == nullptr)
+    return luaO_nilobject; /* not found */
+  fc->layout = t->node;
+  fc->index = cast(uint32_t, n - t->node);
+  return gval(n);
 }
 
 /*
@@ -531,19 +1424,10 @@ const TValue *luaH_getshortstr(Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric(Table *t, const TValue *key) {
-  Node *n = mainposition(t, key);
-  for (;;)    /* check whether 'key' is somewhere in the chain */
-  {
-    if (luaV_rawequalobj(gkey(n), key))
-      return gval(n); /* that's it */
-    else
-    {
-      int nx = gnext(n);
-      if (nx == 0)
-        return luaO_nilobject; /* not found */
-      n += nx;
-    }
-  }
+  Node *n = findnode(t, mainposition(t, key), [key](const TValue *k) {
+    return luaV_rawequalobj(k, key);
+  });
+  return (n != nullptr) ? gval(n) : luaO_nilobject;
 }
 
 const TValue *luaH_getstr(Table *t, TString *key) {
@@ -583,6 +1467,7 @@ const TValue *luaH_get(Table *t, const TValue *key) {
 ** barrier and invalidate the TM cache.
 */
 TValue *luaH_set(lua_State *L, Table *t, const TValue *key) {
+  luaS_unrope(L, key);
   const TValue *p = luaH_get(t, key);
   if (p != luaO_nilobject)
     return cast(TValue *, p);
@@ -598,10 +1483,11 @@ void luaH_setint(lua_State *L, Table *t, lua_Integer key, TValue *value) {
   else
   {
     TValue k;
-    setivalue(&k, key);
+    setivalue(L, &k, key);
     cell = luaH_newkey(L, t, &k);
   }
   setobj2t(L, cell, value);
+  luaH_commit(L, t, cell);
 }
 
 static int unbound_search(Table *t, uint32_t j) {
@@ -636,16 +1522,20 @@ static int unbound_search(Table *t, uint32_t j) {
 ** Try to find a boundary in table 't'. A 'boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
 */
-int luaH_getn(Table *t) {
+static int findborder(Table *t) {
   uint32_t j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1]))
+  if (j > 0 && arrayisnil(t, j - 1))
   {
+#if LUA_USE_TYPEDARRAYS
+    if (istyped(t))    /* elements are all at the front? */
+      return cast_int(t->arrayn);
+#endif
     /* there is a boundary in the array part: (binary) search for it */
     uint32_t i = 0;
     while (j - i > 1)
     {
       uint32_t m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1]))
+      if (arrayisnil(t, m - 1))
         j = m;
       else
         i = m;
@@ -659,10 +1549,65 @@ int luaH_getn(Table *t) {
     return unbound_search(t, j);
 }
 
+/*
+** First checks whether the border found last time, or one of its
+** neighbours, is still a border; this makes '#t' constant time for
+** sequences that only grow or shrink at their end (such as in
+** 't[#t + 1] = v'). The hint is checked, not trusted, so stores do
+** not need to maintain it.
+*/
+int luaH_getn(Table *t) {
+  uint32_t j = t->border;
+  if (j == 0 || !ttisnil(luaH_getint(t, j)))    /* t[j] is present? */
+  {
+    if (ttisnil(luaH_getint(t, cast(lua_Integer, j) + 1)))
+      return cast_int(j);
+    if (j < cast(uint32_t, MAX_INT) &&
+        ttisnil(luaH_getint(t, cast(lua_Integer, j) + 2)))
+      return cast_int(t->border = j + 1);  /* sequence grew by one */
+  }
+  else if (j == 1 || !ttisnil(luaH_getint(t, j - 1)))
+    return cast_int(t->border = j - 1);  /* sequence shrank by one */
+  t->border = cast(uint32_t, findborder(t));
+  return cast_int(t->border);
+}
+
+/*
+** Sorts elements 1 to 'n' of 't' if they are all in a typed array part
+** (and, for floats, none of them is NaN, which has no order); returns
+** 0, doing nothing, otherwise.
+*/
+int luaH_sortnumbers(Table *t, uint32_t n) {
+#if LUA_USE_TYPEDARRAYS
+  if (!istyped(t) || n > t->arrayn)
+    return 0;
+  if (t->arraykind == ARRAY_INT)
+    std::sort(t->iarray, t->iarray + n);
+  else
+  {
+    for (uint32_t i = 0; i < n; i++)
+      if (luai_numisnan(t->farray[i]))
+        return 0;
+    std::sort(t->farray, t->farray + n);
+  }
+  return 1;
+#else
+  UNUSED(t); UNUSED(n);
+  return 0;
+#endif
+}
+
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition(const Table *t, const TValue *key) {
+#if LUA_USE_SWISSTABLE
+  return gnode(t, (h1(mainposition(t, key)) & (numgroups(t) - 1)) * GROUPSIZE);
+#elif LUA_USE_ORDEREDTABLES
+  int i = isdummy(t) ? 0 : gbucket(t, mainposition(t, key));
+  return (i != 0) ? gnode(t, i - 1) : nullptr;
+#else
   return mainposition(t, key);
+#endif
 }
 
 int luaH_isdummy(const Table *t) { return isdummy(t); }
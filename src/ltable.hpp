@@ -7,6 +7,60 @@
 
 #include <lobject.hpp>
 
+/*
+** Tables whose hash part only holds short-string keys can use a shape
+** ("hidden class") instead of their own 'node' array: tables that got
+** the same sequence of keys share one 'Shape', which maps each key to
+** a slot of the table's flat 'slots' array. Shapes form a tree of
+** transitions (one key added per step) rooted at 'g->rootshape'.
+** A table leaves shape mode for good (moving its entries to 'node')
+** when it gets any other kind of key in its hash part, more than
+** MAXSHAPEKEYS keys, or when its shape already has too many different
+** transitions ("megamorphic"). The root shape, where every kind of
+** object starts, allows more transitions (MAXROOTCHILDREN), but still
+** a bounded number, so that tables with keys no other table has (as
+** dictionaries) soon stop making shapes.
+** A path of shapes shares one 'ShapeKeys' array, each shape using a
+** prefix of it: a child appends its key to the array of its parent
+** when no other shape did, and otherwise (or when the array is full)
+** gets a copy of its parent's keys, allocated with the child itself.
+** Only the shapes below that child can share its array.
+*/
+#if !defined(LUA_USE_SHAPES)
+#define LUA_USE_SHAPES          1
+#endif
+
+#define MAXSHAPEKEYS            32
+#define MAXSHAPECHILDREN        8
+#define MAXROOTCHILDREN         256
+
+/* key arrays with room for more keys than this have an index */
+#define SHAPESCANKEYS           8
+
+struct ShapeKeys
+{
+  uint32_t n;  /* keys in use (by the longest shape using the array) */
+  uint32_t size;  /* room for keys */
+  TString* key[1];  /* keys, in slot order (then the index) */
+};
+
+struct Shape
+{
+  Shape* parent;  /* shape without the last key (NULL for the root) */
+  Shape* hnext;  /* chain in the transition table ('g->shapes') */
+  ShapeKeys* keys;  /* its keys are the first 'nkeys' of 'keys' */
+  uint32_t nkeys;  /* number of keys (and of used slots) */
+  uint32_t nchildren;  /* number of transitions from this shape */
+  uint32_t refcount;  /* tables and child shapes using this shape */
+  uint32_t keyhash;  /* hash of the last key (which may be already dead) */
+};
+
+/* key of slot 'i' of shape 's' */
+#define shapekey(s, i)          ((s)->keys->key[i])
+
+/* true when 't' keeps its string keys in a shape */
+#define isshaped(t)             ((t)->shape != NULL)
+
 #define gnode(t, i)      (& (t)->node[i])
 #define gval(n)         (& (n)->i_val)
 #define gnext(n)        ((n)->i_key.nk.next)
@@ -22,12 +76,95 @@
 
 #define invalidateTMcache(t)    ((t)->flags = 0)
 
+#if LUA_USE_SWISSTABLE
+
+/*
+** Open-addressing hash part: each position of 'node' has a control
+** byte in 'ctrl' (allocated right after the nodes), either CTRL_EMPTY
+** or the low 7 bits of the hash of the key stored there. Lookups probe
+** groups of GROUPSIZE control bytes at a time; node arrays smaller than
+** a group pad their control bytes with CTRL_SENTINEL.
+*/
+#define GROUPSIZE               16
+#define CTRL_EMPTY              0x80
+#define CTRL_SENTINEL           0xFE
+
+#define ctrlsize(n)             ((n) < GROUPSIZE ? GROUPSIZE : (n))
+
+/* true when 't' is using 'dummynode' as its hash part */
+#define isdummy(t)              ((t)->ctrl == NULL)
+
+/* size in bytes of a hash part with 'n' nodes */
+#define nodeblocksize(n)        (sizeof(Node) * (n) + ctrlsize(n))
+
+#elif LUA_USE_ORDEREDTABLES
+
+/*
+** Ordered hash part: entries are appended to 'node' in insertion order
+** and chained ('gnext' is the index plus one of the next entry, or 0)
+** from an array of buckets allocated right after the nodes.
+*/
+#define gbucket(t, i)           (cast(int *, gnode(t, sizenode(t)))[i])
+
+/* true when 't' is using 'dummynode' as its hash part */
+#define isdummy(t)              ((t)->firstfree == NULL)
+
+/* size in bytes of a hash part with 'n' nodes */
+#define nodeblocksize(n)        ((sizeof(Node) + sizeof(int)) * (n))
+
+#else
+
 /* true when 't' is using 'dummynode' as its hash part */
 #define isdummy(t)              ((t)->lastfree == NULL)
 
+/* size in bytes of a hash part with 'n' nodes */
+#define nodeblocksize(n)        (sizeof(Node) * (n))
+
+#endif
+
+#if LUA_USE_TYPEDARRAYS
+
+/*
+** A typed array part holds raw 'lua_Integer's (ARRAY_INT) or raw
+** 'lua_Number's (ARRAY_FLT): elements 1 to 'arrayn' are present and
+** all the others are nil. Searches return elements of a typed array
+** part through 'proxy'; whoever writes into a slot returned by a
+** search must then call 'luaH_commit', which stores the new value
+** back or, if it does not fit (a value of another type or a nil that
+** would open a hole), converts the array part to TValues (ARRAY_BOXED).
+*/
+#define ARRAY_BOXED             0
+#define ARRAY_INT               1
+#define ARRAY_FLT               2
+
+#define istyped(t)              ((t)->arraykind != ARRAY_BOXED)
+
+#define luaH_commit(L, t, slot) \
+  ((slot) == &(t)->proxy ? luaH_storeproxy(L, t) : cast_void(0))
+
+#else
+
+#define istyped(t)              0
+#define luaH_commit(L, t, slot) cast_void(0)
+
+#endif
+
+/* size in bytes of each element of the array part */
+#define arraycellsize(t) \
+  (istyped(t) ? sizeof(lua_Integer) : sizeof(TValue))
+
+/* number of TValues (that may need marking) in the array part */
+#define boxedsize(t)            (istyped(t) ? 0 : (t)->sizearray)
+
 /* allocated size for hash nodes */
 #define allocsizenode(t)        (isdummy(t) ? 0 : sizenode(t))
 
+/* bytes of a table with the arrays it owns */
+#define sizetable(t) \
+  cast(lu_mem, sizeof(Table) + arraycellsize(t) * (t)->sizearray + \
+               sizeof(TValue) * (t)->sizeslots + \
+               (isdummy(t) ? 0 : nodeblocksize(cast(size_t, sizenode(t)))))
+
 /* returns the key, given the value of a table entry */
 #define keyfromval(v) \
   (gkey(cast(Node *, cast(char *, (v)) - offsetof(Node, i_val))))
@@ -35,18 +172,49 @@
 LUAI_FUNC const TValue *luaH_getint(Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint(lua_State *L, Table *t, lua_Integer key,
                            TValue *value);
+LUAI_FUNC void luaH_storeproxy(lua_State *L, Table *t);
+LUAI_FUNC int luaH_sortnumbers(Table *t, uint32_t n);
 LUAI_FUNC const TValue *luaH_getshortstr(Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getshortstrmiss(Table *t, TString *key,
+                                             FieldCache *fc);
 LUAI_FUNC const TValue *luaH_getstr(Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get(Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey(lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_set(lua_State *L, Table *t, const TValue *key);
 LUAI_FUNC Table *luaH_new(lua_State *L);
+LUAI_FUNC void luaH_initshapes(lua_State *L);
+LUAI_FUNC void luaH_freeshapes(lua_State *L);
+LUAI_FUNC void luaH_releaseshape(lua_State *L, Shape *s);
 LUAI_FUNC void luaH_resize(lua_State *L, Table *t, uint32_t nasize,
                            uint32_t nhsize);
 LUAI_FUNC void luaH_resizearray(lua_State *L, Table *t, uint32_t nasize);
+LUAI_FUNC void luaH_reserve(lua_State *L, Table *t, uint32_t nasize,
+                            uint32_t nhsize);
 LUAI_FUNC int luaH_next(lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn(Table *t);
 
+/*
+** search function for short strings with an inline cache: check the
+** position where 'key' was found last time (only valid while the table
+** keeps the same shape or hash part) before doing a normal search.
+*/
+inline const TValue *luaH_getshortstrcached(Table *t, TString *key,
+                                            FieldCache *fc) {
+  if (isshaped(t))
+  {
+    const Shape *s = t->shape;
+    if (fc->layout == s && fc->index < s->nkeys && shapekey(s, fc->index) == key)
+      return &t->slots[fc->index];  /* cache hit */
+  }
+  else if (fc->layout == t->node && fc->index < cast(uint32_t, sizenode(t)))
+  {
+    Node *n = gnode(t, fc->index);
+    if (ttisshrstring(gkey(n)) && tsvalue(gkey(n)) == key)
+      return gval(n);  /* cache hit */
+  }
+  return luaH_getshortstrmiss(t, key, fc);
+}
+
 #if defined(LUA_DEBUG)
 LUAI_FUNC Node *luaH_mainposition(const Table *t, const TValue *key);
 LUAI_FUNC int luaH_isdummy(const Table *t);
@@ -389,6 +389,8 @@ static int sort(lua_State *L) {
     if (!lua_isnoneornil(L, 2)) /* is there a 2nd argument? */
       luaL_checktype(L, 2, LuaType::Basic::Function); /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
+    if (lua_isnil(L, 2) && lua_istable(L, 1) && lua_sortnumbers(L, 1, n))
+      return 0;  /* numbers sorted in place */
     auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
@@ -82,7 +82,10 @@ const char *luaT_objtypename(lua_State *L, const TValue *o) {
   {
     const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
     if (ttisstring(name)) /* is '__name' a string? */
+    {
+      luaS_flatvalue(L, name);
       return getstr(tsvalue(name)); /* use it as type name */
+    }
   }
   return LuaType::toString(ttnov(o)); /* else use standard type name */
 }
@@ -122,6 +125,17 @@ int luaT_callbinTM(lua_State *L, const TValue *p1, const TValue *p2,
 
 void luaT_trybinTM(lua_State *L, const TValue *p1, const TValue *p2,
                    StkId res, TMS event) {
+#if LUA_USE_ROPES
+  if (event != TM_CONCAT &&
+      ((ttisstring(p1) && !isflat(tsvalue(p1))) ||
+       (ttisstring(p2) && !isflat(tsvalue(p2)))))
+  {  /* ropes are converted to numbers only when flat; try again */
+    luaS_flatvalue(L, p1);
+    luaS_flatvalue(L, p2);
+    luaO_arith(L, cast_int(event - TM_ADD) + LUA_OPADD, p1, p2, res);
+    return;
+  }
+#endif
   if (!luaT_callbinTM(L, p1, p2, res, event))
     switch (event)
     {
@@ -8,6 +8,7 @@
 
 #include <cstdarg>
 #include <cstddef>
+#include <cstdint>
 #include <luaconf.hpp>
 #include <ltype.hpp>
 
@@ -168,6 +169,8 @@ LUA_API void        (lua_pushnil) (lua_State *L);
 LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
+LUA_API void        (lua_pushsubstring) (lua_State *L, int idx, size_t i,
+                                         size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                         va_list argp);
@@ -203,6 +206,9 @@ LUA_API void  (lua_seti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawset) (lua_State *L, int idx);
 LUA_API void  (lua_rawseti) (lua_State *L, int idx, lua_Integer n);
 LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
+LUA_API void  (lua_rawsetn) (lua_State *L, int idx, lua_Integer i, int n);
+LUA_API void  (lua_rawsetpairs) (lua_State *L, int idx, int n);
+LUA_API void  (lua_reservetable) (lua_State *L, int idx, int narr, int nrec);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 LUA_API void  (lua_setuservalue) (lua_State *L, int idx);
 
@@ -246,9 +252,98 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSETPAUSE          6
 #define LUA_GCSETSTEPMUL        7
 #define LUA_GCISRUNNING         9
+#define LUA_GCGEN               10
+#define LUA_GCINC               11
+#define LUA_GCSETMINORMUL       12
+#define LUA_GCSETMAJORMUL       13
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
+/*
+** Statistics of the garbage collector, kept when the library is built
+** with LUA_USE_GCSTATS. Times are in nanoseconds. A cycle ends when the
+** collector goes back to its pause (incremental mode) or at the end of
+** each collection (generational mode). 'statesteps'/'statetime' are
+** indexed by 'gcstate' (see lgc.hpp). A pause is the time the program
+** waits for one GC step or full collection; 'pausehist[i]' counts the
+** pauses shorter than 2^i microseconds (and not counted before), the
+** last entry counting all the longer ones. Per-type counts are indexed
+** by basic type, with LUA_GCSTATPROTO for function prototypes (numbers
+** are the integers boxed by LUA_NANBOXING builds). Their bytes are
+** those of the objects themselves, plus the array and hash parts of
+** tables (as they grow and shrink), but not the arrays of other objects.
+*/
+#define LUA_GCSTATSTATES        8
+#define LUA_GCSTATPROTO         9
+#define LUA_GCSTATTYPES         10
+#define LUA_GCSTATBUCKETS       16
+
+struct lua_GCStats
+{
+  size_t totalbytes;  /* bytes in use */
+  ptrdiff_t debt;  /* bytes allocated not yet paid with GC work */
+  size_t estimate;  /* estimate of the non-garbage bytes */
+  size_t memtrav;  /* bytes traversed by the current cycle */
+  uint64_t cycles;  /* completed cycles */
+  uint64_t minors;  /* minor collections (generational mode) */
+  uint64_t lastcycletime;  /* GC time of the last completed cycle */
+  uint64_t maxcycletime;
+  uint64_t totaltime;  /* total GC time */
+  uint64_t statesteps[LUA_GCSTATSTATES];  /* incremental steps per state */
+  uint64_t statetime[LUA_GCSTATSTATES];
+  uint64_t pauses;  /* number of pauses */
+  uint64_t maxpause;
+  uint64_t pausehist[LUA_GCSTATBUCKETS];
+  uint64_t newobjs[LUA_GCSTATTYPES];  /* objects created */
+  uint64_t newbytes[LUA_GCSTATTYPES];
+  uint64_t freedobjs[LUA_GCSTATTYPES];  /* objects collected */
+  uint64_t freedbytes[LUA_GCSTATTYPES];
+  uint64_t swept;  /* objects visited by sweeps */
+  uint64_t finalizers;  /* finalizers called */
+  uint64_t barriers;  /* forward barriers ('luaC_barrier_') */
+  uint64_t backbarriers;  /* backward barriers ('luaC_barrierback_') */
+};
+
+/* fill 's'; return 0 if the library keeps no statistics */
+LUA_API int (lua_gcstats) (lua_State *L, struct lua_GCStats *s);
+
+/*
+** Memory accounting, kept when the library is built with
+** LUA_USE_MEMACCOUNT. 'lua_memusage' fills 'bytes' (with
+** LUA_MEMCATEGORIES entries) with the bytes in use by each kind of
+** object, walking all of them; LUA_MEMOTHER is everything else (string
+** table, upvalues, buffers, ...). One in LUAI_MEMSAMPLE new objects is
+** sampled with the source line of the innermost running Lua function;
+** 'lua_memsites' calls 'f' for each line with sampled objects alive,
+** in decreasing order of bytes. A site's 'count' and 'bytes' (of the
+** objects with the arrays they own, as they are now) are estimates,
+** scaled by the sampling rate. Both functions return 0 if the library
+** keeps no accounting.
+*/
+#define LUA_MEMTABLE            0  /* table headers */
+#define LUA_MEMARRAY            1  /* array parts of tables */
+#define LUA_MEMNODE             2  /* hash parts (and shape slots) of tables */
+#define LUA_MEMSTRING           3
+#define LUA_MEMCLOSURE          4
+#define LUA_MEMPROTO            5  /* prototypes with their code and constants */
+#define LUA_MEMUSERDATA         6
+#define LUA_MEMSTACK            7  /* threads with their stacks */
+#define LUA_MEMOTHER            8
+#define LUA_MEMCATEGORIES       9
+
+struct lua_MemSite
+{
+  const char *source;  /* as in 'lua_Debug' ("=[C]" if no Lua function ran) */
+  int line;  /* -1 if unknown */
+  size_t count;  /* objects */
+  size_t bytes;
+};
+
+using lua_MemSiteFn = void (*)(void *ud, const struct lua_MemSite *site);
+
+LUA_API int (lua_memusage) (lua_State *L, size_t *bytes);
+LUA_API int (lua_memsites) (lua_State *L, lua_MemSiteFn f, void *ud);
+
 /*
 ** miscellaneous functions
 */
@@ -257,6 +352,7 @@ LUA_API int (lua_gc) (lua_State *L, int what, int data);
 LUA_API void  (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
+LUA_API int   (lua_sortnumbers) (lua_State *L, int idx, lua_Integer n);
 
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
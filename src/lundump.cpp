@@ -15,6 +15,7 @@
 #include <ldebug.hpp>
 #include <ldo.hpp>
 #include <lfunc.hpp>
+#include <lgc.hpp>
 #include <lmem.hpp>
 #include <lobject.hpp>
 #include <lstring.hpp>
@@ -104,12 +105,25 @@ static TString *LoadString(LoadState& S)
   }
 }
 
+/*
+** load a string into a field of prototype 'f'; the reader may run Lua
+** code (and so the collector) while 'f' is being loaded
+*/
+static TString *LoadStringN(LoadState& S, Proto *f)
+{
+  TString *ts = LoadString(S);
+  if (ts != nullptr)
+    luaC_objbarrier(S.L, f, ts);
+  return ts;
+}
+
 static void LoadCode(LoadState& S, Proto *f)
 {
   int n = LoadInt(S);
   f->code = LMem<Instruction>::luaM_newvector(S.L, n);
   f->sizecode = n;
   LoadVector(S, f->code, n);
+  luaF_newfieldcache(S.L, f);
 }
 
 static void LoadFunction(LoadState& S, Proto* f, TString* psource);
@@ -137,11 +151,11 @@ static void LoadConstants(LoadState& S, Proto* f)
         setfltvalue(o, LoadNumber(S));
         break;
       case LuaType::Variant::IntNumber:
-        setivalue(o, LoadInteger(S));
+        setivalue(S.L, o, LoadInteger(S));
         break;
       case LuaType::Variant::ShortString:
       case LuaType::Variant::LongString:
-        setsvalue2n(S.L, o, LoadString(S));
+        setsvalue2n(S.L, o, LoadStringN(S, f));
         break;
       default:
         luaL_error(S.L, "Unknown type: %i.", t.asUnderlying());
@@ -159,6 +173,7 @@ static void LoadProtos(LoadState& S, Proto *f)
   for (int i = 0; i < n; i++)
   {
     f->p[i] = luaF_newproto(S.L);
+    luaC_objbarrier(S.L, f, f->p[i]);
     LoadFunction(S, f->p[i], f->source);
   }
 }
@@ -191,20 +206,23 @@ static void LoadDebug(LoadState& S, Proto *f)
     f->locvars[i].varname = nullptr;
   for (i = 0; i < n; i++)
   {
-    f->locvars[i].varname = LoadString(S);
+    f->locvars[i].varname = LoadStringN(S, f);
     f->locvars[i].startpc = LoadInt(S);
     f->locvars[i].endpc = LoadInt(S);
   }
   n = LoadInt(S);
   for (i = 0; i < n; i++)
-    f->upvalues[i].name = LoadString(S);
+    f->upvalues[i].name = LoadStringN(S, f);
 }
 
 static void LoadFunction(LoadState& S, Proto *f, TString *psource)
 {
-  f->source = LoadString(S);
-  if (f->source == nullptr) /* no source in dump? */
+  f->source = LoadStringN(S, f);
+  if (f->source == nullptr && psource != nullptr) /* no source in dump? */
+  {
     f->source = psource; /* reuse parent's source */
+    luaC_objbarrier(S.L, f, psource);
+  }
   f->linedefined = LoadInt(S);
   f->lastlinedefined = LoadInt(S);
   f->numparams = LoadByte(S);
@@ -267,6 +285,7 @@ LClosure* luaU_undump(lua_State* L, ZIO& Z, const char* name)
   setclLvalue(L, L->top, cl);
   luaD_inctop(L);
   cl->p = luaF_newproto(L);
+  luaC_objbarrier(L, cl, cl->p);
   LoadFunction(S, cl->p, nullptr);
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luai_verifycode(L, buff, cl->p);
@@ -29,6 +29,18 @@
 #include <ltm.hpp>
 #include <lvm.hpp>
 
+/*
+** By default, use jump tables in the main interpreter loop on gcc
+** and compatible compilers (which support "labels as values").
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE       1
+#else
+#define LUA_USE_JUMPTABLE       0
+#endif
+#endif
+
 /* limit for table tag-method chains (to avoid loops) */
 #define MAXTAGLOOP      2000
 
@@ -64,16 +76,18 @@
 ** by the macro 'tonumber'.
 */
 int luaV_tonumber_(const TValue *obj, lua_Number *n) {
-  TValue v;
+  lua_Integer i;
+  int isint;
   if (ttisinteger(obj))
   {
     *n = cast_num(ivalue(obj));
     return 1;
   }
   else if (cvt2num(obj) &&  /* string convertible to number? */
-           luaO_str2num(svalue(obj), &v) == vslen(obj) + 1)
+           luaO_rawstr2num(svalue(obj), &i, n, &isint) == vslen(obj) + 1)
   {
-    *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
+    if (isint)
+      *n = cast_num(i);  /* convert result of 'luaO_rawstr2num' to a float */
     return 1;
   }
   else
@@ -88,6 +102,8 @@ int luaV_tonumber_(const TValue *obj, lua_Number *n) {
 */
 int luaV_tointeger(const TValue *obj, lua_Integer *p, int mode) {
   TValue v;
+  lua_Number num;
+  int isint;
 again:
   if (ttisfloat(obj))
   {
@@ -108,10 +124,13 @@ again:
     return 1;
   }
   else if (cvt2num(obj) &&
-           luaO_str2num(svalue(obj), &v) == vslen(obj) + 1)
+           luaO_rawstr2num(svalue(obj), p, &num, &isint) == vslen(obj) + 1)
   {
+    if (isint)
+      return 1;
+    setfltvalue(&v, num);
     obj = &v;
-    goto again;  /* convert result from 'luaO_str2num' to an integer */
+    goto again;  /* convert result from 'luaO_rawstr2num' to an integer */
   }
   return 0;  /* conversion failed */
 }
@@ -225,6 +244,7 @@ void luaV_finishset(lua_State *L, const TValue *t, TValue *key,
           slot = luaH_newkey(L, h, key); /* create one */
         /* no metamethod and (now) there is an entry with given key */
         setobj2t(L, cast(TValue *, slot), val);  /* set its new value */
+        luaH_commit(L, h, slot);
         invalidateTMcache(h);
         luaC_barrierback(L, h, val);
         return;
@@ -379,7 +399,11 @@ int luaV_lessthan(lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r)) /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r)) /* both are strings? */
+  {
+    luaS_flatvalue(L, l);
+    luaS_flatvalue(L, r);
     return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+  }
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0) /* no metamethod? */
     luaG_ordererror(L, l, r); /* error */
   return res;
@@ -398,7 +422,11 @@ int luaV_lessequal(lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r)) /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r)) /* both are strings? */
+  {
+    luaS_flatvalue(L, l);
+    luaS_flatvalue(L, r);
     return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+  }
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0) /* try 'le' */
     return res;
   else    /* try 'lt': */
@@ -438,7 +466,15 @@ int luaV_equalobj(lua_State *L, const TValue *t1, const TValue *t2) {
     case LuaType::Variant::LightUserData: return pvalue(t1) == pvalue(t2);
     case LuaType::Variant::LightCFunction: return fvalue(t1) == fvalue(t2);
     case LuaType::Variant::ShortString: return eqshrstr(tsvalue(t1), tsvalue(t2));
-    case LuaType::Variant::LongString: return luaS_eqlngstr(tsvalue(t1), tsvalue(t2));
+    case LuaType::Variant::LongString:
+    {
+      if (L != nullptr && vslen(t1) == vslen(t2))
+      {  /* may have to compare contents (raw callers pass no ropes) */
+        luaS_unrope(L, t1);
+        luaS_unrope(L, t2);
+      }
+      return luaS_eqlngstr(tsvalue(t1), tsvalue(t2));
+    }
     case LuaType::Variant::UserData:
     {
       if (uvalue(t1) == uvalue(t2))
@@ -516,13 +552,25 @@ void luaV_concat(lua_State *L, int total) {
         size_t l = vslen(top - n - 1);
         if (l >= (MAX_SIZE/sizeof(char)) - tl)
           luaG_runerror(L, "string length overflow");
+#if LUA_USE_ROPES
+        if (tl + l >= ROPEMINLEN)    /* too long to copy? */
+          break;
+#endif
         tl += l;
       }
+#if LUA_USE_ROPES
+      if (n == 1)    /* concat only the last two strings, into a rope */
+      {
+        ts = luaS_concat(L, top - 2);
+        n = 2;
+      }
+      else
+#endif
       if (tl <= LUAI_MAXSHORTLEN)    /* is result a short string? */
       {
         char buff[LUAI_MAXSHORTLEN];
         copy2buff(top, n, buff);  /* copy strings to buffer */
-        ts = luaS_newlstr(L, buff, tl);
+        ts = luaS_newtransient(L, buff, tl);
       }
       else    /* long string; copy strings directly to final result */
       {
@@ -549,17 +597,17 @@ void luaV_objlen(lua_State *L, StkId ra, const TValue *rb) {
       tm = fasttm(L, h->metatable, TM_LEN);
       if (tm)
         break; /* metamethod? break switch to call it */
-      setivalue(ra, luaH_getn(h));  /* else primitive len */
+      setivalue(L, ra, luaH_getn(h));  /* else primitive len */
       return;
     }
     case LuaType::Variant::ShortString:
     {
-      setivalue(ra, tsvalue(rb)->shrlen);
+      setivalue(L, ra, tsvalue(rb)->shrlen);
       return;
     }
     case LuaType::Variant::LongString:
     {
-      setivalue(ra, tsvalue(rb)->u.lnglen);
+      setivalue(L, ra, tsvalue(rb)->u.lnglen);
       return;
     }
     default:
@@ -665,7 +713,8 @@ static LClosure *getcached(Proto *p, UpVal **encup, StkId base) {
 ** create a new Lua closure, push it in the stack, and initialize
 ** its upvalues. Note that the closure is not cached if prototype is
 ** already black (which means that 'cache' was already cleared by the
-** GC).
+** GC), unless the collector is generational: old prototypes stay black
+** between cycles, so a barrier makes the next cycles check the cache.
 */
 static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
                         StkId ra) {
@@ -686,6 +735,11 @@ static void pushclosure(lua_State *L, Proto *p, UpVal **encup, StkId base,
   }
   if (!isblack(p)) /* cache will not break GC invariant? */
     p->cache = ncl; /* save it on cache for reuse */
+  else if (L->globalState->gckind == KGC_GEN)
+  {
+    p->cache = ncl;
+    luaC_protobarrier_(L, p);
+  }
 }
 
 /*
@@ -785,6 +839,20 @@ void luaV_finishOp(lua_State *L) {
                 Protect(L->top = ci->top));  /* restore top */ \
     luai_threadyield(L); }
 
+/*
+** an integer 'x' that needs a box (see LUA_NANBOXING) makes a new
+** object, so it may call for a collection step; all registers stay
+** alive
+*/
+#if LUA_NANBOXING
+#define checkintGC(L, x)  { if (l_unlikely(!nbfitsint(x))) checkGC(L, ci->top); }
+#else
+#define checkintGC(L, x)  { }
+#endif
+
+#define setivalueGC(L, o, x)  \
+  { lua_Integer iv_ = (x); setivalue(L, o, iv_); checkintGC(L, iv_); }
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()       { \
     i = *(ci->u.l.savedpc++); \
@@ -804,19 +872,63 @@ void luaV_finishOp(lua_State *L) {
 ** metamethod (which can reallocate the stack)
 */
 #define gettableProtected(L, t, k, v)  { const TValue *slot; \
+                                         luaS_unrope(L, k); \
                                          if (luaV_fastget(L, t, k, slot, luaH_get)) { setobj2s(L, v, slot); } \
                                          else Protect(luaV_finishget(L, t, k, v, slot)); }
 
 /* same for 'luaV_settable' */
 #define settableProtected(L, t, k, v) { const TValue *slot; \
+                                        luaS_unrope(L, k); \
                                         if (!luaV_fastset(L, t, k, slot, luaH_get, v)) \
                                           Protect(luaV_finishset(L, t, k, v, slot)); }
 
+#if LUA_USE_JUMPTABLE
+/* labels as values and computed gotos are GNU extensions */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+** Versions of 'gettableProtected'/'settableProtected' for keys that are
+** constant short strings: the lookup goes through the inline cache of
+** the current instruction ('luaH_getshortstrcached').
+*/
+#define fieldcache()    (cl->p->fieldcache + pcRel(ci->u.l.savedpc, cl->p))
+
+#define luaV_fastgetcached(L, t, k, slot) \
+  (!ttistable(t)  \
+   ? (slot = NULL, 0)  \
+   : (slot = luaH_getshortstrcached(hvalue(t), tsvalue(k), fieldcache()),  \
+      !ttisnil(slot)))
+
+#define luaV_fastsetcached(L, t, k, slot, v) \
+  (!ttistable(t) \
+   ? (slot = NULL, 0) \
+   : (slot = luaH_getshortstrcached(hvalue(t), tsvalue(k), fieldcache()), \
+      ttisnil(slot) ? 0 \
+      : (luaC_barrierback(L, hvalue(t), v), \
+         setobj2t(L, cast(TValue *, slot), v), \
+         1)))
+
+#define gettableCached(L, t, k, v)  { const TValue *slot; \
+                                      if (luaV_fastgetcached(L, t, k, slot)) { setobj2s(L, v, slot); } \
+                                      else Protect(luaV_finishget(L, t, k, v, slot)); }
+
+#define settableCached(L, t, k, v) { const TValue *slot; \
+                                     if (!luaV_fastsetcached(L, t, k, slot, v)) \
+                                       Protect(luaV_finishset(L, t, k, v, slot)); }
+
+/* true if argument 'x' of instruction 'i' is a constant short string */
+#define isKshrstr(x, rk)        (ISK(GETARG_##x(i)) && ttisshrstring(rk))
+
 void luaV_execute(lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include <ljumptab.hpp>
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
 newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
@@ -868,20 +980,41 @@ newframe:  /* reentry point when frame changes (call/return) */
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        if (isKshrstr(C, rc))
+        {
+          gettableCached(L, upval, rc, ra);
+        }
+        else
+        {
+          gettableProtected(L, upval, rc, ra);
+        }
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        if (isKshrstr(C, rc))
+        {
+          gettableCached(L, rb, rc, ra);
+        }
+        else
+        {
+          gettableProtected(L, rb, rc, ra);
+        }
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
         TValue *upval = cl->upvals[GETARG_A(i)]->v;
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, upval, rb, rc);
+        if (isKshrstr(B, rb))
+        {
+          settableCached(L, upval, rb, rc);
+        }
+        else
+        {
+          settableProtected(L, upval, rb, rc);
+        }
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
@@ -893,7 +1026,14 @@ newframe:  /* reentry point when frame changes (call/return) */
       vmcase(OP_SETTABLE) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, ra, rb, rc);
+        if (isKshrstr(B, rb))
+        {
+          settableCached(L, ra, rb, rc);
+        }
+        else
+        {
+          settableProtected(L, ra, rb, rc);
+        }
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -912,7 +1052,8 @@ newframe:  /* reentry point when frame changes (call/return) */
         TValue *rc = RKC(i);
         TString *key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
-        if (luaV_fastget(L, rb, key, aux, luaH_getstr))
+        if (isKshrstr(C, rc) ? luaV_fastgetcached(L, rb, rc, aux)
+                             : luaV_fastget(L, rb, key, aux, luaH_getstr))
         {
           setobj2s(L, ra, aux);
         }
@@ -927,7 +1068,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb) && ttisinteger(rc))
         {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(+, ib, ic));
+          setivalueGC(L, ra, intop(+, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc))
         {
@@ -944,7 +1085,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb) && ttisinteger(rc))
         {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(-, ib, ic));
+          setivalueGC(L, ra, intop(-, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc))
         {
@@ -961,7 +1102,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb) && ttisinteger(rc))
         {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(*, ib, ic));
+          setivalueGC(L, ra, intop(*, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc))
         {
@@ -989,7 +1130,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic))
         {
-          setivalue(ra, intop(&, ib, ic));
+          setivalueGC(L, ra, intop(&, ib, ic));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_BAND));
@@ -1001,7 +1142,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic))
         {
-          setivalue(ra, intop(|, ib, ic));
+          setivalueGC(L, ra, intop(|, ib, ic));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_BOR));
@@ -1013,7 +1154,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic))
         {
-          setivalue(ra, intop(^, ib, ic));
+          setivalueGC(L, ra, intop(^, ib, ic));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_BXOR));
@@ -1025,7 +1166,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic))
         {
-          setivalue(ra, luaV_shiftl(ib, ic));
+          setivalueGC(L, ra, luaV_shiftl(ib, ic));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHL));
@@ -1037,7 +1178,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib; lua_Integer ic;
         if (tointeger(rb, &ib) && tointeger(rc, &ic))
         {
-          setivalue(ra, luaV_shiftl(ib, -ic));
+          setivalueGC(L, ra, luaV_shiftl(ib, -ic));
         }
         else
           Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHR));
@@ -1050,7 +1191,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb) && ttisinteger(rc))
         {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, luaV_mod(L, ib, ic));
+          setivalueGC(L, ra, luaV_mod(L, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc))
         {
@@ -1069,7 +1210,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb) && ttisinteger(rc))
         {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, luaV_div(L, ib, ic));
+          setivalueGC(L, ra, luaV_div(L, ib, ic));
         }
         else if (tonumber(rb, &nb) && tonumber(rc, &nc))
         {
@@ -1097,7 +1238,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         if (ttisinteger(rb))
         {
           lua_Integer ib = ivalue(rb);
-          setivalue(ra, intop(-, 0, ib));
+          setivalueGC(L, ra, intop(-, 0, ib));
         }
         else if (tonumber(rb, &nb))
         {
@@ -1112,7 +1253,7 @@ newframe:  /* reentry point when frame changes (call/return) */
         lua_Integer ib;
         if (tointeger(rb, &ib))
         {
-          setivalue(ra, intop(^, ~l_castS2U(0), ib));
+          setivalueGC(L, ra, intop(^, ~l_castS2U(0), ib));
         }
         else
           Protect(luaT_trybinTM(L, rb, rb, ra, TM_BNOT));
@@ -1271,8 +1412,9 @@ newframe:  /* reentry point when frame changes (call/return) */
           if ((0 < step) ? (idx <= limit) : (limit <= idx))
           {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
-            chgivalue(ra, idx);  /* update internal index... */
-            setivalue(ra + 3, idx);  /* ...and external index */
+            setivalue(L, ra, idx);  /* update internal index... */
+            setobjs2s(L, ra + 3, ra);  /* ...and external index */
+            checkintGC(L, idx);
           }
         }
         else    /* floating loop */
@@ -1296,13 +1438,18 @@ newframe:  /* reentry point when frame changes (call/return) */
         TValue *pstep = ra + 2;
         lua_Integer ilimit;
         int stopnow;
+        luaS_flatvalue(L, init);  /* strings must be flat to convert */
+        luaS_flatvalue(L, plimit);
+        luaS_flatvalue(L, pstep);
         if (ttisinteger(init) && ttisinteger(pstep) &&
             forlimit(plimit, &ilimit, ivalue(pstep), &stopnow))
         {
           /* all values are integer */
-          lua_Integer initv = (stopnow ? 0 : ivalue(init));
-          setivalue(plimit, ilimit);
-          setivalue(init, intop(-, initv, ivalue(pstep)));
+          lua_Integer initv = intop(-, (stopnow ? 0 : ivalue(init)), ivalue(pstep));
+          setivalue(L, plimit, ilimit);
+          setivalue(L, init, initv);
+          checkintGC(L, ilimit);
+          checkintGC(L, initv);
         }
         else    /* try making all values floats */
         {
@@ -1358,10 +1505,13 @@ l_tforloop:
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
         if (last > h->sizearray) /* needs more space? */
           luaH_resizearray(L, h, last); /* preallocate it at once */
-        for (; n > 0; n--)
+        h->border = last;  /* likely the length of the new sequence */
+        last -= n;
+        /* store in ascending order (which a typed array part can take) */
+        for (int j = 1; j <= n; j++)
         {
-          TValue *val = ra+n;
-          luaH_setint(L, h, last--, val);
+          TValue *val = ra+j;
+          luaH_setint(L, h, last + j, val);
           luaC_barrierback(L, h, val);
         }
         L->top = ci->top;  /* correct top (in case of previous open call) */
@@ -1404,4 +1554,8 @@ l_tforloop:
   }
 }
 
+#if LUA_USE_JUMPTABLE
+#pragma GCC diagnostic pop
+#endif
+
 /* }================================================================== */
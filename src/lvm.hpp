@@ -7,6 +7,8 @@
 
 #include <ldo.hpp>
 #include <lobject.hpp>
+#include <lstring.hpp>
+#include <ltable.hpp>
 #include <ltm.hpp>
 
 #if !defined(LUA_NOCVTN2S)
@@ -15,8 +17,12 @@
 #define cvt2str(o)      0       /* no conversion from numbers to strings */
 #endif
 
+/*
+** (A rope not flattened yet does not convert: the operations that need
+** that conversion end in 'luaT_trybinTM', which flattens it and retries.)
+*/
 #if !defined(LUA_NOCVTS2N)
-#define cvt2num(o)      ttisstring(o)
+#define cvt2num(o)      (ttisstring(o) && isflat(tsvalue(o)))
 #else
 #define cvt2num(o)      0       /* no conversion from strings to numbers */
 #endif
@@ -57,6 +63,7 @@
 ** standard implementation for 'gettable'
 */
 #define luaV_gettable(L, t, k, v) { const TValue *slot; \
+                                    luaS_unrope(L, k); \
                                     if (luaV_fastget(L, t, k, slot, luaH_get)) { setobj2s(L, v, slot); } \
                                     else luaV_finishget(L, t, k, v, slot); }
 
@@ -75,9 +82,11 @@
       ttisnil(slot) ? 0 \
       : (luaC_barrierback(L, hvalue(t), v), \
          setobj2t(L, cast(TValue *, slot), v), \
+         luaH_commit(L, hvalue(t), slot), \
          1)))
 
 #define luaV_settable(L, t, k, v) { const TValue *slot; \
+                                    luaS_unrope(L, k); \
                                     if (!luaV_fastset(L, t, k, slot, luaH_get, v)) \
                                       luaV_finishset(L, t, k, v, slot); }
 
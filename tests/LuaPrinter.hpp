@@ -24,6 +24,7 @@ public:
 
   const std::vector<std::string>& getLines() const { return this->lines; }
   const std::string& getLastLine() const;
+  lua_State* getState() const { return this->L; }
 
   LuaPrinter& operator=(const LuaPrinter&) = delete;
   LuaPrinter& operator=(LuaPrinter&&) = delete;
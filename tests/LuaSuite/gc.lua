@@ -7,6 +7,9 @@ local debug = require"debug"
 
 collectgarbage()
 
+-- these tests are for the incremental collector (see gengc.lua)
+local oldmode = collectgarbage("incremental")
+
 assert(collectgarbage("isrunning"))
 
 local function gcinfo () return collectgarbage"count" * 1024 end
@@ -621,4 +624,6 @@ end
 -- just to make sure
 assert(collectgarbage'isrunning')
 
+collectgarbage(oldmode)
+
 print('OK')
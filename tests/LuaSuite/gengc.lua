@@ -0,0 +1,111 @@
+-- tests for the generational mode of the collector
+
+print('testing generational garbage collection')
+
+local oldmode = collectgarbage("generational")
+assert(collectgarbage("generational") == "generational")
+assert(collectgarbage("incremental") == "generational")
+assert(collectgarbage("incremental") == "incremental")
+collectgarbage("generational")
+
+
+-- a young object created inside an old table must survive minor
+-- collections (back barrier on tables)
+do
+  local U = {}
+  collectgarbage()       -- U is old now
+  collectgarbage("step")   -- a minor collection
+  U[1] = {x = {234}}     -- a young object into an old table
+  collectgarbage("step")
+  collectgarbage("step")
+  assert(U[1].x[1] == 234)
+  collectgarbage()
+  assert(U[1].x[1] == 234)
+
+  -- the same with many values, to force a resize of the old table
+  for i = 2, 1000 do U[i] = {i} end
+  for i = 1, 5 do collectgarbage("step") end
+  for i = 2, 1000 do assert(U[i][1] == i) end
+end
+
+
+-- a young value into an upvalue of an old closure (barrier on upvalues)
+do
+  local upval = {}
+  local function f () return upval end
+  collectgarbage()       -- f and upval are old now
+  upval = {"young"}
+  for i = 1, 3 do collectgarbage("step") end
+  assert(f()[1] == "young")
+end
+
+
+-- a young closure cached in an old prototype
+do
+  local function mk () return function () return 10 end end
+  collectgarbage()       -- mk and its prototypes are old
+  local f = mk()         -- a young closure, cached in the old prototype
+  for i = 1, 3 do collectgarbage("step") end
+  assert(f() == 10)
+  local g = mk()
+  assert(mk() == g)      -- cached again (the collector may drop the cache)
+  f = nil; g = nil
+  for i = 1, 3 do collectgarbage("step") end
+  assert(mk()() == 10)   -- no dangling cache
+  collectgarbage()
+  assert(mk()() == 10)
+end
+
+
+-- weak tables are cleared by full collections
+do
+  local k = setmetatable({}, {__mode = "k"})
+  local v = setmetatable({}, {__mode = "v"})
+  collectgarbage()       -- both tables are old
+  for i = 1, 100 do
+    k[{}] = i
+    v[i] = {}
+  end
+  collectgarbage()
+  assert(next(k) == nil and next(v) == nil)
+end
+
+
+-- finalizers run in both kinds of collections
+do
+  local count = 0
+  for i = 1, 10 do setmetatable({}, {__gc = function () count = count + 1 end}) end
+  collectgarbage()
+  assert(count == 10)
+  local done = false
+  setmetatable({}, {__gc = function () done = true end})
+  for i = 1, 10 do
+    if done then break end
+    collectgarbage("step")
+  end
+  collectgarbage()
+  assert(done)
+end
+
+
+-- stress the barriers: old structures linked to lots of young objects
+do
+  local root = {}
+  collectgarbage()
+  local function add (t, n)
+    for i = 1, n do t[#t + 1] = {val = i, str = "s" .. i} end
+  end
+  for round = 1, 20 do
+    add(root, 200)
+    if round % 5 == 0 then collectgarbage() end
+  end
+  for i = 1, #root do
+    local e = root[i]
+    assert(e.str == "s" .. e.val)
+  end
+end
+
+
+collectgarbage(oldmode)
+
+print('OK')
@@ -1,3 +1,4 @@
+#include <limits>  // cxxopts uses std::numeric_limits without including it
 #include <cxxopts/cxxopts.hpp>
 #include <StringUtil.hpp>
 #include <Test.h>
@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <LuaPrinter.hpp>
+#include <lstate.hpp>
+#include <lua.hpp>
+#include <UnitTest++.h>
+
+namespace
+{
+#if LUA_USE_GCSTATS
+  // bytes of tables created minus bytes of tables freed
+  uint64_t liveTableBytes(lua_State* L)
+  {
+    lua_GCStats s;
+    lua_gcstats(L, &s);
+    return s.newbytes[int(LuaType::Basic::Table)] - s.freedbytes[int(LuaType::Basic::Table)];
+  }
+#endif
+}
+
+SUITE(GCStats)
+{
+  TEST(GetStats)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    lua_GCStats s;
+
+#if LUA_USE_GCSTATS
+    CHECK_EQUAL(1, lua_gcstats(L, &s));
+    const uint64_t cycles = s.cycles;
+    const uint64_t pauses = s.pauses;
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_gcstats(L, &s);
+    CHECK(s.cycles > cycles);
+    CHECK(s.pauses > pauses);
+    CHECK(s.totaltime >= s.maxpause);
+    const size_t total = static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    CHECK_EQUAL(total, s.totalbytes);
+    uint64_t histogram = 0;
+    for (uint64_t n: s.pausehist)
+      histogram += n;
+    CHECK_EQUAL(s.pauses, histogram);
+#else
+    CHECK_EQUAL(0, lua_gcstats(L, &s));
+#endif
+  }
+
+#if LUA_USE_GCSTATS
+  TEST(TableBytes)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    const uint64_t before = liveTableBytes(L);
+    lua_newtable(L);
+    for (lua_Integer i = 1; i <= 1000; ++i)
+    {
+      lua_pushinteger(L, i);
+      lua_rawseti(L, 1, i);
+      lua_pushinteger(L, i);
+      lua_setfield(L, 1, lua_tostring(L, -1));  // grows the hash part
+    }
+    CHECK(liveTableBytes(L) >= before + 2000 * sizeof(lua_Integer));
+
+    // freeing the table gives back all that it grew by
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    CHECK_EQUAL(before, liveTableBytes(L));
+  }
+#endif
+
+  TEST(StatsFromLua)
+  {
+    LuaPrinter printer;
+
+#if LUA_USE_GCSTATS
+    CHECK_EQUAL(printer.runCommand("type(collectgarbage('stats'))"), "table");
+    printer.scriptCommand("collectgarbage()");
+    printer.scriptCommand("s = collectgarbage('stats')");
+    CHECK_EQUAL(printer.runCommand("s.cycles > 0 and s.pauses > 0"), "true");
+    CHECK_EQUAL(printer.runCommand("#s.pausehist"), "16");
+    CHECK_EQUAL(printer.runCommand("s.states.pause.steps > 0"), "true");
+    CHECK_EQUAL(printer.runCommand("s.types.table.newbytes >= s.types.table.freedbytes"), "true");
+    CHECK_EQUAL(printer.runCommand("s.types.proto.new > 0"), "true");
+    CHECK_EQUAL(printer.runCommand("s.types.boolean"), "nil");
+#else
+    CHECK_EQUAL(printer.runCommand("collectgarbage('stats')"), "nil");
+#endif
+    CHECK_EQUAL(printer.runCommand("select(2, pcall(collectgarbage, 'statistics')):match('invalid option')"),
+                "invalid option");
+    CHECK_EQUAL(printer.runCommand("select(2, pcall(collectgarbage, {})):match('string expected')"),
+                "string expected");
+  }
+}
@@ -0,0 +1,48 @@
+#include <lauxlib.hpp>
+#include <lstate.hpp>
+#include <lua.hpp>
+#include <lualib.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  // the files of tests/LuaSuite that run without the test library or a terminal
+  const char* const suiteFiles[] = {
+    "api.lua", "calls.lua", "closure.lua", "code.lua", "constructs.lua",
+    "coroutine.lua", "db.lua", "errors.lua", "events.lua", "gc.lua",
+    "goto.lua", "literals.lua", "nextvar.lua", "pm.lua", "sort.lua",
+    "tpack.lua", "utf8.lua", "vararg.lua", "verybig.lua", "gengc.lua"
+  };
+
+  // Runs 'prelude' and then a file of the suite in a new state, returning
+  // the error message, if any.
+  std::string runSuiteFile(const char* prelude, const char* name)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    luaL_openlibs(L);
+    const std::string path = std::string(LUA_SUITE_DIR) + "/" + name;
+    if (luaL_dostring(L, prelude) || luaL_dofile(L, path.c_str()))
+    {
+      const char* message = lua_tostring(L, -1);
+      return std::string(name) + ": " + (message ? message : "(error object is not a string)");
+    }
+    return std::string();
+  }
+}
+
+SUITE(LuaSuite)
+{
+  TEST(Incremental)
+  {
+    for (const char* name: suiteFiles)
+      CHECK_EQUAL("", runSuiteFile("collectgarbage('incremental')", name));
+  }
+
+  TEST(Generational)
+  {
+    for (const char* name: suiteFiles)
+      CHECK_EQUAL("", runSuiteFile("collectgarbage('generational')", name));
+  }
+}
@@ -0,0 +1,132 @@
+#include <cstring>
+#include <lauxlib.hpp>
+#include <LuaPrinter.hpp>
+#include <lstate.hpp>
+#include <lua.hpp>
+#include <string>
+#include <UnitTest++.h>
+#include <vector>
+
+namespace
+{
+  struct Site
+  {
+    std::string source;
+    int32_t line;
+    size_t count;
+    size_t bytes;
+  };
+
+  void addSite(void* ud, const lua_MemSite* site)
+  {
+    static_cast<std::vector<Site>*>(ud)->push_back({site->source, site->line, site->count, site->bytes});
+  }
+
+#if LUA_USE_MEMACCOUNT
+  size_t totalBytes(lua_State* L)
+  {
+    return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+  }
+
+  // 100000 tables created at line 3 of chunk "=sites"
+  const char* const sitesChunk =
+    "local t = {}\n"
+    "for i = 1, 100000 do\n"
+    "  t[i] = {}\n"
+    "end\n"
+    "return t\n";
+#endif
+}
+
+SUITE(MemAccount)
+{
+  TEST(MemUsage)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    size_t bytes[LUA_MEMCATEGORIES];
+
+#if LUA_USE_MEMACCOUNT
+    CHECK_EQUAL(1, lua_memusage(L, bytes));
+    size_t total = 0;
+    for (size_t b: bytes)
+      total += b;
+    CHECK_EQUAL(totalBytes(L), total);
+
+    const size_t arrays = bytes[LUA_MEMARRAY];
+    const size_t strings = bytes[LUA_MEMSTRING];
+    lua_newtable(L);
+    for (lua_Integer i = 1; i <= 1000; ++i)
+    {
+      lua_pushinteger(L, i);
+      lua_rawseti(L, 1, i);
+    }
+    const std::string text(1000, 'x');
+    for (int32_t i = 0; i < 100; ++i)
+      lua_pushfstring(L, "%d%s", i, text.c_str());
+    lua_memusage(L, bytes);
+    CHECK(bytes[LUA_MEMARRAY] >= arrays + 1000 * sizeof(lua_Integer));
+    CHECK(bytes[LUA_MEMSTRING] >= strings + 100 * text.size());
+    CHECK(bytes[LUA_MEMTABLE] > 0);
+    CHECK(bytes[LUA_MEMSTACK] > 0);
+
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_memusage(L, bytes);
+    CHECK_EQUAL(arrays, bytes[LUA_MEMARRAY]);
+#else
+    CHECK_EQUAL(0, lua_memusage(L, bytes));
+#endif
+  }
+
+  TEST(MemSites)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    std::vector<Site> sites;
+
+#if LUA_USE_MEMACCOUNT
+    CHECK_EQUAL(LUA_OK, luaL_loadbuffer(L, sitesChunk, strlen(sitesChunk), "=sites"));
+    CHECK_EQUAL(LUA_OK, lua_pcall(L, 0, 1, 0));
+    CHECK_EQUAL(1, lua_memsites(L, addSite, &sites));
+    CHECK(!sites.empty());
+    for (size_t i = 1; i < sites.size(); ++i)
+      CHECK(sites[i - 1].bytes >= sites[i].bytes);  // decreasing bytes
+    // the estimates are scaled samples: only check the order of magnitude
+    CHECK_EQUAL("=sites", sites[0].source);
+    CHECK_EQUAL(3, sites[0].line);
+    CHECK(sites[0].count > 50000 && sites[0].count < 200000);
+    CHECK(sites[0].bytes >= sites[0].count * sizeof(Table) / 2);
+
+    // dead objects leave their sites
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    sites.clear();
+    lua_memsites(L, addSite, &sites);
+    for (const Site& site: sites)
+      CHECK(site.source != "=sites" || site.line != 3);
+#else
+    CHECK_EQUAL(0, lua_memsites(L, addSite, &sites));
+    CHECK(sites.empty());
+#endif
+  }
+
+  TEST(MemoryFromLua)
+  {
+    LuaPrinter printer;
+
+#if LUA_USE_MEMACCOUNT
+    printer.scriptCommand("m = collectgarbage('memory')");
+    CHECK_EQUAL(printer.runCommand("type(m.sites)"), "table");
+    CHECK_EQUAL(printer.runCommand("m.table > 0 and m.string > 0 and m.closure > 0 and m.proto > 0"), "true");
+    CHECK_EQUAL(printer.runCommand("m.stack > 0 and m.other >= 0 and m.array >= 0 and m.node >= 0"), "true");
+    printer.scriptCommand("keep = {} for i = 1, 20000 do keep[i] = {i} end");
+    printer.scriptCommand("m = collectgarbage('memory')");
+    CHECK_EQUAL(printer.runCommand("#m.sites > 0 and m.sites[1].count > 0 and m.sites[1].bytes > 0"), "true");
+    CHECK_EQUAL(printer.runCommand("math.type(m.sites[1].line)"), "integer");
+    CHECK_EQUAL(printer.runCommand("type(m.sites[1].source)"), "string");
+#else
+    CHECK_EQUAL(printer.runCommand("collectgarbage('memory')"), "nil");
+#endif
+  }
+}
@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <lnumconv.hpp>
+#include <LuaPrinter.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  // xorshift64*, so that runs are reproducible
+  class Random
+  {
+  public:
+    uint64_t next()
+    {
+      this->state ^= this->state >> 12;
+      this->state ^= this->state << 25;
+      this->state ^= this->state >> 27;
+      return this->state * 2685821657736338717ull;
+    }
+
+    // finite doubles spread over all exponents, and decimal fractions
+    // (which are often close to the rounding ties of printf)
+    double nextDouble()
+    {
+      const uint64_t r = this->next();
+      double x;
+      if (r % 4 == 0)
+        return static_cast<double>(static_cast<int64_t>(r >> 40) - (1 << 23)) / 1000.0;
+      do
+      {
+        const uint64_t bits = this->next();
+        memcpy(&x, &bits, sizeof(x));
+      } while (x != x || x - x != 0);  // nan or inf
+      return x;
+    }
+
+  private:
+    uint64_t state = 88172645463325252ull;
+  };
+
+  // number of significant digits of a numeral written by 'g'
+  int32_t significantDigits(const char* s)
+  {
+    std::string digits;
+    for (; *s && *s != 'e'; ++s)
+      if (*s >= '0' && *s <= '9')
+        digits += *s;
+    const size_t first = digits.find_first_not_of('0');
+    if (first == std::string::npos)
+      return 1;
+    const size_t last = digits.find_last_not_of('0');
+    return static_cast<int32_t>(last - first + 1);
+  }
+
+  // Does a numeral with 'digits' significant digits read back as 'x'?
+  // Only the nearest one and its two neighbors can.
+  bool readsBackShorter(double x, int32_t digits)
+  {
+    if (digits < 1)
+      return false;
+    char numeral[64];
+    snprintf(numeral, sizeof(numeral), "%.*e", digits - 1, x);
+    char* exponent = strchr(numeral, 'e');
+    const int32_t e = atoi(exponent + 1) - (digits - 1);
+    *exponent = '\0';
+    std::string mantissa(numeral);
+    mantissa.erase(std::remove(mantissa.begin(), mantissa.end(), '.'), mantissa.end());
+    const long long nearest = atoll(mantissa.c_str());
+    for (long long m = nearest - 1; m <= nearest + 1; ++m)
+    {
+      snprintf(numeral, sizeof(numeral), "%llde%d", m, e);
+      if (strtod(numeral, nullptr) == x)
+        return true;
+    }
+    return false;
+  }
+}
+
+SUITE(NumberConversion)
+{
+  TEST(IntegerToString)
+  {
+    const lua_Integer values[] = {
+      0, 1, -1, 9, 10, 99, 100, -100, 12345678, 1000000007,
+      std::numeric_limits<lua_Integer>::max(), std::numeric_limits<lua_Integer>::min()
+    };
+    char buff[LUAI_MAXINT2STR];
+    char expected[LUAI_MAXINT2STR];
+    for (lua_Integer n: values)
+    {
+      const int32_t len = luai_int2str(buff, n);
+      snprintf(expected, sizeof(expected), "%lld", static_cast<long long>(n));
+      CHECK_EQUAL(expected, buff);
+      CHECK_EQUAL(static_cast<int32_t>(strlen(expected)), len);
+    }
+  }
+
+  TEST(FloatFormatsMatchSnprintf)
+  {
+    static const char convs[] = {'e', 'f', 'g'};
+    Random random;
+    char buff[400];
+    char expected[400];
+    char format[16];
+    int32_t exact = 0;
+    for (int32_t i = 0; i < 20000; ++i)
+    {
+      const double x = random.nextDouble();
+      for (char conv: convs)
+        for (int32_t prec = 0; prec <= 15; ++prec)
+        {
+          if (luai_flt2str(buff, x, prec, conv, '.') < 0)
+            continue;  // left to snprintf
+          snprintf(format, sizeof(format), "%%.%d%c", prec, conv);
+          snprintf(expected, sizeof(expected), format, x);
+          CHECK_EQUAL(expected, buff);
+          ++exact;
+        }
+    }
+    CHECK(exact > 20000 * 3 * 16 / 2);  // most conversions are done here
+  }
+
+  TEST(ShortestFloatsRoundTrip)
+  {
+    Random random;
+    char buff[LUAI_MAXNUM2STR];
+    for (int32_t i = 0; i < 100000; ++i)
+    {
+      const double x = random.nextDouble();
+      CHECK(luai_flt2str(buff, x, -1, 'g', '.') > 0);
+      CHECK_EQUAL(x, strtod(buff, nullptr));
+      CHECK(!readsBackShorter(x, significantDigits(buff) - 1));
+    }
+  }
+
+  TEST(ReadFloatsMatchStrtod)
+  {
+    Random random;
+    char numeral[128];
+    int32_t total = 0;
+    int32_t exact = 0;
+    auto check = [&](const char* s) {
+      lua_Number result;
+      const char* end = luai_str2flt(s, &result);
+      ++total;
+      if (end == nullptr)
+        return;  // left to strtod
+      ++exact;
+      const double expected = strtod(s, nullptr);
+      CHECK_EQUAL(0, memcmp(&expected, &result, sizeof(result)));
+      CHECK_EQUAL('\0', *end);
+    };
+    for (int32_t i = 0; i < 20000; ++i)
+    {
+      const double x = random.nextDouble();
+      for (int32_t digits = 1; digits <= 17; ++digits)
+      {
+        snprintf(numeral, sizeof(numeral), "%.*g", digits, x);
+        check(numeral);
+      }
+      snprintf(numeral, sizeof(numeral), "%.*f", static_cast<int32_t>(random.next() % 25), x / 1e10);
+      check(numeral);
+      // halfway between two floats (exact in long double), then a bit off
+      const long double mid = (static_cast<long double>(x) + nextafter(x, 2 * x + 1)) / 2;
+      snprintf(numeral, sizeof(numeral), "%.40Le", mid);
+      check(numeral);
+      snprintf(numeral, sizeof(numeral), "%.25Le", mid);
+      check(numeral);
+      // long digit strings
+      std::string digits = " ";
+      for (int32_t d = static_cast<int32_t>(random.next() % 40); d >= 0; --d)
+        digits += static_cast<char>('0' + random.next() % 10);
+      digits += ".";
+      digits += std::to_string(random.next() % 1000000);
+      digits += "e" + std::to_string(static_cast<int32_t>(random.next() % 700) - 350) + " ";
+      check(digits.c_str());
+    }
+    CHECK(exact > total * 9 / 10);  // most numerals are read here
+
+    const char* const extremes[] = {
+      "0", "0.0", "-0.0", ".5", "5.", "1e308", "1.8e308", "1e-308", "4.9e-324",
+      "2.4e-324", "1e-400", "1e400", "123456789012345678901234567890", "0.000000000000000000001"
+    };
+    for (const char* s: extremes)
+      check(s);
+  }
+
+  TEST(ReadFloatsRejects)
+  {
+    const char* const numerals[] = {
+      "", "  ", "-", ".", "e5", "1e", "1e+", "0x10", "inf", "nan", "1.2.3", "1 2", "1e5x"
+    };
+    for (const char* s: numerals)
+    {
+      lua_Number result;
+      CHECK(luai_str2flt(s, &result) == nullptr);
+    }
+  }
+
+  TEST(ToNumberFromLua)
+  {
+    LuaPrinter printer;
+
+    CHECK_EQUAL(printer.runCommand("tonumber(' 0.1 ') == 1/10"), "true");
+    CHECK_EQUAL(printer.runCommand("tonumber('1e400') == math.huge"), "true");
+    CHECK_EQUAL(printer.runCommand("tonumber('-1e-400')"), "-0.0");
+    CHECK_EQUAL(printer.runCommand("tonumber('0x1p4')"), "16.0");
+    CHECK_EQUAL(printer.runCommand("tonumber('1e')"), "nil");
+    CHECK_EQUAL(printer.runCommand("9007199254740993.0 == 2^53"), "true");
+  }
+
+  TEST(ToStringFromLua)
+  {
+    LuaPrinter printer;
+
+    CHECK_EQUAL(printer.runCommand("0.1"), "0.1");
+    CHECK_EQUAL(printer.runCommand("1e100"), "1e+100");
+    CHECK_EQUAL(printer.runCommand("-1.5e-7"), "-1.5e-07");
+    CHECK_EQUAL(printer.runCommand("2^10"), "1024.0");
+    CHECK_EQUAL(printer.runCommand("1/0"), "inf");
+    CHECK_EQUAL(printer.runCommand("-12345678"), "-12345678");
+    CHECK_EQUAL(printer.runCommand("string.format('%.3f|%e|%g|%d', 2.0625, 1/3, 1e-5, 42)"),
+                "2.062|3.333333e-01|1e-05|42");
+#if LUA_SHORTESTFLOATS
+    CHECK_EQUAL(printer.runCommand("1/3"), "0.3333333333333333");
+    CHECK_EQUAL(printer.runCommand("2^53"), "9007199254740992.0");
+    CHECK_EQUAL(printer.runCommand("-2^63"), "-9.223372036854776e+18");
+#else
+    CHECK_EQUAL(printer.runCommand("1/3"), "0.33333333333333");
+    CHECK_EQUAL(printer.runCommand("2^53"), "9.007199254741e+15");
+    CHECK_EQUAL(printer.runCommand("-2^63"), "-9.2233720368548e+18");
+#endif
+  }
+}
@@ -0,0 +1,136 @@
+#include <LuaPrinter.hpp>
+#include <lua.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  // the compiled patterns kept by the string library, and their number
+  void openCache(LuaPrinter& printer)
+  {
+    printer.scriptCommand("P = debug.getregistry()._PATTERNS");
+    printer.scriptCommand("function count () local n = 0 for _ in pairs(P) do n = n + 1 end return n end");
+  }
+}
+
+SUITE(PatternCache)
+{
+  TEST(AnchoredPatterns)
+  {
+    LuaPrinter printer;
+
+    for (int32_t i = 0; i < 2; ++i)  // then with the programs in the cache
+    {
+      CHECK_EQUAL(printer.runCommand("('aab'):find('^a')"), "1");
+      CHECK_EQUAL(printer.runCommand("('baa'):find('^a')"), "nil");
+      CHECK_EQUAL(printer.runCommand("('baa'):find('^a', 2)"), "2");
+      CHECK_EQUAL(printer.runCommand("('baa'):match('^a+')"), "nil");
+      CHECK_EQUAL(printer.runCommand("('aab'):match('^(a+)b')"), "aa");
+      CHECK_EQUAL(printer.runCommand("('aaa'):gsub('^a', 'b')"), "baa");
+      CHECK_EQUAL(printer.runCommand("select(2, ('aaa'):gsub('^a', 'b'))"), "1");
+
+      // in 'gmatch' a '^' is not an anchor but a plain character
+      CHECK_EQUAL(printer.runCommand("(function () local n = 0 for _ in ('aaa'):gmatch('^a') do n = n + 1 end return n end)()"), "0");
+      CHECK_EQUAL(printer.runCommand("(function () local s = '' for w in ('^a^ab^a'):gmatch('^a') do s = s .. w end return s end)()"), "^a^a^a");
+    }
+  }
+
+  TEST(MalformedPatterns)
+  {
+    LuaPrinter printer;
+
+    for (int32_t i = 0; i < 2; ++i)  // errors every time
+    {
+      CHECK_EQUAL(printer.runCommand("select(2, pcall(string.find, 'abc', '[a'))"), "malformed pattern (missing ']')");
+      CHECK_EQUAL(printer.runCommand("select(2, pcall(string.match, 'abc', 'a%'))"), "malformed pattern (ends with '%')");
+      CHECK_EQUAL(printer.runCommand("select(2, pcall(string.find, 'abc', '(a'))"), "unfinished capture");
+      CHECK_EQUAL(printer.runCommand("select(2, pcall(string.find, 'abc', '%1'))"), "invalid capture index %1");
+    }
+
+    // an error is raised only when the matcher reaches it
+    CHECK_EQUAL(printer.runCommand("('abc'):find('z[a')"), "nil");
+    CHECK_EQUAL(printer.runCommand("select(2, pcall(string.find, 'zbc', 'z[a'))"), "malformed pattern (missing ']')");
+    CHECK_EQUAL(printer.runCommand("('abc'):find('z[a')"), "nil");
+  }
+
+#if LUA_USE_PATTERNCACHE
+  TEST(HitsAcrossFunctions)
+  {
+    LuaPrinter printer;
+
+    openCache(printer);
+    printer.scriptCommand("collectgarbage('stop')");
+    CHECK_EQUAL(printer.runCommand("count()"), "0");
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):find('%a%d+')"), "3");
+    CHECK_EQUAL(printer.runCommand("count()"), "1");
+    printer.scriptCommand("cp = P['%a%d+']");
+    CHECK_EQUAL(printer.runCommand("type(cp)"), "userdata");
+
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):match('%a%d+')"), "a12");
+    CHECK_EQUAL(printer.runCommand("(function () local s = '' for w in ('x a12 b3'):gmatch('%a%d+') do s = s .. w end return s end)()"), "a12b3");
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):gsub('%a%d+', '#')"), "x # #");
+    CHECK_EQUAL(printer.runCommand("count()"), "1");  // one program for all
+    CHECK_EQUAL(printer.runCommand("P['%a%d+'] == cp"), "true");
+
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):find('%a%d+', 4)"), "7");
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):match('(%a)(%d+)')"), "a");
+    CHECK_EQUAL(printer.runCommand("count()"), "2");
+
+    // plain finds and long patterns do not compile
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):find('%a', 1, true)"), "nil");
+    CHECK_EQUAL(printer.runCommand("('x a12 b3'):find(string.rep('a?', 200))"), "1");
+    CHECK_EQUAL(printer.runCommand("count()"), "2");
+  }
+
+  TEST(AnchoredPatternsInCache)
+  {
+    LuaPrinter printer;
+
+    openCache(printer);
+    printer.scriptCommand("collectgarbage('stop')");
+    CHECK_EQUAL(printer.runCommand("('aab'):find('^a')"), "1");
+    CHECK_EQUAL(printer.runCommand("P['^a'] ~= nil"), "true");
+    // 'gmatch' does not use the anchored program
+    CHECK_EQUAL(printer.runCommand("(function () local n = 0 for _ in ('aaa'):gmatch('^a') do n = n + 1 end return n end)()"), "0");
+    CHECK_EQUAL(printer.runCommand("count()"), "1");
+  }
+
+  TEST(MalformedPatternsNotCached)
+  {
+    LuaPrinter printer;
+
+    openCache(printer);
+    printer.scriptCommand("collectgarbage('stop')");
+    printer.scriptCommand("pcall(string.find, 'abc', '[a')");
+    printer.scriptCommand("pcall(string.match, 'abc', 'a%')");
+    printer.scriptCommand("pcall(string.gmatch('abc', '[a'))");
+    printer.scriptCommand("pcall(string.gsub, 'abc', '%b', '')");
+    CHECK_EQUAL(printer.runCommand("('abc'):find('z[a')"), "nil");
+    CHECK_EQUAL(printer.runCommand("count()"), "0");
+  }
+
+  TEST(EvictedByCollector)
+  {
+    LuaPrinter printer;
+
+    openCache(printer);
+    CHECK_EQUAL(printer.runCommand("('x a12'):find('%a%d+')"), "3");
+    CHECK_EQUAL(printer.runCommand("P['%a%d+'] ~= nil"), "true");
+    printer.scriptCommand("collectgarbage()");
+    CHECK_EQUAL(printer.runCommand("count()"), "0");
+
+    // an iterator keeps its program
+    printer.scriptCommand("it = ('a1 b2 c3'):gmatch('%a%d')");
+    CHECK_EQUAL(printer.runCommand("it()"), "a1");
+    printer.scriptCommand("collectgarbage()");
+    CHECK_EQUAL(printer.runCommand("count()"), "1");
+    CHECK_EQUAL(printer.runCommand("it()"), "b2");
+    printer.scriptCommand("it = nil collectgarbage()");
+    CHECK_EQUAL(printer.runCommand("count()"), "0");
+
+    // compiled again when needed
+    CHECK_EQUAL(printer.runCommand("('x a12'):match('%a%d+')"), "a12");
+    CHECK_EQUAL(printer.runCommand("count()"), "1");
+  }
+#endif
+}
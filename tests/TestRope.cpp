@@ -0,0 +1,188 @@
+#include <cstring>
+#include <LuaPrinter.hpp>
+#include <lstate.hpp>
+#include <lstring.hpp>
+#include <lua.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  // is the global 'name' a string not flattened yet?
+  bool isRope(lua_State* L, const char* name)
+  {
+    lua_getglobal(L, name);
+    const bool rope = ttisstring(L->top - 1) && !isflat(tsvalue(L->top - 1));
+    lua_pop(L, 1);
+    return rope;
+  }
+
+  // the global 'r' is ((a .. b) .. (a .. b)) .. a, for pieces of 600 bytes
+  void makeRope(LuaPrinter& printer)
+  {
+    printer.scriptCommand("a = string.rep('a', 600) b = string.rep('b', 600)");
+    printer.scriptCommand("r = ((a .. b) .. (a .. b)) .. a");
+  }
+
+  const std::string a(600, 'a');
+  const std::string b(600, 'b');
+  const std::string flat = a + b + a + b + a;
+}
+
+SUITE(Rope)
+{
+  TEST(ToLString)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    makeRope(printer);
+    CHECK_EQUAL(bool(LUA_USE_ROPES), isRope(L, "r"));
+    lua_getglobal(L, "r");
+    size_t len;
+    const char* s = lua_tolstring(L, -1, &len);
+    CHECK_EQUAL(flat.size(), len);
+    CHECK_EQUAL(flat, std::string(s, len));
+    CHECK_EQUAL(flat.size(), strlen(s));  // terminated
+    lua_pop(L, 1);
+    CHECK(!isRope(L, "r"));  // flattened for good
+  }
+
+  TEST(Length)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("#r"), std::to_string(flat.size()));
+    CHECK_EQUAL(bool(LUA_USE_ROPES), isRope(L, "r"));  // no need to flatten
+    CHECK_EQUAL(printer.runCommand("#(r .. r)"), std::to_string(2 * flat.size()));
+  }
+
+  TEST(Comparison)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    makeRope(printer);
+    printer.scriptCommand("f = string.rep('a', 600) .. string.rep('b', 600)");
+    printer.scriptCommand("f = f .. f .. string.rep('a', 600)");
+    printer.scriptCommand("r2 = (a .. (b .. a)) .. (b .. a)");  // same bytes, other tree
+    CHECK_EQUAL(printer.runCommand("r == r2"), "true");
+    CHECK_EQUAL(printer.runCommand("r == f"), "true");
+    CHECK_EQUAL(printer.runCommand("r ~= r .. 'x'"), "true");
+    CHECK(!isRope(L, "r"));
+    CHECK(!isRope(L, "r2"));
+
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("r < r .. 'x'"), "true");
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("r <= b"), "true");
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("b > r"), "true");
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("rawequal(r, f)"), "true");
+    makeRope(printer);
+    lua_getglobal(L, "r");
+    lua_getglobal(L, "f");
+    CHECK(lua_rawequal(L, -1, -2));
+    CHECK(lua_compare(L, -1, -2, LUA_OPEQ));
+    lua_pop(L, 2);
+  }
+
+  TEST(TableKey)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    makeRope(printer);
+    printer.scriptCommand("f = a .. b .. a .. b .. a");
+    printer.scriptCommand("t = {} t[r] = 1");
+    CHECK(!isRope(L, "r"));
+    CHECK_EQUAL(printer.runCommand("t[f]"), "1");
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("t[r]"), "1");  // a rope to look up
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("rawget(t, r)"), "1");
+    makeRope(printer);
+    CHECK_EQUAL(printer.runCommand("next({[r] = 2}) == f"), "true");
+    printer.scriptCommand("t[(a .. b) .. (a .. b) .. a] = nil");
+    CHECK_EQUAL(printer.runCommand("next(t)"), "nil");
+
+    lua_getglobal(L, "t");
+    makeRope(printer);
+    lua_getglobal(L, "r");
+    lua_pushinteger(L, 3);
+    lua_settable(L, -3);
+    lua_pushlstring(L, flat.data(), flat.size());
+    lua_gettable(L, -2);
+    CHECK_EQUAL(3, lua_tointeger(L, -1));
+    lua_pop(L, 2);
+  }
+
+  TEST(ToNumber)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    printer.scriptCommand("n = string.rep(' ', 600) .. '42'");
+    CHECK_EQUAL(bool(LUA_USE_ROPES), isRope(L, "n"));
+    CHECK_EQUAL(printer.runCommand("tonumber(n)"), "42");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '0x10'");
+    CHECK_EQUAL(printer.runCommand("math.type(tonumber(n))"), "integer");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '2.5' .. string.rep(' ', 600)");
+    CHECK_EQUAL(printer.runCommand("tonumber(n) * 2"), "5.0");
+    printer.scriptCommand("n = string.rep(' ', 600) .. 'x'");
+    CHECK_EQUAL(printer.runCommand("tonumber(n)"), "nil");
+
+    printer.scriptCommand("n = string.rep(' ', 600) .. '7'");
+    lua_getglobal(L, "n");
+    int32_t isnum = 0;
+    CHECK_EQUAL(7, lua_tointegerx(L, -1, &isnum));
+    CHECK(isnum);
+    lua_pop(L, 1);
+  }
+
+  // arithmetic on a rope fails to convert it, and 'luaT_trybinTM'
+  // flattens it and tries again
+  TEST(Arithmetic)
+  {
+    LuaPrinter printer;
+    lua_State* L = printer.getState();
+
+    printer.scriptCommand("n = string.rep(' ', 600) .. '42'");
+    CHECK_EQUAL(printer.runCommand("n + 1"), "43.0");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '42'");
+    CHECK_EQUAL(printer.runCommand("1 + n"), "43.0");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '42'");
+    printer.scriptCommand("m = string.rep(' ', 600) .. '8'");
+    CHECK_EQUAL(printer.runCommand("n - m"), "34.0");
+    CHECK(!isRope(L, "n"));
+    CHECK(!isRope(L, "m"));
+    printer.scriptCommand("n = string.rep(' ', 600) .. '42'");
+    CHECK_EQUAL(printer.runCommand("-n"), "-42.0");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '6'");
+    CHECK_EQUAL(printer.runCommand("n | 1"), "7");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '6'");
+    CHECK_EQUAL(printer.runCommand("~n"), "-7");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '1.5'");
+    CHECK_EQUAL(printer.runCommand("n // 1"), "1.0");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '6'");
+    lua_getglobal(L, "n");
+    lua_pushinteger(L, 2);
+    lua_arith(L, LUA_OPMUL);
+    CHECK_EQUAL(12, lua_tointeger(L, -1));
+    lua_pop(L, 1);
+
+    // still an error when the flat string is not a number
+    printer.scriptCommand("n = string.rep(' ', 600) .. 'x'");
+    CHECK_EQUAL(printer.runCommand("select(2, pcall(function () return n + 1 end)):match('perform arithmetic on a string value') ~= nil"), "true");
+    printer.scriptCommand("n = string.rep(' ', 600) .. '1.5'");
+    CHECK_EQUAL(printer.runCommand("select(2, pcall(function () return n | 1 end)):match('has no integer representation') ~= nil"), "true");
+
+    // a metamethod for strings still runs after the retry
+    printer.scriptCommand("getmetatable('').__add = function (x, y) return 'added' end");
+    printer.scriptCommand("n = string.rep(' ', 600) .. 'x'");
+    CHECK_EQUAL(printer.runCommand("n + 1"), "added");
+  }
+}
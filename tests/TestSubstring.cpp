@@ -0,0 +1,167 @@
+#include <cstring>
+#include <LuaPrinter.hpp>
+#include <lstate.hpp>
+#include <lua.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  // 100 distinct bytes, so that every substring is long enough to be a slice
+  std::string makeText()
+  {
+    std::string text;
+    for (int32_t i = 0; i < 100; ++i)
+      text += static_cast<char>('0' + i % 75);
+    return text;
+  }
+
+  std::string getString(lua_State* L, int32_t index = -1)
+  {
+    size_t len;
+    const char* s = lua_tolstring(L, index, &len);
+    return std::string(s, len);
+  }
+
+  size_t totalBytes(lua_State* L)
+  {
+    return static_cast<size_t>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+  }
+
+  // a tail of a string 50 times longer, the only reference to its parent
+  void pushLoneSlice(lua_State* L, size_t len)
+  {
+    const std::string text = std::string(49 * len, '-') + std::string(len, 's');
+    lua_pushlstring(L, text.data(), text.size());
+    lua_pushsubstring(L, -1, 49 * len, len);
+    lua_remove(L, -2);
+  }
+
+  // keeps the bytes of the slice in argument 1 while running the collector
+  int32_t holdSlice(lua_State* L)
+  {
+    size_t len;
+    const char* s = lua_tolstring(L, 1, &len);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    const std::string other(50 * len, 'o');  // reuse freed memory
+    lua_pushlstring(L, other.data(), other.size());
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_pushboolean(L, std::string(s, len) == std::string(len, 's'));
+    return 1;
+  }
+}
+
+SUITE(Substring)
+{
+  TEST(PushSubstring)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    const std::string text = makeText();
+
+    lua_pushlstring(L, text.data(), text.size());
+    lua_pushsubstring(L, 1, 10, 80);
+    CHECK_EQUAL(2, lua_gettop(L));
+    CHECK_EQUAL(text.substr(10, 80), getString(L));
+    CHECK_EQUAL(80u, strlen(lua_tostring(L, -1)));  // terminated when read
+
+    lua_pushsubstring(L, -1, 5, 70);  // substring of a substring
+    CHECK_EQUAL(text.substr(15, 70), getString(L));
+
+    lua_pushsubstring(L, 1, 0, text.size());  // the whole string
+    CHECK_EQUAL(text, getString(L));
+    CHECK(lua_rawequal(L, 1, -1));
+
+    lua_pushsubstring(L, 1, 98, 2);  // short
+    CHECK_EQUAL(text.substr(98), getString(L));
+
+    lua_pushsubstring(L, 1, text.size(), 0);  // empty, at the end
+    CHECK_EQUAL("", getString(L));
+  }
+
+  TEST(PushSubstringOutlivesParent)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    const std::string text = makeText();
+
+    lua_pushlstring(L, text.data(), text.size());
+    lua_pushsubstring(L, 1, 20, 70);
+    lua_remove(L, 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_pushlstring(L, text.data(), text.size());  // reuse freed memory
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    CHECK_EQUAL(text.substr(20, 70), getString(L, 1));
+  }
+
+  TEST(PushSubstringAsKey)
+  {
+    lua_State state;
+    lua_State* L = &state;
+    const std::string text = makeText();
+
+    lua_newtable(L);
+    lua_pushlstring(L, text.data(), text.size());
+    lua_pushsubstring(L, 2, 0, 40);  // a short string equal to an interned one
+    lua_pushinteger(L, 1);
+    lua_rawset(L, 1);
+    lua_pushsubstring(L, 2, 10, 64);  // a long one
+    lua_pushinteger(L, 2);
+    lua_rawset(L, 1);
+
+    lua_pushlstring(L, text.data(), 40);
+    lua_rawget(L, 1);
+    CHECK_EQUAL(1, lua_tointeger(L, -1));
+    lua_pushlstring(L, text.data() + 10, 64);
+    lua_rawget(L, 1);
+    CHECK_EQUAL(2, lua_tointeger(L, -1));
+  }
+
+  TEST(ExposedSliceKeepsItsBytes)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_pushcfunction(L, holdSlice);
+    pushLoneSlice(L, 1000);
+    CHECK_EQUAL(LUA_OK, lua_pcall(L, 1, 1, 0));
+    CHECK(lua_toboolean(L, -1));
+  }
+
+#if LUA_USE_SLICES
+  TEST(LoneSliceIsCompacted)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    const size_t before = totalBytes(L);
+    pushLoneSlice(L, 10000);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    CHECK(totalBytes(L) < before + 2 * 10000);  // the parent is gone
+    CHECK_EQUAL(std::string(10000, 's'), getString(L));
+  }
+#endif
+
+  TEST(SubstringFunctions)
+  {
+    LuaPrinter printer;
+
+    printer.scriptCommand("s = string.rep('abcdefghij', 20)");
+    CHECK_EQUAL(printer.runCommand("s:sub(11, 90) == string.rep('abcdefghij', 8)"), "true");
+    CHECK_EQUAL(printer.runCommand("#s:sub(-100)"), "100");
+    CHECK_EQUAL(printer.runCommand("#s:sub(150, 1000)"), "51");
+    CHECK_EQUAL(printer.runCommand("#s:sub(300)"), "0");
+    CHECK_EQUAL(printer.runCommand("s:sub(3, 72):sub(2, 66):sub(1, 1)"), "d");
+    CHECK_EQUAL(printer.runCommand("#select(2, s:match('(j)(' .. string.rep('.', 70) .. ')'))"), "70");
+    CHECK_EQUAL(printer.runCommand("(function () local n = 0 for w in s:gmatch(string.rep('.', 66)) do n = n + #w end return n end)()"), "198");
+
+    // library functions keep reading a slice while the collector runs
+    printer.scriptCommand("t = string.rep('x', 16000) .. string.rep('abcd', 1000)");
+    printer.scriptCommand("t = t:sub(16001)");
+    CHECK_EQUAL(printer.runCommand("(function () local n = 0 for c in t:gmatch('.') do n = n + 1; if n % 97 == 0 then collectgarbage() end end return n end)()"), "4000");
+    printer.scriptCommand("t = string.rep('y', 16000) .. string.rep('efgh', 1000)");
+    printer.scriptCommand("t = t:sub(16001)");
+    CHECK_EQUAL(printer.runCommand("t:gsub('e', function () collectgarbage() return 'E' end) == string.rep('Efgh', 1000)"), "true");
+  }
+}
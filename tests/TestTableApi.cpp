@@ -0,0 +1,201 @@
+#include <climits>
+#include <limits>
+#include <lauxlib.hpp>
+#include <lstate.hpp>
+#include <lua.hpp>
+#include <lualib.hpp>
+#include <string>
+#include <UnitTest++.h>
+
+namespace
+{
+  lua_Integer getInteger(lua_State* L, int32_t tableIndex, lua_Integer key)
+  {
+    lua_rawgeti(L, tableIndex, key);
+    lua_Integer result = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    return result;
+  }
+
+  std::string getString(lua_State* L, int32_t tableIndex, const char* key)
+  {
+    lua_pushstring(L, key);
+    lua_rawget(L, tableIndex);
+    std::string result = lua_isstring(L, -1) ? lua_tostring(L, -1) : "(not a string)";
+    lua_pop(L, 1);
+    return result;
+  }
+
+  // Runs 'function' in protected mode and returns its error message, if any.
+  std::string protectedCall(lua_State* L, lua_CFunction function)
+  {
+    lua_pushcfunction(L, function);
+    if (lua_pcall(L, 0, 0, 0) == LUA_OK)
+      return std::string();
+    std::string message = lua_tostring(L, -1);
+    lua_pop(L, 1);
+    return message;
+  }
+
+  int32_t setNilKey(lua_State* L)
+  {
+    lua_newtable(L);
+    lua_pushstring(L, "a");
+    lua_pushinteger(L, 1);
+    lua_pushnil(L);
+    lua_pushinteger(L, 2);
+    lua_rawsetpairs(L, 1, 2);
+    return 0;
+  }
+
+  int32_t setNaNKey(lua_State* L)
+  {
+    lua_newtable(L);
+    lua_pushnumber(L, std::numeric_limits<lua_Number>::quiet_NaN());
+    lua_pushinteger(L, 1);
+    lua_rawsetpairs(L, 1, 1);
+    return 0;
+  }
+
+  int32_t reserveTooMuch(lua_State* L)
+  {
+    lua_newtable(L);
+    lua_reservetable(L, 1, 0, INT_MAX);
+    return 0;
+  }
+}
+
+SUITE(TableApi)
+{
+  TEST(RawSetNFillsArray)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_newtable(L);
+    for (lua_Integer i = 1; i <= 5; ++i)
+      lua_pushinteger(L, i * 10);
+    lua_rawsetn(L, 1, 1, 5);
+    CHECK_EQUAL(1, lua_gettop(L));
+    CHECK_EQUAL(5u, lua_rawlen(L, 1));
+
+    // continue right after the array part, overwriting the last element
+    for (lua_Integer i = 5; i <= 8; ++i)
+      lua_pushinteger(L, i * 100);
+    lua_rawsetn(L, 1, 5, 4);
+    CHECK_EQUAL(8u, lua_rawlen(L, 1));
+    CHECK_EQUAL(40, getInteger(L, 1, 4));
+    CHECK_EQUAL(500, getInteger(L, 1, 5));
+    CHECK_EQUAL(800, getInteger(L, 1, 8));
+
+    // no values is a no-op
+    lua_rawsetn(L, 1, 1, 0);
+    CHECK_EQUAL(1, lua_gettop(L));
+    CHECK_EQUAL(10, getInteger(L, 1, 1));
+  }
+
+  TEST(RawSetNOutsideArray)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_newtable(L);
+    lua_pushinteger(L, -1);
+    lua_pushinteger(L, 0);
+    lua_pushinteger(L, 1);
+    lua_rawsetn(L, 1, -1, 3);
+    CHECK_EQUAL(-1, getInteger(L, 1, -1));
+    CHECK_EQUAL(0, getInteger(L, 1, 0));
+    CHECK_EQUAL(1, getInteger(L, 1, 1));
+
+    lua_pushinteger(L, 1000);
+    lua_pushinteger(L, 1001);
+    lua_rawsetn(L, 1, 1000, 2);
+    CHECK_EQUAL(1000, getInteger(L, 1, 1000));
+    CHECK_EQUAL(1001, getInteger(L, 1, 1001));
+    CHECK_EQUAL(1u, lua_rawlen(L, 1));
+  }
+
+  TEST(RawSetNKeepsCollectables)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_newtable(L);
+    lua_gc(L, LUA_GCCOLLECT, 0);  // make the table old (black) first
+    for (int32_t i = 1; i <= 100; ++i)
+      lua_pushfstring(L, "value %d", i);
+    lua_rawsetn(L, 1, 1, 100);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    lua_rawgeti(L, 1, 100);
+    CHECK_EQUAL("value 100", lua_tostring(L, -1));
+  }
+
+  TEST(RawSetPairs)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_newtable(L);
+    lua_pushstring(L, "x");
+    lua_pushstring(L, "first");
+    lua_pushinteger(L, 3);
+    lua_pushinteger(L, 30);
+    lua_pushnumber(L, 2.0);  // normalized to the integer key 2
+    lua_pushinteger(L, 20);
+    lua_pushstring(L, "x");  // a later pair wins
+    lua_pushfstring(L, "%s", "second");
+    lua_rawsetpairs(L, 1, 4);
+    CHECK_EQUAL(1, lua_gettop(L));
+    CHECK_EQUAL("second", getString(L, 1, "x"));
+    CHECK_EQUAL(20, getInteger(L, 1, 2));
+    CHECK_EQUAL(30, getInteger(L, 1, 3));
+
+    lua_rawsetpairs(L, 1, 0);
+    CHECK_EQUAL(1, lua_gettop(L));
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    CHECK_EQUAL("second", getString(L, 1, "x"));
+  }
+
+  TEST(RawSetPairsInvalidKeys)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    CHECK(protectedCall(L, setNilKey).find("index is nil") != std::string::npos);
+    CHECK(protectedCall(L, setNaNKey).find("index is NaN") != std::string::npos);
+    CHECK_EQUAL(0, lua_gettop(L));
+  }
+
+  TEST(ReserveTable)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    lua_newtable(L);
+    lua_pushstring(L, "kept");
+    lua_setfield(L, 1, "name");
+    lua_reservetable(L, 1, 100, 50);
+    CHECK_EQUAL("kept", getString(L, 1, "name"));
+    for (lua_Integer i = 1; i <= 100; ++i)
+    {
+      lua_pushinteger(L, i);
+      lua_rawseti(L, 1, i);
+    }
+    CHECK_EQUAL(100u, lua_rawlen(L, 1));
+
+    // it never shrinks the table
+    lua_reservetable(L, 1, 0, 0);
+    CHECK_EQUAL(100u, lua_rawlen(L, 1));
+    CHECK_EQUAL(100, getInteger(L, 1, 100));
+    CHECK_EQUAL("kept", getString(L, 1, "name"));
+  }
+
+  TEST(ReserveTableOverflow)
+  {
+    lua_State state;
+    lua_State* L = &state;
+
+    CHECK(protectedCall(L, reserveTooMuch).find("table overflow") != std::string::npos);
+  }
+}
@@ -0,0 +1,61 @@
+-- Allocation-heavy workloads (compare builds with LUA_USE_ARENA ON and
+-- OFF, that is, the size-class arena against malloc). Run one case with
+-- its name as argument, or all of them. Where /proc is available, the
+-- peak resident size of the process so far is printed as well.
+
+local N = 3000000
+
+-- peak resident size in MB, or nil
+local function peak ()
+  local f = io.open("/proc/self/status")
+  if not f then return nil end
+  local s = f:read("a")
+  f:close()
+  local kb = s:match("VmHWM:%s+(%d+)")
+  return kb and tonumber(kb) // 1024
+end
+
+local function bench (name, f)
+  collectgarbage(); collectgarbage()
+  local t0 = os.clock()
+  f()
+  local mb = peak()
+  print(string.format("%-12s %.3f%s", name, os.clock() - t0,
+                      mb and string.format("  peak %d MB", mb) or ""))
+end
+
+local mode = arg and arg[1]
+
+-- small objects (tables, closures, strings) with a steady live set
+if mode == nil or mode == "small" then
+  bench("small", function ()
+    local keep = {}
+    for i = 1, N do
+      keep[i % 50000 + 1] = {i, function () return i end, "s" .. i}
+    end
+  end)
+end
+
+-- tables of mixed sizes that grow element by element
+if mode == nil or mode == "mixed" then
+  bench("mixed", function ()
+    local keep = {}
+    for r = 1, 30 do
+      for i = 1, 5000 do
+        local t = {}
+        for j = 1, i % 40 do t[j] = {j} end
+        keep[i] = t
+      end
+    end
+  end)
+end
+
+-- strings of all sizes up to a few hundred bytes
+if mode == nil or mode == "strings" then
+  bench("strings", function ()
+    local keep = {}
+    for i = 1, N // 3 * 2 do
+      keep[i % 20000 + 1] = string.rep("a", i % 300) .. i
+    end
+  end)
+end
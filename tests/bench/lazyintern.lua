@@ -0,0 +1,62 @@
+-- Short strings built at run time (compare builds with LUA_USE_LAZYINTERN
+-- ON and OFF). Run one case with its name as argument, or all of them.
+
+local N = 3000000
+
+local function bench (name, f)
+  collectgarbage(); collectgarbage()
+  local t0 = os.clock()
+  f()
+  print(string.format("%-12s %.3f", name, os.clock() - t0))
+end
+
+local mode = arg and arg[1]
+
+-- built strings that are thrown away
+if mode == nil or mode == "concat" then
+  bench("concat", function ()
+    local n = 0
+    for i = 1, N do local s = "item" .. i .. ":" .. (i * 7); n = n + #s end
+  end)
+end
+
+if mode == nil or mode == "sub" then
+  bench("sub/format", function ()
+    local src = string.rep("abcdefghij", 4)
+    local n = 0
+    for i = 1, N do
+      local s = src:sub(i % 10 + 1, i % 10 + 20)
+      local f = string.format("%d-%d", i, i % 97)
+      n = n + #s + #f
+    end
+  end)
+end
+
+-- built strings used as keys or compared (the lazy mode pays here)
+if mode == nil or mode == "lookup" then
+  bench("lookup", function ()
+    local t = {}
+    for i = 1, 1000 do t["key" .. i] = i end
+    local n = 0
+    for i = 1, N do n = n + t["key" .. (i % 1000 + 1)] end
+  end)
+end
+
+if mode == nil or mode == "newkeys" then
+  bench("newkeys", function ()
+    for r = 1, 10 do
+      local t = {}
+      for i = 1, N // 10 do t["k" .. i] = i end
+    end
+  end)
+end
+
+if mode == nil or mode == "eq" then
+  bench("eq", function ()
+    local n = 0
+    local a = "prefix"
+    for i = 1, N do
+      if a .. (i % 10) == "prefix5" then n = n + 1 end
+    end
+  end)
+end
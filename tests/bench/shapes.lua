@@ -0,0 +1,62 @@
+-- Tables with string keys (compare builds with LUA_USE_SHAPES ON and
+-- OFF). Run one case with its name as argument, or all of them. Each
+-- case prints its time and the memory its live tables take.
+
+local mode = arg and arg[1]
+
+local function bench (name, f)
+  collectgarbage(); collectgarbage()
+  local base = collectgarbage("count")
+  local t0 = os.clock()
+  local keep = f()
+  collectgarbage(); collectgarbage()
+  print(string.format("%-12s %.3f  %.1f MB", name, os.clock() - t0,
+                      (collectgarbage("count") - base) / 1024))
+  return keep
+end
+
+-- objects of one class: all tables share one chain of shapes
+if mode == nil or mode == "class" then
+  bench("class", function ()
+    local keep = {}
+    for i = 1, 200000 do
+      keep[i] = {x = i, y = i, vx = 1, vy = 2, name = "p"}
+    end
+    return keep
+  end)
+end
+
+-- dictionaries whose keys no other table has
+if mode == nil or mode == "dict" then
+  bench("dict", function ()
+    local keep = {}
+    for i = 1, 20000 do
+      local t = {}
+      for j = 1, 20 do t["k" .. i .. "_" .. j] = j end
+      keep[i] = t
+    end
+    return keep
+  end)
+end
+
+-- a class with many fields, read by many lookups
+if mode == nil or mode == "wide" then
+  bench("wide", function ()
+    local names = {}
+    for j = 1, 24 do names[j] = "f" .. j end
+    local keep = {}
+    for i = 1, 20000 do
+      local t = {}
+      for j = 1, 24 do t[names[j]] = j end
+      keep[i] = t
+    end
+    local s = 0
+    for r = 1, 20 do
+      for i = 1, 20000 do
+        local t = keep[i]
+        for j = 1, 24 do s = s + t[names[j]] end
+      end
+    end
+    return keep
+  end)
+end
@@ -0,0 +1,49 @@
+-- Plain substring search and patterns without specials (string.find).
+
+local function bench (name, f)
+  local t0 = os.clock()
+  local r = f()
+  print(string.format("%-24s %.3f", name, os.clock() - t0), r)
+end
+
+local words = {}
+for i = 1, 400000 do words[i] = ("w%x"):format(i * 2654435761 % 1000003) end
+local text = table.concat(words, " ")   -- about 3.4 MB
+local as = string.rep("a", 4 * 1024 * 1024) .. "ab"
+local spaces = string.rep("abc ", 1024 * 1024) .. "needle"
+
+-- rare first char: memchr does the work
+bench("plain 8-byte miss", function ()
+  local n = 0
+  for i = 1, 20 do if text:find("zzneedle", 1, true) then n = n + 1 end end
+  return n
+end)
+
+-- every position is a candidate
+bench("plain 'aab' in aaaa", function ()
+  local n = 0
+  for i = 1, 20 do n = n + as:find("aab", 1, true) end
+  return n
+end)
+
+bench("frequent 1st char", function ()
+  local n = 0
+  for i = 1, 20 do n = n + spaces:find(" needle", 1, true) end
+  return n
+end)
+
+-- short subjects, where the 'nospecials' test is most of the cost
+bench("nospecials short", function ()
+  local n = 0
+  local s = "GET /index.html HTTP/1.1"
+  for i = 1, 2000000 do if s:find("HTTP") then n = n + 1 end end
+  return n
+end)
+
+bench("nospecials 40-byte", function ()
+  local n = 0
+  local s = "x" .. string.rep("y", 60)
+  local p = string.rep("y", 40)
+  for i = 1, 1000000 do if s:find(p) then n = n + 1 end end
+  return n
+end)